@@ -0,0 +1,51 @@
+#include "chunkcache.h"
+
+
+namespace Airwave {
+
+
+std::mutex ChunkCache::mutex_;
+std::map<ChunkCache::Key, std::weak_ptr<Chunk>> ChunkCache::chunks_;
+
+
+u8* Chunk::data()
+{
+	return port.isNull() ? buffer.data() : port.frame<u8>();
+}
+
+
+std::shared_ptr<Chunk> ChunkCache::find(u64 hash, size_t size)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto it = chunks_.find(Key(hash, size));
+	if(it == chunks_.end())
+		return nullptr;
+
+	std::shared_ptr<Chunk> chunk = it->second.lock();
+	if(!chunk)
+		chunks_.erase(it);
+
+	return chunk;
+}
+
+
+void ChunkCache::insert(const std::shared_ptr<Chunk>& chunk)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// Drop the chunks released since the last insertion.
+	for(auto it = chunks_.begin(); it != chunks_.end();) {
+		if(it->second.expired()) {
+			it = chunks_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	chunks_[Key(chunk->hash, chunk->size)] = chunk;
+}
+
+
+} // namespace Airwave
@@ -0,0 +1,48 @@
+#ifndef COMMON_CHUNKCACHE_H
+#define COMMON_CHUNKCACHE_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "common/dataport.h"
+#include "common/types.h"
+
+
+namespace Airwave {
+
+
+// VST plugin chunk received from the host endpoint. The data is kept either in the
+// buffer, or in the transient port it was transferred through.
+struct Chunk {
+	u64 hash;
+	size_t size;
+	std::vector<u8> buffer;
+	DataPort port;
+
+	u8* data();
+};
+
+
+// Registry of the chunks shared by all of the plugin endpoints of the process. The
+// chunks are addressed by the hash of their content, so the instances of the same VST
+// plugin with the identical state use the single copy of the chunk. The registry
+// doesn't own the chunks, they are released with the last endpoint referencing them.
+class ChunkCache {
+public:
+	static std::shared_ptr<Chunk> find(u64 hash, size_t size);
+	static void insert(const std::shared_ptr<Chunk>& chunk);
+
+private:
+	using Key = std::pair<u64, size_t>;
+
+	static std::mutex mutex_;
+	static std::map<Key, std::weak_ptr<Chunk>> chunks_;
+};
+
+
+} // namespace Airwave
+
+
+#endif // COMMON_CHUNKCACHE_H
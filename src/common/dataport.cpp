@@ -1,7 +1,15 @@
 #include "dataport.h"
 
+#include <cerrno>
 #include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <signal.h>
+#include <syscall.h>
+#include <unistd.h>
+#include <linux/memfd.h>
 #include <sys/ipc.h>
+#include <sys/mman.h>
 #include <sys/shm.h>
 #include <sys/stat.h>
 #include "common/logger.h"
@@ -10,10 +18,38 @@
 namespace Airwave {
 
 
+static const u32 kRequestBitset  = 1 << 0;
+static const u32 kResponseBitset = 1 << 1;
+
+static const char* const kMemfdName = "airwave-port";
+static const size_t kPageSize = 4096;
+static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+
+DataPort::ControlBlock::ControlBlock(size_t frameSize, int flags) :
+	request(kRequestBitset),
+	response(kResponseBitset),
+	serviceTid(0),
+	frameSize(frameSize),
+	flags(flags),
+	attachCount(1),
+	creatorPid(getpid()),
+	peerPid(0)
+{
+}
+
+
 DataPort::DataPort() :
 	id_(-1),
+	fd_(-1),
+	owner_(0),
+	isCreator_(false),
+	bufferSize_(0),
 	frameSize_(0),
-	buffer_(nullptr)
+	buffer_(nullptr),
+	hasPriorityInheritance_(false),
+	isServing_(false),
+	serviceTid_(0)
 {
 }
 
@@ -24,7 +60,7 @@ DataPort::~DataPort()
 }
 
 
-bool DataPort::create(size_t frameSize)
+bool DataPort::create(size_t frameSize, int flags)
 {
 	if(!isNull()) {
 		ERROR("Unable to create, port is already created");
@@ -33,52 +69,85 @@ bool DataPort::create(size_t frameSize)
 
 	size_t bufferSize = sizeof(ControlBlock) + frameSize;
 
-	id_ = shmget(IPC_PRIVATE, bufferSize, S_IRUSR | S_IWUSR);
-	if(id_ < 0) {
-		ERROR("Unable to allocate %d bytes of shared memory", bufferSize);
+	if(!createMemfd(bufferSize, flags) && !createSystemV(bufferSize))
 		return false;
-	}
 
-	buffer_ = shmat(id_, nullptr, 0);
-	if(buffer_ == reinterpret_cast<void*>(-1)) {
-		ERROR("Unable to attach shared memory segment with id %d", id_);
-		shmctl(id_, IPC_RMID, nullptr);
-		id_ = -1;
-		return false;
-	}
+	isCreator_ = true;
+	frameSize_ = frameSize;
 
-	new (controlBlock()) ControlBlock;
+	new (controlBlock()) ControlBlock(frameSize, flags);
+
+	if(flags & kLockMemory)
+		lockMemory();
 
-	frameSize_ = frameSize;
 	return true;
 }
 
 
-bool DataPort::connect(int id)
+bool DataPort::connect(int id, pid_t owner)
 {
 	if(!isNull()) {
 		ERROR("Unable to connect on already initialized port");
 		return false;
 	}
 
-	buffer_ = shmat(id, nullptr, 0);
-	if(buffer_ == reinterpret_cast<void*>(-1)) {
-		ERROR("Unable to attach shared memory segment with id %d", id);
-		return false;
+	if(owner) {
+		std::string path = "/proc/" + std::to_string(owner) + "/fd/" +
+				std::to_string(id);
+
+		int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+		if(fd < 0) {
+			ERROR("Unable to open memory file %s", path.c_str());
+			return false;
+		}
+
+		struct stat info;
+		if(fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) <
+				sizeof(ControlBlock)) {
+			ERROR("Unable to get size of memory file %s", path.c_str());
+			close(fd);
+			return false;
+		}
+
+		bufferSize_ = info.st_size;
+		buffer_ = mmap(nullptr, bufferSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+		// The mapping keeps the memory alive, the descriptor isn't needed anymore.
+		close(fd);
+
+		if(buffer_ == MAP_FAILED) {
+			ERROR("Unable to map memory file %s", path.c_str());
+			buffer_ = nullptr;
+			return false;
+		}
 	}
+	else {
+		buffer_ = shmat(id, nullptr, 0);
+		if(buffer_ == reinterpret_cast<void*>(-1)) {
+			ERROR("Unable to attach shared memory segment with id %d", id);
+			buffer_ = nullptr;
+			return false;
+		}
 
-	shmid_ds info;
-	if(shmctl(id, IPC_STAT, &info) != 0) {
-		ERROR("Unable to get info about shared memory segment with id %d", id);
-		shmdt(buffer_);
-		id_ = -1;
-		return false;
+		// The segment will be destroyed after the last detach, even if some of the
+		// endpoints crashes.
+		shmctl(id, IPC_RMID, nullptr);
+
+		bufferSize_ = sizeof(ControlBlock) + controlBlock()->frameSize;
 	}
 
-	size_t bufferSize = info.shm_segsz;
-	frameSize_ = bufferSize - sizeof(ControlBlock);
+	ControlBlock* control = controlBlock();
+	frameSize_ = control->frameSize;
+
+	if(control->flags & kLockMemory)
+		lockMemory();
+
+	control->peerPid = getpid();
+	control->attachCount++;
 
 	id_ = id;
+	owner_ = owner;
+	isCreator_ = false;
 	return true;
 }
 
@@ -86,21 +155,39 @@ bool DataPort::connect(int id)
 void DataPort::disconnect()
 {
 	if(!isNull()) {
-		if(!isConnected()) {
-//			ControlBlock* control = controlBlock();
-//			sem_destroy(&control->request);
-//			sem_destroy(&control->response);
+		releaseService();
+		controlBlock()->attachCount--;
+
+		if(owner_) {
+			munmap(buffer_, bufferSize_);
+			releaseDescriptor();
+		}
+		else {
+			shmdt(buffer_);
+
+			if(isCreator_)
+				shmctl(id_, IPC_RMID, nullptr);
 		}
 
-		shmdt(buffer_);
-		shmctl(id_, IPC_RMID, nullptr);
 		id_ = -1;
+		owner_ = 0;
+		isCreator_ = false;
 		buffer_ = nullptr;
+		bufferSize_ = 0;
 		frameSize_ = 0;
 	}
 }
 
 
+void DataPort::releaseDescriptor()
+{
+	if(fd_ >= 0) {
+		close(fd_);
+		fd_ = -1;
+	}
+}
+
+
 bool DataPort::isNull() const
 {
 	return id_ < 0;
@@ -109,14 +196,16 @@ bool DataPort::isNull() const
 
 bool DataPort::isConnected() const
 {
-	shmid_ds info;
+	if(isNull())
+		return false;
 
-	if(shmctl(id_, IPC_STAT, &info) != 0) {
-		ERROR("Unable to get shared memory segment (%d) info", id_);
+	const ControlBlock* control = controlBlock();
+	if(control->attachCount < 2)
 		return false;
-	}
 
-	return info.shm_nattch > 1;
+	// The other endpoint could be terminated without detaching from the port.
+	pid_t pid = isCreator_ ? control->peerPid : control->creatorPid;
+	return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
 }
 
 
@@ -126,6 +215,12 @@ int DataPort::id() const
 }
 
 
+pid_t DataPort::owner() const
+{
+	return owner_;
+}
+
+
 size_t DataPort::frameSize() const
 {
 	return frameSize_;
@@ -140,27 +235,127 @@ void* DataPort::frameBuffer()
 
 void DataPort::sendRequest()
 {
-	if(!isNull())
-		controlBlock()->request.post();
+	if(!isNull()) {
+		ControlBlock* control = controlBlock();
+
+		// The serving thread owns the service lock until it sends the response. The lock
+		// is still owned if the previous request is being served (pipelined mode).
+		if(hasPriorityInheritance_) {
+			int tid = control->serviceTid;
+			if(tid)
+				control->service.assign(tid);
+		}
+
+		control->request.post();
+	}
 }
 
 
 void DataPort::sendResponse()
 {
-	if(!isNull())
-		controlBlock()->response.post();
+	if(!isNull()) {
+		ControlBlock* control = controlBlock();
+		control->response.post();
+
+		// The kernel hands the service lock over to the requester, if it is blocked on
+		// it, without any wake up of this thread.
+		if(isServing_)
+			control->service.release(serviceTid_);
+	}
+}
+
+
+bool DataPort::tryWaitRequest()
+{
+	ControlBlock* control = controlBlock();
+	if(!control->request.tryWait())
+		return false;
+
+	// Takes the lock, which was free when the request was sent (see sendRequest).
+	if(isServing_)
+		control->service.assign(serviceTid_);
+
+	return true;
 }
 
 
 bool DataPort::waitRequest(int msecs)
 {
-	return controlBlock()->request.wait(msecs);
+	ControlBlock* control = controlBlock();
+	if(!control->request.wait(msecs, &spinPolicy_))
+		return false;
+
+	if(isServing_)
+		control->service.assign(serviceTid_);
+
+	return true;
 }
 
 
 bool DataPort::waitResponse(int msecs)
 {
-	return controlBlock()->response.wait(msecs);
+	ControlBlock* control = controlBlock();
+
+	if(!hasPriorityInheritance_)
+		return control->response.wait(msecs, &spinPolicy_);
+
+	if(control->response.tryWait())
+		return true;
+
+	// Both waits share the same deadline, so the timeout is applied once.
+	timespec tm;
+	timespec* deadline = Event::deadline(msecs, &tm);
+
+	// Block on the service lock, so the serving thread inherits our priority until it
+	// sends the response. The response is posted by then, unless the lock was free.
+	if(!control->service.lockUntil(deadline))
+		return false;
+
+	control->service.unlock();
+	return control->response.waitUntil(deadline);
+}
+
+
+SpinPolicy* DataPort::spinPolicy()
+{
+	return &spinPolicy_;
+}
+
+
+bool DataPort::hasPriorityInheritance() const
+{
+	return hasPriorityInheritance_;
+}
+
+
+void DataPort::setPriorityInheritance(bool enabled)
+{
+	hasPriorityInheritance_ = enabled;
+}
+
+
+bool DataPort::acquireService()
+{
+	if(isNull() || !hasPriorityInheritance_ || isServing_)
+		return false;
+
+	serviceTid_ = syscall(SYS_gettid);
+	controlBlock()->serviceTid = serviceTid_;
+	isServing_ = true;
+	return true;
+}
+
+
+void DataPort::releaseService()
+{
+	if(isServing_) {
+		ControlBlock* control = controlBlock();
+		control->serviceTid = 0;
+		control->service.release(serviceTid_);
+
+		isServing_ = false;
+		serviceTid_ = 0;
+	}
 }
 
 
@@ -170,4 +365,106 @@ DataPort::ControlBlock* DataPort::controlBlock()
 }
 
 
+const DataPort::ControlBlock* DataPort::controlBlock() const
+{
+	return static_cast<const ControlBlock*>(buffer_);
+}
+
+
+bool DataPort::createMemfd(size_t bufferSize, int flags)
+{
+	int fd = -1;
+	int mapFlags = MAP_SHARED;
+
+	if(flags & kLockMemory)
+		mapFlags |= MAP_POPULATE;
+
+#ifdef MFD_HUGETLB
+	if(flags & kHugePages) {
+		size_t size = (bufferSize + kHugePageSize - 1) & ~(kHugePageSize - 1);
+
+		fd = syscall(SYS_memfd_create, kMemfdName, MFD_CLOEXEC | MFD_HUGETLB);
+		if(fd >= 0 && ftruncate(fd, size) == 0) {
+			buffer_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, mapFlags, fd, 0);
+
+			if(buffer_ != MAP_FAILED) {
+				id_ = fd;
+				fd_ = fd;
+				owner_ = getpid();
+				bufferSize_ = size;
+				return true;
+			}
+		}
+
+		DEBUG("Huge pages are not available, using regular pages");
+
+		if(fd >= 0)
+			close(fd);
+	}
+#endif
+
+	fd = syscall(SYS_memfd_create, kMemfdName, MFD_CLOEXEC);
+	if(fd < 0) {
+		DEBUG("memfd_create() is not supported, using System V shared memory");
+		return false;
+	}
+
+	if(ftruncate(fd, bufferSize) != 0) {
+		ERROR("Unable to allocate %d bytes of shared memory", bufferSize);
+		close(fd);
+		return false;
+	}
+
+	buffer_ = mmap(nullptr, bufferSize, PROT_READ | PROT_WRITE, mapFlags, fd, 0);
+	if(buffer_ == MAP_FAILED) {
+		ERROR("Unable to map memory file");
+		buffer_ = nullptr;
+		close(fd);
+		return false;
+	}
+
+	id_ = fd;
+	fd_ = fd;
+	owner_ = getpid();
+	bufferSize_ = bufferSize;
+	return true;
+}
+
+
+bool DataPort::createSystemV(size_t bufferSize)
+{
+	int id = shmget(IPC_PRIVATE, bufferSize, S_IRUSR | S_IWUSR);
+	if(id < 0) {
+		ERROR("Unable to allocate %d bytes of shared memory", bufferSize);
+		return false;
+	}
+
+	buffer_ = shmat(id, nullptr, 0);
+	if(buffer_ == reinterpret_cast<void*>(-1)) {
+		ERROR("Unable to attach shared memory segment with id %d", id);
+		shmctl(id, IPC_RMID, nullptr);
+		buffer_ = nullptr;
+		return false;
+	}
+
+	id_ = id;
+	owner_ = 0;
+	bufferSize_ = bufferSize;
+	return true;
+}
+
+
+void DataPort::lockMemory()
+{
+	// Touch every page, so there will be no page faults in the realtime path.
+	volatile u8* buffer = static_cast<u8*>(buffer_);
+	for(size_t i = 0; i < bufferSize_; i += kPageSize)
+		buffer[i] = buffer[i];
+
+	if(mlock(buffer_, bufferSize_) != 0)
+		ERROR("Unable to lock %d bytes of shared memory, check the memlock limit",
+				bufferSize_);
+}
+
+
 } // namespace Airwave
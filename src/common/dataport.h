@@ -1,6 +1,8 @@
 #ifndef COMMON_DATAPORT_H
 #define COMMON_DATAPORT_H
 
+#include <atomic>
+#include <sys/types.h>
 #include "common/event.h"
 #include "common/types.h"
 
@@ -10,16 +12,32 @@ namespace Airwave {
 
 class DataPort {
 public:
+	enum Flags {
+		kNoFlags    = 0,
+		kLockMemory = 1 << 0, // Prefault and lock the port memory on both sides
+		kHugePages  = 1 << 1  // Back the port memory with huge pages, if possible
+	};
+
 	DataPort();
 	~DataPort();
 
-	bool create(size_t frameSize);
-	bool connect(int id);
+	// The memfd backend is used when it is supported by the kernel, otherwise the port
+	// falls back to the System V shared memory.
+	bool create(size_t frameSize, int flags = kNoFlags);
+
+	// The owner is the pid of the process that created the memfd port, or zero for the
+	// System V port.
+	bool connect(int id, pid_t owner);
 	void disconnect();
 
+	// Closes the memory file descriptor of the creator. Should be called once the peer
+	// has connected, the mapping keeps the memory alive. No more peers can connect then.
+	void releaseDescriptor();
+
 	bool isNull() const;
 	bool isConnected() const;
 	int id() const;
+	pid_t owner() const;
 	size_t frameSize() const;
 
 	void* frameBuffer();
@@ -30,20 +48,57 @@ public:
 	void sendRequest();
 	void sendResponse();
 
+	bool tryWaitRequest();
 	bool waitRequest(int msecs = -1);
 	bool waitResponse(int msecs = -1);
 
+	SpinPolicy* spinPolicy();
+
+	bool hasPriorityInheritance() const;
+	void setPriorityInheritance(bool enabled);
+
+	// Must be called by the serving thread when the priority inheritance is enabled.
+	// The requester gives the service lock to the serving thread along with the request,
+	// and the serving thread releases it along with the response. So the requester,
+	// blocked on the lock, receives it right when the response is sent.
+	bool acquireService();
+	void releaseService();
+
 private:
-	struct ControlBlock {
+	// Aligned to the cache line size, so the frame buffer is aligned too.
+	struct alignas(64) ControlBlock {
+		ControlBlock(size_t frameSize, int flags);
+
 		Event request;
 		Event response;
+		PiLock service;
+		std::atomic<int> serviceTid;
+
+		u64 frameSize;
+		i32 flags;
+		std::atomic<int> attachCount;
+		std::atomic<int> creatorPid;
+		std::atomic<int> peerPid;
 	};
 
 	int id_;
+	int fd_;
+	pid_t owner_;
+	bool isCreator_;
+	size_t bufferSize_;
 	size_t frameSize_;
 	void* buffer_;
+	SpinPolicy spinPolicy_;
+	bool hasPriorityInheritance_;
+	bool isServing_;
+	int serviceTid_;
 
 	ControlBlock* controlBlock();
+	const ControlBlock* controlBlock() const;
+
+	bool createMemfd(size_t bufferSize, int flags);
+	bool createSystemV(size_t bufferSize);
+	void lockMemory();
 };
 
 
@@ -1,5 +1,6 @@
 #include "event.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <syscall.h>
 #include <time.h>
@@ -7,15 +8,166 @@
 #include <linux/futex.h>
 
 
-#define futex_wait(futex, count, timeout) \
-		(syscall(SYS_futex, futex, FUTEX_WAIT, count, timeout, nullptr, 0) == 0)
+// The futex wrappers return the result of the system call, zero on success.
+
+// The timeout of the FUTEX_WAIT_BITSET operation is an absolute CLOCK_MONOTONIC time.
+static inline long futex_wait(std::atomic<int>* futex, int count,
+		const timespec* deadline, u32 bitset)
+{
+	return syscall(SYS_futex, futex, FUTEX_WAIT_BITSET, count, deadline, nullptr,
+			bitset);
+}
+
+
+static inline long futex_post(std::atomic<int>* futex, int count, u32 bitset)
+{
+	return syscall(SYS_futex, futex, FUTEX_WAKE_BITSET, count, nullptr, nullptr, bitset);
+}
+
+
+// The timeout of the FUTEX_LOCK_PI operation is an absolute CLOCK_REALTIME time.
+static inline long futex_lock_pi(std::atomic<int>* futex, const timespec* deadline)
+{
+	return syscall(SYS_futex, futex, FUTEX_LOCK_PI, 0, deadline, nullptr, 0);
+}
+
+
+static inline long futex_unlock_pi(std::atomic<int>* futex)
+{
+	return syscall(SYS_futex, futex, FUTEX_UNLOCK_PI, 0, nullptr, nullptr, 0);
+}
+
+
+// Number of polling iterations between two clock readings.
+static const int kSpinBatch = 64;
+
+
+static inline void cpuRelax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#else
+	std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+
+static inline i64 monotonicTime()
+{
+	timespec tm;
+	clock_gettime(CLOCK_MONOTONIC, &tm);
+	return static_cast<i64>(tm.tv_sec) * 1000000000 + tm.tv_nsec;
+}
+
+
+// The FUTEX_LOCK_PI operation doesn't accept CLOCK_MONOTONIC deadlines.
+static inline timespec* toRealtime(const timespec* deadline, timespec* tm)
+{
+	if(!deadline)
+		return nullptr;
+
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	clock_gettime(CLOCK_REALTIME, tm);
+
+	i64 remaining = std::max<i64>(0, (deadline->tv_sec - now.tv_sec) * 1000000000LL +
+			deadline->tv_nsec - now.tv_nsec);
+
+	i64 nsecs = tm->tv_nsec + remaining;
+	tm->tv_sec += nsecs / 1000000000;
+	tm->tv_nsec = nsecs % 1000000000;
+	return tm;
+}
+
+
+static inline timespec* makeDeadline(clockid_t clock, int msecs, timespec* tm)
+{
+	if(msecs < 0)
+		return nullptr;
+
+	clock_gettime(clock, tm);
+
+	tm->tv_sec  += msecs / 1000;
+	tm->tv_nsec += (msecs % 1000) * 1000000;
+
+	if(tm->tv_nsec >= 1000000000) {
+		tm->tv_sec++;
+		tm->tv_nsec -= 1000000000;
+	}
+
+	return tm;
+}
+
+
+SpinPolicy::SpinPolicy() :
+	limit_(0),
+	budget_(0),
+	hitCount_(0),
+	missCount_(0)
+{
+}
+
+
+int SpinPolicy::limit() const
+{
+	return limit_ / 1000;
+}
+
+
+void SpinPolicy::setLimit(int usecs)
+{
+	limit_ = std::max(usecs, 0) * 1000LL;
+	budget_ = limit_;
+}
+
+
+int SpinPolicy::budget() const
+{
+	return budget_ / 1000;
+}
+
+
+u64 SpinPolicy::hitCount() const
+{
+	return hitCount_;
+}
+
+
+u64 SpinPolicy::missCount() const
+{
+	return missCount_;
+}
+
+
+void SpinPolicy::hit(i64 nsecs)
+{
+	hitCount_++;
+
+	// Keep some headroom above the observed wait time.
+	budget_ = std::min(limit_, std::max(budget_, nsecs * 2));
+}
 
-#define futex_post(futex, count) \
-		(syscall(SYS_futex, futex, FUTEX_WAKE, count, nullptr, nullptr, 0) == 0)
 
+void SpinPolicy::miss(i64 nsecs)
+{
+	missCount_++;
+
+	if(nsecs > limit_) {
+		// The event is posted too late to be caught by spinning, so reduce the budget,
+		// but keep probing with the small one to notice when the wait times go down.
+		budget_ = std::max(limit_ / 16, budget_ / 2);
+	}
+	else {
+		// The event would be caught with a bit larger budget.
+		budget_ = std::min(limit_, nsecs * 2);
+	}
+}
 
-Event::Event() :
-	count_(0)
+
+Event::Event(u32 bitset) :
+	count_(0),
+	waiters_(0),
+	bitset_(bitset)
 {
 }
 
@@ -23,37 +175,157 @@ Event::Event() :
 Event::~Event()
 {
 	// FIXME The current implementation is not correct as it wakes only the one waiter.
-	futex_post(&count_, 1);
+	futex_post(&count_, 1, bitset_);
+}
+
+
+bool Event::tryWait()
+{
+	int count = count_.load();
+
+	while(count > 0) {
+		if(count_.compare_exchange_weak(count, count - 1))
+			return true;
+	}
+
+	return false;
 }
 
 
 bool Event::wait(int msecs)
 {
-	timespec* timeout = nullptr;
 	timespec tm;
+	return waitUntil(makeDeadline(CLOCK_MONOTONIC, msecs, &tm));
+}
+
+
+bool Event::wait(int msecs, SpinPolicy* policy)
+{
+	if(!policy || policy->limit_ <= 0)
+		return wait(msecs);
+
+	// The deadline is calculated before spinning, so the total wait time doesn't
+	// exceed the requested timeout.
+	timespec tm;
+	timespec* deadline = makeDeadline(CLOCK_MONOTONIC, msecs, &tm);
+
+	i64 start = monotonicTime();
+	i64 elapsed = 0;
+
+	do {
+		for(int i = 0; i < kSpinBatch; ++i) {
+			if(tryWait()) {
+				policy->hit(monotonicTime() - start);
+				return true;
+			}
+
+			cpuRelax();
+		}
+
+		elapsed = monotonicTime() - start;
+	} while(elapsed < policy->budget_);
+
+	bool result = waitUntil(deadline);
+
+	policy->miss(monotonicTime() - start);
+	return result;
+}
+
 
-	if(msecs >= 0) {
-		int seconds = msecs / 1000;
-		msecs %= 1000;
+void Event::post()
+{
+	count_++;
+
+	if(waiters_ > 0)
+		futex_post(&count_, 1, bitset_);
+}
+
+
+timespec* Event::deadline(int msecs, timespec* tm)
+{
+	return makeDeadline(CLOCK_MONOTONIC, msecs, tm);
+}
 
-		tm.tv_sec  = seconds;
-		tm.tv_nsec = msecs * 1000000;
 
-		timeout = &tm;
+bool Event::waitUntil(const timespec* deadline)
+{
+	// The poster skips the wake up system call when there are no sleeping waiters.
+	waiters_++;
+
+	while(!tryWait()) {
+		// Since the deadline is absolute, spurious wake ups and interruptions by signals
+		// don't prolong the total wait time.
+		if(futex_wait(&count_, 0, deadline, bitset_) != 0 && errno != EWOULDBLOCK &&
+				errno != EINTR) {
+			waiters_--;
+			return false;
+		}
 	}
 
-	while(count_ == 0) {
-		if(!futex_wait(&count_, 0, timeout) && errno != EWOULDBLOCK)
+	waiters_--;
+	return true;
+}
+
+
+PiLock::PiLock() :
+	owner_(0)
+{
+}
+
+
+bool PiLock::lock(int msecs)
+{
+	timespec tm;
+	return lockUntil(makeDeadline(CLOCK_MONOTONIC, msecs, &tm));
+}
+
+
+bool PiLock::lockUntil(const timespec* deadline)
+{
+	int tid = syscall(SYS_gettid);
+	int expected = 0;
+
+	if(owner_.compare_exchange_strong(expected, tid))
+		return true;
+
+	timespec tm;
+	timespec* realtime = toRealtime(deadline, &tm);
+
+	while(futex_lock_pi(&owner_, realtime) != 0) {
+		if(errno != EINTR)
 			return false;
 	}
 
-	count_--;
 	return true;
 }
 
 
-void Event::post()
+void PiLock::unlock()
 {
-	count_++;
-	futex_post(&count_, 1);
+	int tid = syscall(SYS_gettid);
+
+	// The kernel takes care of the lock ownership transfer if there are waiters.
+	if(!owner_.compare_exchange_strong(tid, 0))
+		futex_unlock_pi(&owner_);
+}
+
+
+bool PiLock::assign(int tid)
+{
+	int expected = 0;
+	return owner_.compare_exchange_strong(expected, tid);
+}
+
+
+bool PiLock::release(int tid)
+{
+	if((owner_.load() & FUTEX_TID_MASK) != tid)
+		return false;
+
+	// The kernel takes care of the lock ownership transfer if there are waiters.
+	int expected = tid;
+	if(!owner_.compare_exchange_strong(expected, 0))
+		futex_unlock_pi(&owner_);
+
+	return true;
 }
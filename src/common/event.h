@@ -2,24 +2,90 @@
 #define COMMON_EVENT_H
 
 #include <atomic>
+#include <time.h>
+#include "common/types.h"
 
 #ifdef bool
 #undef bool
 #endif
 
 
+// Adaptive busy-waiting policy for the Event::wait() function. The waiter polls the
+// event for up to budget() microseconds before falling back to the futex. The budget is
+// adjusted according to the measured wait times and never exceeds the limit().
+class SpinPolicy {
+public:
+	SpinPolicy();
+
+	int limit() const;
+	void setLimit(int usecs);
+
+	int budget() const;
+
+	u64 hitCount() const;
+	u64 missCount() const;
+
+private:
+	friend class Event;
+
+	i64 limit_;
+	i64 budget_;
+	u64 hitCount_;
+	u64 missCount_;
+
+	void hit(i64 nsecs);
+	void miss(i64 nsecs);
+};
+
+
+// Counting semaphore placed in the shared memory. The waits use FUTEX_WAIT_BITSET with
+// the match-any bitset (kAnyBitset) just to get the absolute CLOCK_MONOTONIC deadlines,
+// the plain FUTEX_WAIT only accepts relative timeouts.
 class Event {
 public:
 	static const int kInfinite = -1;
+	static const u32 kAnyBitset = 0xffffffff;
 
-	Event();
+	Event(u32 bitset = kAnyBitset);
 	~Event();
 
+	bool tryWait();
 	bool wait(int msecs = kInfinite);
+	bool wait(int msecs, SpinPolicy* policy);
 	void post();
 
+	// The deadline is an absolute CLOCK_MONOTONIC time, nullptr means infinite.
+	bool waitUntil(const timespec* deadline);
+
+	// Makes the deadline for the given timeout, returns nullptr for kInfinite.
+	static timespec* deadline(int msecs, timespec* tm);
+
 private:
 	std::atomic<int> count_;
+	std::atomic<int> waiters_;
+	u32 bitset_;
+};
+
+
+// Priority inheritance mutex placed in the shared memory. The thread blocked in the
+// lock() function lends its priority to the owner of the lock.
+class PiLock {
+public:
+	PiLock();
+
+	bool lock(int msecs = Event::kInfinite);
+	bool lockUntil(const timespec* deadline);
+	void unlock();
+
+	// Gives the free lock to the thread with the given id, even the one of another
+	// process. The thread then unlocks it as if it had locked it itself.
+	bool assign(int tid);
+
+	// Unlocks the lock only if it is owned by the thread with the given id.
+	bool release(int tid);
+
+private:
+	std::atomic<int> owner_;
 };
 
 
@@ -0,0 +1,117 @@
+#include "hash.h"
+
+#include <cstring>
+
+
+namespace Airwave {
+
+
+static const u64 kPrime1 = 0x9E3779B185EBCA87ULL;
+static const u64 kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const u64 kPrime3 = 0x165667B19E3779F9ULL;
+static const u64 kPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const u64 kPrime5 = 0x27D4EB2F165667C5ULL;
+
+
+static inline u64 rotateLeft(u64 value, int count)
+{
+	return (value << count) | (value >> (64 - count));
+}
+
+
+// Unaligned little-endian loads, the chunk data can start at any address.
+static inline u64 read64(const u8* data)
+{
+	u64 value;
+	std::memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+
+static inline u32 read32(const u8* data)
+{
+	u32 value;
+	std::memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+
+static inline u64 round(u64 accumulator, u64 input)
+{
+	accumulator += input * kPrime2;
+	accumulator = rotateLeft(accumulator, 31);
+	return accumulator * kPrime1;
+}
+
+
+static inline u64 mergeRound(u64 accumulator, u64 value)
+{
+	accumulator ^= round(0, value);
+	return accumulator * kPrime1 + kPrime4;
+}
+
+
+u64 hash64(const void* data, size_t size, u64 seed)
+{
+	const u8* p = static_cast<const u8*>(data);
+	const u8* end = p + size;
+	u64 hash;
+
+	if(size >= 32) {
+		const u8* limit = end - 32;
+
+		u64 v1 = seed + kPrime1 + kPrime2;
+		u64 v2 = seed + kPrime2;
+		u64 v3 = seed;
+		u64 v4 = seed - kPrime1;
+
+		do {
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+			p += 32;
+		} while(p <= limit);
+
+		hash = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) +
+				rotateLeft(v4, 18);
+
+		hash = mergeRound(hash, v1);
+		hash = mergeRound(hash, v2);
+		hash = mergeRound(hash, v3);
+		hash = mergeRound(hash, v4);
+	}
+	else {
+		hash = seed + kPrime5;
+	}
+
+	hash += static_cast<u64>(size);
+
+	while(p + 8 <= end) {
+		hash ^= round(0, read64(p));
+		hash = rotateLeft(hash, 27) * kPrime1 + kPrime4;
+		p += 8;
+	}
+
+	if(p + 4 <= end) {
+		hash ^= static_cast<u64>(read32(p)) * kPrime1;
+		hash = rotateLeft(hash, 23) * kPrime2 + kPrime3;
+		p += 4;
+	}
+
+	while(p < end) {
+		hash ^= (*p) * kPrime5;
+		hash = rotateLeft(hash, 11) * kPrime1;
+		p++;
+	}
+
+	hash ^= hash >> 33;
+	hash *= kPrime2;
+	hash ^= hash >> 29;
+	hash *= kPrime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+
+} // namespace Airwave
@@ -0,0 +1,19 @@
+#ifndef COMMON_HASH_H
+#define COMMON_HASH_H
+
+#include <cstddef>
+#include "common/types.h"
+
+
+namespace Airwave {
+
+
+// 64-bit non-cryptographic hash (the XXH64 algorithm). It is fast enough to hash the
+// plugin chunks of hundreds of megabytes on each effGetChunk request.
+u64 hash64(const void* data, size_t size, u64 seed = 0);
+
+
+} // namespace Airwave
+
+
+#endif // COMMON_HASH_H
@@ -0,0 +1,194 @@
+#include "hostlauncher.h"
+
+#include <cstdio>
+#include <cstring>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "common/filesystem.h"
+#include "common/hash.h"
+#include "common/logger.h"
+
+
+namespace Airwave {
+
+
+// The claimed host endpoint replies as soon as it has received the claim, so this
+// timeout is only reached if the daemon is stuck.
+static const int kClaimTimeout = 2000;
+
+
+// Checks if the NAME=value string is the variable with the given name.
+static bool isVariable(const std::string& string, const char* name)
+{
+	size_t length = std::strlen(name);
+	return string.size() > length && string[length] == '=' &&
+			string.compare(0, length, name) == 0;
+}
+
+
+std::vector<std::string> currentEnvironment()
+{
+	std::vector<std::string> environment;
+	for(char** it = environ; *it; ++it)
+		environment.push_back(*it);
+
+	return environment;
+}
+
+
+bool launchHost(const std::string& hostPath, const std::string& prefixPath,
+		const std::string& loaderPath, const std::vector<std::string>& args,
+		const std::vector<std::string>& environment, pid_t* pid)
+{
+	// The host endpoint launcher is a shell script generated by winegcc, which just
+	// executes the WINE loader with the .exe.so binary next to it. Do the same here to
+	// avoid the shell startup. The script is still used if the binary is missing.
+	std::string binaryPath = hostPath + ".so";
+	std::string hostDir = hostPath.substr(0, hostPath.rfind('/'));
+	bool isDirect = FileSystem::isFileExists(binaryPath);
+
+	std::vector<const char*> argv;
+	if(isDirect) {
+		argv.push_back(loaderPath.c_str());
+		argv.push_back(binaryPath.c_str());
+	}
+	else {
+		argv.push_back("/bin/sh");
+		argv.push_back(hostPath.c_str());
+	}
+
+	for(const std::string& arg : args)
+		argv.push_back(arg.c_str());
+
+	argv.push_back(nullptr);
+
+	// The given environment with the WINE variables replaced.
+	std::vector<std::string> strings;
+	strings.push_back("WINEPREFIX=" + prefixPath);
+	strings.push_back("WINELOADER=" + loaderPath);
+
+	std::string dllPath = hostDir;
+	for(const std::string& variable : environment) {
+		if(isVariable(variable, "WINEDLLPATH"))
+			dllPath += ':' + variable.substr(12);
+	}
+
+	if(isDirect)
+		strings.push_back("WINEDLLPATH=" + dllPath);
+
+	for(const std::string& variable : environment) {
+		if(!isVariable(variable, "WINEPREFIX") && !isVariable(variable, "WINELOADER") &&
+				(!isDirect || !isVariable(variable, "WINEDLLPATH"))) {
+			strings.push_back(variable);
+		}
+	}
+
+	std::vector<const char*> env;
+	for(const std::string& string : strings)
+		env.push_back(string.c_str());
+
+	env.push_back(nullptr);
+
+	// posix_spawn() doesn't copy the page tables of the (potentially huge) DAW process
+	// like fork() does. The signal dispositions and the mask of the DAW are not
+	// inherited by the host endpoint.
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+
+	sigset_t signals;
+	sigemptyset(&signals);
+	posix_spawnattr_setsigmask(&attr, &signals);
+	sigfillset(&signals);
+	posix_spawnattr_setsigdefault(&attr, &signals);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+	// The host endpoint doesn't need any of the file descriptors opened by the DAW.
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+	posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#endif
+
+	int result = posix_spawn(pid, argv[0], &actions, &attr,
+			const_cast<char* const*>(argv.data()), const_cast<char* const*>(env.data()));
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	if(result != 0) {
+		ERROR("Unable to start host endpoint: %s", std::strerror(result));
+		return false;
+	}
+
+	return true;
+}
+
+
+std::string hostPoolAddress(const std::string& prefixPath, const std::string& loaderPath)
+{
+	std::string key = prefixPath + '\n' + loaderPath;
+
+	char buffer[64];
+	std::snprintf(buffer, sizeof(buffer), "airwave-pool-%d-%016llx",
+			static_cast<int>(getuid()),
+			static_cast<ulonglong>(hash64(key.data(), key.size())));
+
+	return buffer;
+}
+
+
+bool claimPooledHost(const std::string& prefixPath, const std::string& loaderPath,
+		const PoolClaim& claim, const std::vector<std::string>& environment, pid_t* pid)
+{
+	std::string block;
+	for(const std::string& variable : environment)
+		block.append(variable.c_str(), variable.size() + 1);
+
+	if(block.size() > kPoolEnvironmentSize)
+		return false;
+
+	std::string address = hostPoolAddress(prefixPath, loaderPath);
+
+	// The abstract socket name starts with the null byte.
+	sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	std::memcpy(addr.sun_path + 1, address.data(), address.size());
+	socklen_t addrSize = offsetof(sockaddr_un, sun_path) + 1 + address.size();
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+		return false;
+
+	timeval timeout;
+	timeout.tv_sec = kClaimTimeout / 1000;
+	timeout.tv_usec = (kClaimTimeout % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	if(connect(fd, reinterpret_cast<sockaddr*>(&addr), addrSize) != 0) {
+		close(fd);
+		return false;
+	}
+
+	i32 result = 0;
+	bool isClaimed = send(fd, &claim, sizeof(claim), MSG_NOSIGNAL) == sizeof(claim) &&
+			send(fd, block.data(), block.size(), MSG_NOSIGNAL) ==
+					static_cast<ssize_t>(block.size()) &&
+			recv(fd, &result, sizeof(result), 0) == sizeof(result) && result > 0;
+
+	close(fd);
+
+	if(!isClaimed)
+		return false;
+
+	*pid = result;
+	return true;
+}
+
+
+} // namespace Airwave
@@ -0,0 +1,37 @@
+#ifndef COMMON_HOSTLAUNCHER_H
+#define COMMON_HOSTLAUNCHER_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "common/protocol.h"
+
+
+namespace Airwave {
+
+
+// Returns the environment variables of the current process (as NAME=value strings).
+std::vector<std::string> currentEnvironment();
+
+// Starts the host endpoint process with the given arguments and environment (the WINE
+// variables are replaced). The WINE loader is executed directly with the .exe.so binary
+// instead of the winegcc launcher script if possible.
+bool launchHost(const std::string& hostPath, const std::string& prefixPath,
+		const std::string& loaderPath, const std::vector<std::string>& args,
+		const std::vector<std::string>& environment, pid_t* pid);
+
+// Name of the abstract socket of the host pool daemon, serving the WINE prefix and
+// loader pair.
+std::string hostPoolAddress(const std::string& prefixPath, const std::string& loaderPath);
+
+// Hands the claim over to an idle host endpoint of the pool daemon, which was started
+// with the given environment. Fails quickly if there is no daemon running for the prefix
+// or it has no such idle host endpoint.
+bool claimPooledHost(const std::string& prefixPath, const std::string& loaderPath,
+		const PoolClaim& claim, const std::vector<std::string>& environment, pid_t* pid);
+
+
+} // namespace Airwave
+
+
+#endif // COMMON_HOSTLAUNCHER_H
@@ -0,0 +1,394 @@
+#include "logdecoder.h"
+
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "common/logger.h"
+
+
+namespace Airwave {
+
+
+namespace {
+
+
+struct Argument {
+	LogArg      tag;
+	u64         integer;
+	double      real;
+	std::string string;
+};
+
+
+bool readArgument(const u8** data, const u8* end, Argument* arg)
+{
+	if(*data >= end)
+		return false;
+
+	arg->tag = static_cast<LogArg>(*(*data)++);
+
+	if(arg->tag == LogArg::kString) {
+		u16 length;
+		if(end - *data < static_cast<ptrdiff_t>(sizeof(u16)))
+			return false;
+
+		std::memcpy(&length, *data, sizeof(u16));
+		*data += sizeof(u16);
+
+		if(end - *data < length)
+			return false;
+
+		arg->string.assign(reinterpret_cast<const char*>(*data), length);
+		*data += length;
+		return true;
+	}
+
+	if(end - *data < static_cast<ptrdiff_t>(sizeof(u64)))
+		return false;
+
+	std::memcpy(&arg->integer, *data, sizeof(u64));
+	*data += sizeof(u64);
+
+	if(arg->tag == LogArg::kDouble) {
+		std::memcpy(&arg->real, &arg->integer, sizeof(double));
+		arg->integer = static_cast<i64>(arg->real);
+	}
+	else if(arg->tag == LogArg::kSigned || arg->tag == LogArg::kSigned32) {
+		arg->real = static_cast<i64>(arg->integer);
+	}
+	else {
+		arg->real = arg->integer;
+	}
+
+	return true;
+}
+
+
+// Returns the width of the integer conversion in bits, the length modifier takes
+// precedence over the recorded width of the argument.
+int integerBits(const std::string& modifier, const Argument& arg)
+{
+	if(modifier == "hh")
+		return 8;
+
+	if(modifier == "h")
+		return 16;
+
+	if(!modifier.empty())
+		return 64;
+
+	if(arg.tag == LogArg::kSigned32 || arg.tag == LogArg::kUnsigned32)
+		return 32;
+
+	return 64;
+}
+
+
+// Reads the '*' width or precision argument.
+bool readStarArgument(const u8** data, const u8* end, int* value)
+{
+	Argument arg;
+	if(!readArgument(data, end, &arg) || arg.tag == LogArg::kString)
+		return false;
+
+	*value = static_cast<int>(arg.integer);
+	return true;
+}
+
+
+void appendFormat(std::string* output, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+
+	va_list copy;
+	va_copy(copy, args);
+	int length = std::vsnprintf(nullptr, 0, format, copy);
+	va_end(copy);
+
+	if(length > 0) {
+		std::vector<char> buffer(length + 1);
+		std::vsnprintf(buffer.data(), buffer.size(), format, args);
+		output->append(buffer.data(), length);
+	}
+
+	va_end(args);
+}
+
+
+} // namespace
+
+
+LogDecoder::LogDecoder() :
+	droppedCount_(0)
+{
+}
+
+
+bool LogDecoder::decode(const char* data, size_t size, u64* timestamp, LogLevel* level,
+		std::string* sender, std::string* text)
+{
+	if(size <= sizeof(u64))
+		return false;
+
+	std::memcpy(timestamp, data, sizeof(u64));
+
+	// The sender id is followed by the kind byte.
+	const char* begin = data + sizeof(u64);
+	const char* end = data + size;
+	const char* pos = begin;
+
+	while(pos < end && (*pos < static_cast<char>(LogDatagram::kText) ||
+			*pos > static_cast<char>(LogDatagram::kDropped))) {
+		++pos;
+	}
+
+	if(pos == end)
+		return false;
+
+	sender->assign(begin, pos);
+	LogDatagram kind = static_cast<LogDatagram>(*pos++);
+
+	if(kind == LogDatagram::kText) {
+		*level = LogLevel::kTrace;
+		text->assign(pos, strnlen(pos, end - pos));
+		return true;
+	}
+
+	if(kind == LogDatagram::kDropped) {
+		u64 count;
+		if(end - pos < static_cast<ptrdiff_t>(2 * sizeof(u64)))
+			return false;
+
+		std::memcpy(&count, pos + sizeof(u64), sizeof(u64));
+		droppedCount_ += count;
+
+		*level = LogLevel::kError;
+		*text = std::to_string(count) + " log messages were dropped by the sender";
+		return true;
+	}
+
+	FormatKey key;
+	if(end - pos < static_cast<ptrdiff_t>(sizeof(u64) + sizeof(u32)))
+		return false;
+
+	std::memcpy(&key.first, pos, sizeof(u64));
+	pos += sizeof(u64);
+	std::memcpy(&key.second, pos, sizeof(u32));
+	pos += sizeof(u32);
+
+	if(kind == LogDatagram::kFormat) {
+		if(pos == end)
+			return false;
+
+		Format& format = formats_[key];
+		format.level = static_cast<LogLevel>(*pos++);
+		format.text.assign(pos, strnlen(pos, end - pos));
+		return false;
+	}
+
+	const u8* args = reinterpret_cast<const u8*>(pos);
+	auto it = formats_.find(key);
+
+	if(it == formats_.end()) {
+		*level = LogLevel::kTrace;
+		text->assign("(unknown log format #" + std::to_string(key.second) + ")");
+	}
+	else {
+		*level = it->second.level;
+		*text = formatRecord(it->second.text, args, end - pos);
+	}
+
+	return true;
+}
+
+
+void LogDecoder::clear()
+{
+	formats_.clear();
+}
+
+
+u64 LogDecoder::droppedCount() const
+{
+	return droppedCount_;
+}
+
+
+std::string LogDecoder::formatRecord(const std::string& format, const u8* data,
+		size_t size)
+{
+	std::string result;
+	const u8* end = data + size;
+	size_t i = 0;
+
+	while(i < format.size()) {
+		if(format[i] != '%') {
+			result += format[i++];
+			continue;
+		}
+
+		// The conversion specification is %[flags][width][.precision][length]type. The
+		// '*' width and precision are taken from the arguments. The length modifier is
+		// replaced with the one matching the width of the converted number.
+		std::string spec(1, '%');
+		bool isMissing = false;
+		++i;
+
+		while(i < format.size() && std::strchr("-+ #0", format[i]) && format[i])
+			spec += format[i++];
+
+		if(i < format.size() && format[i] == '*') {
+			int width;
+			if(readStarArgument(&data, end, &width)) {
+				spec += std::to_string(width);
+			}
+			else {
+				isMissing = true;
+			}
+
+			++i;
+		}
+
+		while(i < format.size() && std::isdigit(format[i]))
+			spec += format[i++];
+
+		if(i < format.size() && format[i] == '.') {
+			std::string precision(1, format[i++]);
+
+			if(i < format.size() && format[i] == '*') {
+				int value;
+				if(!readStarArgument(&data, end, &value)) {
+					isMissing = true;
+				}
+				else if(value >= 0) {
+					precision += std::to_string(value);
+				}
+				else {
+					// The negative precision is taken as if it were omitted.
+					precision.clear();
+				}
+
+				++i;
+			}
+
+			while(i < format.size() && std::isdigit(format[i]))
+				precision += format[i++];
+
+			spec += precision;
+		}
+
+		std::string modifier;
+		while(i < format.size() && std::strchr("hlLqjzt", format[i]) && format[i])
+			modifier += format[i++];
+
+		if(i == format.size())
+			break;
+
+		char type = format[i++];
+		if(type == '%') {
+			result += '%';
+			continue;
+		}
+
+		Argument arg;
+		if(isMissing || !readArgument(&data, end, &arg)) {
+			result += "(missing)";
+			continue;
+		}
+
+		switch(type) {
+		case 'd':
+		case 'i':
+			switch(integerBits(modifier, arg)) {
+			case 8:
+				appendFormat(&result, (spec + type).c_str(),
+						static_cast<i8>(arg.integer));
+				break;
+
+			case 16:
+				appendFormat(&result, (spec + type).c_str(),
+						static_cast<i16>(arg.integer));
+				break;
+
+			case 32:
+				appendFormat(&result, (spec + type).c_str(),
+						static_cast<i32>(arg.integer));
+				break;
+
+			default:
+				appendFormat(&result, (spec + "ll" + type).c_str(),
+						static_cast<long long>(arg.integer));
+				break;
+			}
+			break;
+
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+			switch(integerBits(modifier, arg)) {
+			case 8:
+				appendFormat(&result, (spec + type).c_str(),
+						static_cast<u8>(arg.integer));
+				break;
+
+			case 16:
+				appendFormat(&result, (spec + type).c_str(),
+						static_cast<u16>(arg.integer));
+				break;
+
+			case 32:
+				appendFormat(&result, (spec + type).c_str(),
+						static_cast<u32>(arg.integer));
+				break;
+
+			default:
+				appendFormat(&result, (spec + "ll" + type).c_str(),
+						static_cast<unsigned long long>(arg.integer));
+				break;
+			}
+			break;
+
+		case 'c':
+			appendFormat(&result, (spec + type).c_str(), static_cast<int>(arg.integer));
+			break;
+
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			appendFormat(&result, (spec + type).c_str(), arg.real);
+			break;
+
+		case 's':
+			if(arg.tag == LogArg::kString) {
+				appendFormat(&result, (spec + type).c_str(), arg.string.c_str());
+			}
+			else {
+				result += "(invalid)";
+			}
+			break;
+
+		case 'p':
+			appendFormat(&result, (spec + type).c_str(),
+					reinterpret_cast<void*>(static_cast<uintptr_t>(arg.integer)));
+			break;
+
+		default:
+			result += spec + type;
+			break;
+		}
+	}
+
+	return result;
+}
+
+
+} // namespace Airwave
@@ -0,0 +1,48 @@
+#ifndef COMMON_LOGDECODER_H
+#define COMMON_LOGDECODER_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include "common/logger.h"
+#include "common/types.h"
+
+
+namespace Airwave {
+
+
+// Decodes the log datagrams (see LogDatagram). The formats are remembered per logger
+// session, the records are formatted with them the same way as printf() does. The text
+// messages are reported with the trace level and the drop reports with the error one.
+class LogDecoder {
+public:
+	LogDecoder();
+
+	// Returns false if the datagram is invalid or it doesn't carry a message.
+	bool decode(const char* data, size_t size, u64* timestamp, LogLevel* level,
+			std::string* sender, std::string* text);
+
+	// Forgets all of the formats.
+	void clear();
+
+	// Total count of the messages reported as dropped by the senders.
+	u64 droppedCount() const;
+
+private:
+	struct Format {
+		LogLevel level;
+		std::string text;
+	};
+
+	using FormatKey = std::pair<u64, u32>;
+	std::map<FormatKey, Format> formats_;
+	u64 droppedCount_;
+
+	std::string formatRecord(const std::string& format, const u8* data, size_t size);
+};
+
+
+} // namespace Airwave
+
+
+#endif // COMMON_LOGDECODER_H
@@ -1,11 +1,17 @@
 #include "logger.h"
 
-#include <cstdarg>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
 #include <ctime>
+#include <mutex>
+#include <new>
+#include <thread>
 #include <unistd.h>
 #include <linux/un.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <vector>
 #include "common/types.h"
 
@@ -13,16 +19,313 @@
 namespace Airwave {
 
 
-static int fd = -1;
+// Messages are recorded into the fixed size records of the per-thread lock-free ring
+// buffers, so the calling thread (possibly the realtime one) never blocks or makes a
+// system call. The records are sent to the log socket by the background drain thread.
+// The message is dropped (and counted) if the ring of the thread is full. When all the
+// preallocated rings are taken, the new thread allocates the extra one on its first
+// message. The rings are reused by the later threads, but never freed.
+static const int kRingCount = 32;
+static const u32 kRingSize = 64;	// should be a power of two
+static const size_t kRecordSize = 512;
+
+// Interval between two drain passes (in milliseconds).
+static const int kDrainInterval = 20;
+
+// Maximum size of the datagram (timestamp, sender id and message).
+static const size_t kDatagramSize = 1024;
+static const size_t kMaxSenderIdSize = 255;
+
+// Maximum number of the registered call site formats.
+static const u32 kMaxFormats = 4096;
+
+// Interval between two repeats of the same format datagram (in milliseconds).
+static const int kFormatInterval = 10000;
+
+// The message is dropped if the log socket is not read for this time (in milliseconds),
+// so the stalled log viewer doesn't block the loggerFree().
+static const int kSendTimeout = 100;
+
+
+// The data is the format id followed by the arguments (see LogDatagram).
+struct LogRecord {
+	u64 timestamp;
+	u32 length;
+	u8  data[kRecordSize - sizeof(u64) - sizeof(u32)];
+};
+
+
+enum RingState {
+	kRingFree,
+	kRingOwned,
+	kRingReleased
+};
+
+
+// Single producer single consumer ring, the head and tail are free running counters.
+// The next pointer links the extra rings, it is set before the ring is published.
+struct LogRing {
+	LogRing* next;
+	std::atomic<int> state;
+	std::atomic<u32> head;
+	std::atomic<u32> tail;
+	LogRecord records[kRingSize];
+};
+
+
+// The ring of the exiting thread is released, its remaining records are still sent.
+struct RingHolder {
+	LogRing* ring = nullptr;
+	LogRecord* record = nullptr;
+
+	~RingHolder()
+	{
+		if(ring)
+			ring->state = kRingReleased;
+	}
+};
+
+
+// The descriptor is read by the logging threads and the drain thread, the rest of the
+// init state is guarded by the initGuard.
+static std::atomic<int> fd(-1);
+static std::mutex initGuard;
 static std::string id;
-static std::vector<char> buffer;
+static std::mutex idGuard;
 static LogLevel defaultLevel = LogLevel::kDebug;
 
+static LogRing rings[kRingCount];
+static std::atomic<LogRing*> extraRings(nullptr);
+static thread_local RingHolder threadRing;
+static std::atomic<u64> droppedCount(0);
+
+// The formats are registered by the call sites of any thread, but the format ids are
+// only read by the drain thread from the records, published after the registration.
+static const char* formats[kMaxFormats];
+static LogLevel formatLevels[kMaxFormats];
+static std::atomic<u32> formatCount(0);
+static std::chrono::steady_clock::time_point formatSentTimes[kMaxFormats];
+static bool isFormatSent[kMaxFormats];
+
+// Distinguishes the format ids of this logger from the ones of the other processes and
+// the other plugin modules.
+static u64 session = 0;
+
+static std::thread* drainThread = nullptr;
+static std::atomic<bool> isDraining(false);
+
+
+// The drain thread shouldn't outlive the module. The logger is shared by all of the
+// plugin endpoints of the module, so it's freed only when the module is unloaded.
+// Declared after the rest of the state, so it is destroyed first.
+static struct DrainGuard {
+	~DrainGuard();
+} drainGuard;
+
+
+static LogRing* acquireRing()
+{
+	if(threadRing.ring)
+		return threadRing.ring;
+
+	for(int i = 0; i < kRingCount; ++i) {
+		int expected = kRingFree;
+
+		if(rings[i].state.compare_exchange_strong(expected, kRingOwned)) {
+			threadRing.ring = &rings[i];
+			return threadRing.ring;
+		}
+	}
+
+	LogRing* head = extraRings.load(std::memory_order_acquire);
+	for(LogRing* ring = head; ring; ring = ring->next) {
+		int expected = kRingFree;
+
+		if(ring->state.compare_exchange_strong(expected, kRingOwned)) {
+			threadRing.ring = ring;
+			return threadRing.ring;
+		}
+	}
+
+	LogRing* ring = new(std::nothrow) LogRing;
+	if(!ring)
+		return nullptr;
+
+	ring->state.store(kRingOwned, std::memory_order_relaxed);
+	ring->head.store(0, std::memory_order_relaxed);
+	ring->tail.store(0, std::memory_order_relaxed);
+	ring->next = head;
+
+	while(!extraRings.compare_exchange_weak(ring->next, ring,
+			std::memory_order_release, std::memory_order_relaxed)) {
+	}
+
+	threadRing.ring = ring;
+	return threadRing.ring;
+}
+
+
+// Writes the common part of the datagram, returns its size.
+static size_t writeHeader(char* buffer, const std::string& senderId, u64 timestamp,
+		LogDatagram kind)
+{
+	std::memcpy(buffer, &timestamp, sizeof(u64));
+	char* output = buffer + sizeof(u64);
+
+	size_t idLength = std::min(senderId.size(), kMaxSenderIdSize);
+	output = std::copy(senderId.begin(), senderId.begin() + idLength, output);
+	*output++ = static_cast<char>(kind);
+
+	if(kind != LogDatagram::kText) {
+		std::memcpy(output, &session, sizeof(u64));
+		output += sizeof(u64);
+	}
+
+	return output - buffer;
+}
+
+
+static void sendDatagram(const char* buffer, size_t size)
+{
+	if(send(fd, buffer, size, 0) < 0)
+		droppedCount++;
+}
+
+
+// The count is sent with the separate datagram kind, so the reader can sum it up. The
+// count is restored if the datagram isn't sent.
+static void sendDropped(const std::string& senderId, u64 timestamp, u64 count)
+{
+	char buffer[kDatagramSize];
+	size_t size = writeHeader(buffer, senderId, timestamp, LogDatagram::kDropped);
+
+	std::memcpy(buffer + size, &count, sizeof(u64));
+
+	if(send(fd, buffer, size + sizeof(u64), 0) < 0)
+		droppedCount += count;
+}
+
+
+static void sendFormat(const std::string& senderId, u64 timestamp, u32 id)
+{
+	char buffer[kDatagramSize];
+	size_t size = writeHeader(buffer, senderId, timestamp, LogDatagram::kFormat);
+
+	std::memcpy(buffer + size, &id, sizeof(u32));
+	size += sizeof(u32);
+
+	buffer[size++] = static_cast<char>(formatLevels[id]);
+
+	size_t length = std::min(std::strlen(formats[id]), kDatagramSize - size - 1);
+	std::memcpy(buffer + size, formats[id], length);
+	buffer[size + length] = '\0';
+
+	sendDatagram(buffer, size + length + 1);
+}
+
+
+static void sendRecord(const std::string& senderId, const LogRecord& record)
+{
+	u32 id;
+	std::memcpy(&id, record.data, sizeof(u32));
+
+	// The reader needs the format to decode the record.
+	auto now = std::chrono::steady_clock::now();
+	if(!isFormatSent[id] || now - formatSentTimes[id] >
+			std::chrono::milliseconds(kFormatInterval)) {
+		sendFormat(senderId, record.timestamp, id);
+		isFormatSent[id] = true;
+		formatSentTimes[id] = now;
+	}
+
+	char buffer[kDatagramSize];
+	size_t size = writeHeader(buffer, senderId, record.timestamp, LogDatagram::kRecord);
+
+	std::memcpy(buffer + size, record.data, record.length);
+	sendDatagram(buffer, size + record.length);
+}
+
+
+static u64 currentTimestamp()
+{
+	timespec tm;
+	clock_gettime(CLOCK_REALTIME, &tm);
+	return (static_cast<u64>(tm.tv_sec) << 32) + tm.tv_nsec;
+}
+
+
+static void drainRing(const std::string& senderId, LogRing* ring)
+{
+	// The owner doesn't push anything after the ring is released, so the head loaded
+	// after the state is the final one.
+	int state = ring->state.load(std::memory_order_acquire);
+	if(state == kRingFree)
+		return;
+
+	u32 tail = ring->tail.load(std::memory_order_relaxed);
+	u32 head = ring->head.load(std::memory_order_acquire);
+
+	while(tail != head) {
+		sendRecord(senderId, ring->records[tail % kRingSize]);
+		ring->tail.store(++tail, std::memory_order_release);
+	}
+
+	if(state == kRingReleased)
+		ring->state.compare_exchange_strong(state, kRingFree);
+}
+
+
+static void drainRings()
+{
+	std::string senderId = loggerSenderId();
+
+	for(int i = 0; i < kRingCount; ++i)
+		drainRing(senderId, &rings[i]);
+
+	LogRing* ring = extraRings.load(std::memory_order_acquire);
+	for(; ring; ring = ring->next)
+		drainRing(senderId, ring);
+
+	u64 count = droppedCount.exchange(0);
+	if(count > 0)
+		sendDropped(senderId, currentTimestamp(), count);
+}
+
+
+static void drainThreadProc()
+{
+	while(isDraining) {
+		drainRings();
+		std::this_thread::sleep_for(std::chrono::milliseconds(kDrainInterval));
+	}
+
+	// Send the messages logged before the logger was freed.
+	drainRings();
+}
+
+
+// Should be called with the initGuard locked.
+static void freeLogger()
+{
+	if(fd >= 0) {
+		isDraining = false;
+		drainThread->join();
+		delete drainThread;
+		drainThread = nullptr;
+
+		close(fd.exchange(-1));
+		loggerSetSenderId(std::string());
+	}
+}
+
 
 bool loggerInit(const std::string& socketPath, const std::string& senderId)
 {
-	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
-	if(fd < 0)
+	std::lock_guard<std::mutex> lock(initGuard);
+	freeLogger();
+
+	int socketFd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if(socketFd < 0)
 		return false;
 
 	sockaddr_un address;
@@ -30,27 +333,43 @@ bool loggerInit(const std::string& socketPath, const std::string& senderId)
 	address.sun_family = AF_UNIX;
 	snprintf(address.sun_path, UNIX_PATH_MAX, socketPath.c_str());
 
-	if(connect(fd, reinterpret_cast<sockaddr*>(&address),
+	if(connect(socketFd, reinterpret_cast<sockaddr*>(&address),
 			sizeof(sockaddr_un)) != 0) {
-		close(fd);
-		fd = -1;
+		close(socketFd);
 		return false;
 	}
 
-	id = senderId;
+	timeval timeout;
+	timeout.tv_sec = 0;
+	timeout.tv_usec = kSendTimeout * 1000;
+	setsockopt(socketFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
 
-	// NOTE The buffer size is hardcoded, increase it if necessary.
-	buffer.resize(1024);
+	loggerSetSenderId(senderId);
+
+	session = (static_cast<u64>(getpid()) << 32) ^ currentTimestamp() ^
+			reinterpret_cast<uintptr_t>(&session);
+
+	std::fill(isFormatSent, isFormatSent + kMaxFormats, false);
+
+	// The records are accepted from now on.
+	fd = socketFd;
+
+	isDraining = true;
+	drainThread = new std::thread(drainThreadProc);
 	return true;
 }
 
 
+DrainGuard::~DrainGuard()
+{
+	loggerFree();
+}
+
+
 void loggerFree()
 {
-	if(fd >= 0) {
-		close(fd);
-		id.clear();
-	}
+	std::lock_guard<std::mutex> lock(initGuard);
+	freeLogger();
 }
 
 
@@ -68,45 +387,109 @@ void loggerSetLogLevel(LogLevel level)
 
 std::string loggerSenderId()
 {
+	std::lock_guard<std::mutex> lock(idGuard);
 	return id;
 }
 
 
 void loggerSetSenderId(const std::string& senderId)
 {
+	std::lock_guard<std::mutex> lock(idGuard);
 	id = senderId;
 }
 
 
-void loggerMessage(LogLevel level, const char* format, ...)
+LogFormat::LogFormat(LogLevel level, const char* format) :
+	id_(formatCount++)
+{
+	if(id_ < kMaxFormats) {
+		formats[id_] = format;
+		formatLevels[id_] = level;
+	}
+}
+
+
+u32 LogFormat::id() const
+{
+	return id_;
+}
+
+
+void LogWriter::write(LogArg tag, const void* data, size_t size)
 {
-	if(level > defaultLevel)
+	if(static_cast<size_t>(end - pos) < size + 1) {
+		pos = end;
 		return;
+	}
 
-	if(fd == -1)
+	*pos++ = static_cast<u8>(tag);
+	std::memcpy(pos, data, size);
+	pos += size;
+}
+
+
+void LogWriter::writeString(const char* string)
+{
+	if(!string)
+		string = "(null)";
+
+	size_t space = end - pos;
+	if(space < 1 + sizeof(u16)) {
+		pos = end;
 		return;
+	}
 
-	timespec tm;
-	clock_gettime(CLOCK_REALTIME, &tm);
+	u16 length = std::min(std::strlen(string), space - 1 - sizeof(u16));
+
+	*pos++ = static_cast<u8>(LogArg::kString);
+	std::memcpy(pos, &length, sizeof(u16));
+	pos += sizeof(u16);
 
-	u64* timestamp = reinterpret_cast<u64*>(buffer.data());
-	*timestamp = (static_cast<u64>(tm.tv_sec) << 32) + tm.tv_nsec;
+	std::memcpy(pos, string, length);
+	pos += length;
+}
 
-	char* output = buffer.data() + sizeof(u64);
-	output = std::copy(id.begin(), id.end(), output);
-	*output = '\x01';
-	++output;
 
-	uint count = output - buffer.data();
+bool loggerBeginRecord(const LogFormat& format, LogWriter* writer)
+{
+	if(fd == -1)
+		return false;
 
-	va_list args;
-	va_start(args, format);
+	LogRing* ring = acquireRing();
+	if(!ring || format.id() >= kMaxFormats) {
+		droppedCount++;
+		return false;
+	}
 
-	count += std::vsnprintf(output, buffer.size() - count, format, args) + 1;
+	u32 head = ring->head.load(std::memory_order_relaxed);
+	if(head - ring->tail.load(std::memory_order_acquire) >= kRingSize) {
+		droppedCount++;
+		return false;
+	}
+
+	LogRecord* record = &ring->records[head % kRingSize];
+	record->timestamp = currentTimestamp();
+
+	u32 id = format.id();
+	std::memcpy(record->data, &id, sizeof(u32));
+
+	writer->pos = record->data + sizeof(u32);
+	writer->end = record->data + sizeof(record->data);
+
+	threadRing.record = record;
+	return true;
+}
+
+
+void loggerCommitRecord(const LogWriter& writer)
+{
+	LogRing* ring = threadRing.ring;
+	LogRecord* record = threadRing.record;
 
-	va_end(args);
+	record->length = writer.pos - record->data;
 
-	send(fd, buffer.data(), count, 0);
+	u32 head = ring->head.load(std::memory_order_relaxed);
+	ring->head.store(head + 1, std::memory_order_release);
 }
 
 
@@ -1,17 +1,20 @@
 #ifndef COMMON_LOGGER_H
 #define COMMON_LOGGER_H
 
+#include <cstring>
 #include <string>
+#include <type_traits>
+#include "common/types.h"
 
 
 #define FLOOD(format, ...) \
-		Airwave::loggerMessage(Airwave::LogLevel::kFlood, format, ##__VA_ARGS__)
+		LOGGER_RECORD(Airwave::LogLevel::kFlood, format, ##__VA_ARGS__)
 
 #define DEBUG(format, ...) \
-		Airwave::loggerMessage(Airwave::LogLevel::kDebug, format, ##__VA_ARGS__)
+		LOGGER_RECORD(Airwave::LogLevel::kDebug, format, ##__VA_ARGS__)
 
 #define TRACE(format, ...) \
-		Airwave::loggerMessage(Airwave::LogLevel::kTrace, format, ##__VA_ARGS__)
+		LOGGER_RECORD(Airwave::LogLevel::kTrace, format, ##__VA_ARGS__)
 
 // Workaround for wingdi.h
 #ifdef ERROR
@@ -19,7 +22,17 @@
 #endif
 
 #define ERROR(format, ...) \
-		Airwave::loggerMessage(Airwave::LogLevel::kError, format, ##__VA_ARGS__)
+		LOGGER_RECORD(Airwave::LogLevel::kError, format, ##__VA_ARGS__)
+
+// Each call site registers its format string once, the message is recorded as the
+// format id and the raw arguments. It is formatted by the reader (see LogDecoder).
+#define LOGGER_RECORD(level, format, ...) \
+		do { \
+			if(level <= Airwave::loggerLogLevel()) { \
+				static const Airwave::LogFormat logFormat(level, format); \
+				Airwave::loggerRecord(logFormat, ##__VA_ARGS__); \
+			} \
+		} while(0)
 
 namespace Airwave {
 
@@ -34,13 +47,165 @@ enum class LogLevel {
 };
 
 
+// Each log datagram starts with the 64-bit timestamp and the sender id, followed by the
+// kind byte:
+//   kText   - the message text, null terminated;
+//   kRecord - the 64-bit logger session, the 32-bit format id and the arguments;
+//   kFormat - the session, the format id, the log level byte and the null terminated
+//             format string;
+//   kDropped - the session and the 64-bit count of messages dropped by the sender.
+// The format is sent before the first record, which uses it, and is repeated
+// periodically, so the restarted reader learns it as well.
+enum class LogDatagram : char {
+	kText = 1,
+	kRecord,
+	kFormat,
+	kDropped
+};
+
+
+// Tags of the record arguments. The numbers are widened to 64 bits, the 32-bit tags keep
+// the width of the narrower integers for the reader. The string is prefixed with its
+// 16-bit length.
+enum class LogArg : u8 {
+	kSigned = 1,
+	kUnsigned,
+	kDouble,
+	kString,
+	kPointer,
+	kSigned32,
+	kUnsigned32
+};
+
+
+// Format string and log level of the call site. The format should be a string literal,
+// since only the pointer is kept.
+class LogFormat {
+public:
+	LogFormat(LogLevel level, const char* format);
+	u32 id() const;
+
+private:
+	u32 id_;
+};
+
+
+// Writes the arguments into the record, the ones which don't fit are dropped.
+struct LogWriter {
+	u8* pos;
+	u8* end;
+
+	void write(LogArg tag, const void* data, size_t size);
+	void writeString(const char* string);
+};
+
+
 bool loggerInit(const std::string& socketPath, const std::string& senderId);
 void loggerFree();
 LogLevel loggerLogLevel();
 void loggerSetLogLevel(LogLevel level);
 std::string loggerSenderId();
 void loggerSetSenderId(const std::string& senderId);
-void loggerMessage(LogLevel level, const char* format, ...);
+bool loggerBeginRecord(const LogFormat& format, LogWriter* writer);
+void loggerCommitRecord(const LogWriter& writer);
+
+
+inline void loggerWriteArg(LogWriter* writer, const char* value)
+{
+	writer->writeString(value);
+}
+
+
+inline void loggerWriteArg(LogWriter* writer, char* value)
+{
+	writer->writeString(value);
+}
+
+
+template<typename T>
+inline void loggerWriteArg(LogWriter* writer, T* value)
+{
+	u64 data = reinterpret_cast<uintptr_t>(value);
+	writer->write(LogArg::kPointer, &data, sizeof(data));
+}
+
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+loggerWriteArg(LogWriter* writer, T value)
+{
+	i64 data = value;
+	LogArg tag = sizeof(T) <= sizeof(u32) ? LogArg::kSigned32 : LogArg::kSigned;
+	writer->write(tag, &data, sizeof(data));
+}
+
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+loggerWriteArg(LogWriter* writer, T value)
+{
+	u64 data = value;
+	LogArg tag = sizeof(T) <= sizeof(u32) ? LogArg::kUnsigned32 : LogArg::kUnsigned;
+	writer->write(tag, &data, sizeof(data));
+}
+
+
+template<typename T>
+inline typename std::enable_if<std::is_enum<T>::value>::type
+loggerWriteArg(LogWriter* writer, T value)
+{
+	i64 data = static_cast<i64>(value);
+	LogArg tag = sizeof(T) <= sizeof(u32) ? LogArg::kSigned32 : LogArg::kSigned;
+	writer->write(tag, &data, sizeof(data));
+}
+
+
+template<typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+loggerWriteArg(LogWriter* writer, T value)
+{
+	double data = value;
+	writer->write(LogArg::kDouble, &data, sizeof(data));
+}
+
+
+// Handle like objects (e.g. std::thread::id), which were passed through the varargs.
+template<typename T>
+inline typename std::enable_if<std::is_class<T>::value>::type
+loggerWriteArg(LogWriter* writer, const T& value)
+{
+	static_assert(std::is_trivially_copyable<T>::value && sizeof(T) <= sizeof(u64),
+			"Unsupported log argument type");
+
+	u64 data = 0;
+	std::memcpy(&data, &value, sizeof(T));
+	writer->write(LogArg::kPointer, &data, sizeof(data));
+}
+
+
+inline void loggerWriteArgs(LogWriter*)
+{
+}
+
+
+template<typename T, typename... Args>
+inline void loggerWriteArgs(LogWriter* writer, const T& value, const Args&... args)
+{
+	loggerWriteArg(writer, value);
+	loggerWriteArgs(writer, args...);
+}
+
+
+template<typename... Args>
+inline void loggerRecord(const LogFormat& format, const Args&... args)
+{
+	LogWriter writer;
+	if(!loggerBeginRecord(format, &writer))
+		return;
+
+	loggerWriteArgs(&writer, args...);
+	loggerCommitRecord(writer);
+}
 
 
 } // namespace Airwave
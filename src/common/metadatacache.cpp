@@ -0,0 +1,280 @@
+#include "metadatacache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common/config.h"
+#include "common/filesystem.h"
+#include "common/hash.h"
+#include "common/json.h"
+#include "common/logger.h"
+
+
+namespace Airwave {
+
+
+static std::string toHex(u64 value)
+{
+	char buffer[17];
+	std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<ulonglong>(value));
+	return buffer;
+}
+
+
+MetadataCache::MetadataCache()
+{
+	const char* string = getenv("XDG_CACHE_HOME");
+	std::string path = string ? string : std::string();
+	if(path.empty())
+		path = FileSystem::realPath("~") + "/.cache";
+
+	if(path.back() != '/')
+		path += '/';
+
+	cachePath_ = path + PROJECT_NAME "/metadata";
+}
+
+
+static u64 fromHex(const Json::Value& value)
+{
+	return std::strtoull(value.asString().c_str(), nullptr, 16);
+}
+
+
+bool MetadataCache::load(const std::string& vstPath, PluginMetadata* metadata)
+{
+	if(!identify(vstPath, metadata))
+		return false;
+
+	bool isTouched = false;
+	if(readEntry(vstPath, metadata, &isTouched)) {
+		// The binary is only touched, remember its new modification time to avoid
+		// hashing it again next time.
+		if(isTouched)
+			save(vstPath, *metadata);
+
+		return true;
+	}
+
+	// The complete identity is required to save the new entry later.
+	if(!metadata->fileHash)
+		hashFile(vstPath, &metadata->fileHash);
+
+	return false;
+}
+
+
+bool MetadataCache::readEntry(const std::string& vstPath, PluginMetadata* metadata,
+		bool* isTouched)
+{
+	std::ifstream file(filePath(vstPath));
+	if(!file.is_open())
+		return false;
+
+	Json::Value root;
+	Json::Reader reader;
+	if(!reader.parse(file, root, false))
+		return false;
+
+	if(root["path"].asString() != vstPath ||
+			root["size"].asString() != toHex(metadata->fileSize)) {
+		DEBUG("Metadata cache entry of '%s' is outdated", vstPath.c_str());
+		return false;
+	}
+
+	if(root["time"].asString() == toHex(metadata->fileTime)) {
+		metadata->fileHash = fromHex(root["hash"]);
+	}
+	else {
+		if(!hashFile(vstPath, &metadata->fileHash))
+			return false;
+
+		if(root["hash"].asString() != toHex(metadata->fileHash)) {
+			DEBUG("Metadata cache entry of '%s' is outdated", vstPath.c_str());
+			return false;
+		}
+
+		*isTouched = true;
+	}
+
+	Json::Value info = root["info"];
+	if(!info.isObject())
+		return false;
+
+	metadata->info.flags        = info["flags"].asInt();
+	metadata->info.programCount = info["program_count"].asInt();
+	metadata->info.paramCount   = info["param_count"].asInt();
+	metadata->info.inputCount   = info["input_count"].asInt();
+	metadata->info.outputCount  = info["output_count"].asInt();
+	metadata->info.initialDelay = info["initial_delay"].asInt();
+	metadata->info.uniqueId     = info["unique_id"].asInt();
+	metadata->info.version      = info["version"].asInt();
+
+	Json::Value values = root["values"];
+	for(const std::string& name : values.getMemberNames())
+		metadata->values[name] = values[name].asInt64();
+
+	Json::Value strings = root["strings"];
+	for(const std::string& name : strings.getMemberNames())
+		metadata->strings[name] = strings[name].asString();
+
+	Json::Value names = root["parameter_names"];
+	for(const std::string& index : names.getMemberNames())
+		metadata->parameterNames[std::atoi(index.c_str())] = names[index].asString();
+
+	names = root["program_names"];
+	for(const std::string& index : names.getMemberNames())
+		metadata->programNames[std::atoi(index.c_str())] = names[index].asString();
+
+	Json::Value canDo = root["can_do"];
+	for(const std::string& name : canDo.getMemberNames())
+		metadata->canDo[name] = canDo[name].asInt64();
+
+	Json::Value parameters = root["parameter_values"];
+	for(const std::string& index : parameters.getMemberNames())
+		metadata->parameterValues[std::atoi(index.c_str())] = parameters[index].asFloat();
+
+	return true;
+}
+
+
+bool MetadataCache::save(const std::string& vstPath, const PluginMetadata& metadata)
+{
+	if(!FileSystem::makePath(cachePath_)) {
+		ERROR("Unable to create metadata cache directory '%s'", cachePath_.c_str());
+		return false;
+	}
+
+	Json::Value root;
+	root["path"] = vstPath;
+	root["size"] = toHex(metadata.fileSize);
+	root["time"] = toHex(metadata.fileTime);
+	root["hash"] = toHex(metadata.fileHash);
+
+	Json::Value info;
+	info["flags"]         = metadata.info.flags;
+	info["program_count"] = metadata.info.programCount;
+	info["param_count"]   = metadata.info.paramCount;
+	info["input_count"]   = metadata.info.inputCount;
+	info["output_count"]  = metadata.info.outputCount;
+	info["initial_delay"] = metadata.info.initialDelay;
+	info["unique_id"]     = metadata.info.uniqueId;
+	info["version"]       = metadata.info.version;
+	root["info"] = info;
+
+	Json::Value values(Json::objectValue);
+	for(auto& it : metadata.values)
+		values[it.first] = static_cast<Json::Int64>(it.second);
+
+	root["values"] = values;
+
+	Json::Value strings(Json::objectValue);
+	for(auto& it : metadata.strings)
+		strings[it.first] = it.second;
+
+	root["strings"] = strings;
+
+	Json::Value names(Json::objectValue);
+	for(auto& it : metadata.parameterNames)
+		names[std::to_string(it.first)] = it.second;
+
+	root["parameter_names"] = names;
+
+	names = Json::Value(Json::objectValue);
+	for(auto& it : metadata.programNames)
+		names[std::to_string(it.first)] = it.second;
+
+	root["program_names"] = names;
+
+	Json::Value canDo(Json::objectValue);
+	for(auto& it : metadata.canDo)
+		canDo[it.first] = static_cast<Json::Int64>(it.second);
+
+	root["can_do"] = canDo;
+
+	Json::Value parameters(Json::objectValue);
+	for(auto& it : metadata.parameterValues)
+		parameters[std::to_string(it.first)] = it.second;
+
+	root["parameter_values"] = parameters;
+
+	// Write to a temporary file first, so the concurrently started plugin endpoints
+	// never read a partially written entry.
+	std::string path = filePath(vstPath);
+	std::string tempPath = path + '.' + std::to_string(getpid());
+
+	std::ofstream file(tempPath, std::ios::out | std::ios::trunc);
+	if(!file.is_open())
+		return false;
+
+	Json::StyledWriter writer;
+	file << writer.write(root);
+	file.close();
+
+	if(!file || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+		ERROR("Unable to write metadata cache entry '%s'", path.c_str());
+		unlink(tempPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+
+std::string MetadataCache::filePath(const std::string& vstPath) const
+{
+	return cachePath_ + '/' + toHex(hash64(vstPath.data(), vstPath.size())) + ".json";
+}
+
+
+bool MetadataCache::identify(const std::string& vstPath, PluginMetadata* metadata)
+{
+	struct stat info;
+	if(stat(vstPath.c_str(), &info) != 0) {
+		ERROR("Unable to stat VST plugin binary '%s'", vstPath.c_str());
+		return false;
+	}
+
+	metadata->fileSize = info.st_size;
+	metadata->fileTime = static_cast<i64>(info.st_mtim.tv_sec) * 1000000000 +
+			info.st_mtim.tv_nsec;
+	metadata->fileHash = 0;
+	return true;
+}
+
+
+bool MetadataCache::hashFile(const std::string& vstPath, u64* hash)
+{
+	int fd = open(vstPath.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return false;
+
+	struct stat info;
+	if(fstat(fd, &info) != 0) {
+		close(fd);
+		return false;
+	}
+
+	*hash = 0;
+
+	if(info.st_size > 0) {
+		void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+
+		*hash = hash64(data, info.st_size);
+		munmap(data, info.st_size);
+	}
+
+	close(fd);
+	return true;
+}
+
+
+} // namespace Airwave
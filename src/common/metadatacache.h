@@ -0,0 +1,66 @@
+#ifndef COMMON_METADATACACHE_H
+#define COMMON_METADATACACHE_H
+
+#include <map>
+#include <string>
+#include "common/protocol.h"
+#include "common/types.h"
+
+
+namespace Airwave {
+
+
+// Static information about the VST plugin, which is enough to answer the queries of a
+// DAW plugin scan. Only the answers received from the VST plugin are stored, so the
+// missing entries mean "unknown" rather than "unsupported".
+struct PluginMetadata {
+	PluginMetadata() : fileSize(0), fileTime(0), fileHash(0), info() {}
+
+	// Identity of the VST plugin binary, the cached metadata is valid only while the
+	// binary remains the same.
+	u64 fileSize;
+	i64 fileTime;
+	u64 fileHash;
+
+	PluginInfo info;
+
+	std::map<std::string, i64> values;
+	std::map<std::string, std::string> strings;
+	std::map<i32, std::string> parameterNames;
+	std::map<i32, std::string> programNames;
+	std::map<std::string, i64> canDo;
+
+	// Parameter values right after the host endpoint start.
+	std::map<i32, float> parameterValues;
+};
+
+
+// On-disk cache of the VST plugin metadata. There is a separate file for every VST
+// plugin binary, keyed by the binary path. The entry is used only when the size and
+// modification time of the binary match. The content hash is compared only when they
+// don't, so the binary is read just after it has been touched.
+class MetadataCache {
+public:
+	MetadataCache();
+
+	// Fills the binary identity fields of the metadata even if the cache entry is
+	// missing or outdated, so the metadata can be saved later.
+	bool load(const std::string& vstPath, PluginMetadata* metadata);
+	bool save(const std::string& vstPath, const PluginMetadata& metadata);
+
+private:
+	std::string cachePath_;
+
+	std::string filePath(const std::string& vstPath) const;
+	bool readEntry(const std::string& vstPath, PluginMetadata* metadata,
+			bool* isTouched);
+
+	static bool identify(const std::string& vstPath, PluginMetadata* metadata);
+	static bool hashFile(const std::string& vstPath, u64* hash);
+};
+
+
+} // namespace Airwave
+
+
+#endif // COMMON_METADATACACHE_H
@@ -1,26 +1,112 @@
 #include "moduleinfo.h"
 
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-ModuleInfo::ModuleInfo() :
-	isInitialized_(false)
-{
-	magic_ = magic_open(MAGIC_NONE);
-	if(!magic_) {
-		return;
+
+// PE/COFF constants, see the Microsoft PE and COFF specification.
+static const u16 kDosSignature          = 0x5a4d;     // "MZ"
+static const u32 kPeSignature           = 0x00004550; // "PE\0\0"
+static const u16 kMachineI386           = 0x014c;
+static const u16 kMachineAmd64          = 0x8664;
+static const u16 kOptionalMagicPe32     = 0x010b;
+static const u16 kOptionalMagicPe32Plus = 0x020b;
+static const u32 kExportDirectory       = 0;
+static const u32 kImportDirectory       = 1;
+static const size_t kSectionHeaderSize  = 40;
+static const size_t kImportEntrySize    = 20;
+
+// Limits protecting against the corrupted headers.
+static const u32 kMaxExportNames = 65536;
+static const u32 kMaxImports     = 4096;
+
+
+// Bounds checked little-endian reader of the mapped module image.
+class ImageReader {
+public:
+	ImageReader(const u8* data, size_t size) :
+		data_(data),
+		size_(size),
+		sectionCount_(0),
+		sectionOffset_(0)
+	{
 	}
 
-	if(magic_load(magic_, nullptr) != 0) {
-		magic_close(magic_);
-		return;
+	template<typename T>
+	bool read(size_t offset, T* value) const
+	{
+		if(offset > size_ || size_ - offset < sizeof(T))
+			return false;
+
+		std::memcpy(value, data_ + offset, sizeof(T));
+		return true;
+	}
+
+	void setSections(size_t offset, u16 count)
+	{
+		sectionOffset_ = offset;
+		sectionCount_ = count;
+	}
+
+	// Converts the relative virtual address to the file offset using the section table.
+	bool toOffset(u32 rva, size_t* offset) const
+	{
+		for(u16 i = 0; i < sectionCount_; ++i) {
+			size_t header = sectionOffset_ + i * kSectionHeaderSize;
+
+			u32 virtualAddress;
+			u32 rawSize;
+			u32 rawOffset;
+
+			if(!read(header + 12, &virtualAddress) || !read(header + 16, &rawSize) ||
+					!read(header + 20, &rawOffset)) {
+				return false;
+			}
+
+			// Only the part of the section backed by the file data is of interest.
+			if(rva >= virtualAddress && rva - virtualAddress < rawSize) {
+				*offset = static_cast<size_t>(rawOffset) + (rva - virtualAddress);
+				return *offset < size_;
+			}
+		}
+
+		return false;
+	}
+
+	bool readString(u32 rva, std::string* string) const
+	{
+		size_t offset;
+		if(!toOffset(rva, &offset))
+			return false;
+
+		const char* begin = reinterpret_cast<const char*>(data_ + offset);
+		const void* end = std::memchr(begin, 0, size_ - offset);
+		if(!end)
+			return false;
+
+		string->assign(begin, static_cast<const char*>(end));
+		return true;
 	}
 
-	isInitialized_ = true;
+private:
+	const u8* data_;
+	size_t size_;
+	u16 sectionCount_;
+	size_t sectionOffset_;
+};
+
+
+ModuleInfo::ModuleInfo()
+{
 }
 
 
 ModuleInfo::~ModuleInfo()
 {
-	magic_close(magic_);
 }
 
 
@@ -33,20 +119,196 @@ ModuleInfo* ModuleInfo::instance()
 
 ModuleInfo::Arch ModuleInfo::getArch(const std::string& fileName) const
 {
-	if(isInitialized_) {
-		const char* buffer = magic_file(magic_, fileName.c_str());
+	Module module;
+	if(!getModule(fileName, &module))
+		return kArchUnknown;
+
+	return module.arch;
+}
+
+
+bool ModuleInfo::getModule(const std::string& fileName, Module* module) const
+{
+	int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return false;
+
+	struct stat info;
+	if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+		close(fd);
+		return false;
+	}
+
+	u64 fileSize = info.st_size;
+	i64 fileTime = static_cast<i64>(info.st_mtim.tv_sec) * 1000000000 +
+			info.st_mtim.tv_nsec;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		auto it = cache_.find(fileName);
+		if(it != cache_.end() && it->second.fileSize == fileSize &&
+				it->second.fileTime == fileTime) {
+			close(fd);
+
+			if(!it->second.isValid)
+				return false;
+
+			*module = it->second.module;
+			return true;
+		}
+	}
+
+	Entry entry;
+	entry.fileSize = fileSize;
+	entry.fileTime = fileTime;
+	entry.isValid = false;
+
+	if(fileSize > 0) {
+		void* data = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data != MAP_FAILED) {
+			entry.isValid = parse(static_cast<const u8*>(data), fileSize, &entry.module);
+			munmap(data, fileSize);
+		}
+	}
+
+	close(fd);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	cache_[fileName] = entry;
+
+	if(!entry.isValid)
+		return false;
+
+	*module = entry.module;
+	return true;
+}
+
+
+bool ModuleInfo::parse(const u8* data, size_t size, Module* module)
+{
+	ImageReader reader(data, size);
+
+	u16 dosSignature;
+	u32 peOffset;
+	if(!reader.read(0, &dosSignature) || dosSignature != kDosSignature ||
+			!reader.read(0x3c, &peOffset)) {
+		return false;
+	}
 
-		if(buffer) {
-			std::string string = buffer;
+	u32 peSignature;
+	if(!reader.read(peOffset, &peSignature) || peSignature != kPeSignature)
+		return false;
 
-			if(string.find("80386") != std::string::npos) {
-				return kArch32;
+	// COFF file header
+	size_t coffOffset = static_cast<size_t>(peOffset) + 4;
+
+	u16 machine;
+	u16 sectionCount;
+	u16 optionalSize;
+	if(!reader.read(coffOffset, &machine) ||
+			!reader.read(coffOffset + 2, &sectionCount) ||
+			!reader.read(coffOffset + 16, &optionalSize)) {
+		return false;
+	}
+
+	if(machine == kMachineI386) {
+		module->arch = kArch32;
+	}
+	else if(machine == kMachineAmd64) {
+		module->arch = kArch64;
+	}
+	else {
+		return false;
+	}
+
+	// Optional header, its layout depends on the image format.
+	size_t optionalOffset = coffOffset + 20;
+
+	u16 optionalMagic;
+	if(!reader.read(optionalOffset, &optionalMagic))
+		return false;
+
+	size_t directoryCountOffset;
+	if(optionalMagic == kOptionalMagicPe32) {
+		directoryCountOffset = 92;
+	}
+	else if(optionalMagic == kOptionalMagicPe32Plus) {
+		directoryCountOffset = 108;
+	}
+	else {
+		return false;
+	}
+
+	u32 directoryCount;
+	if(directoryCountOffset + 4 > optionalSize ||
+			!reader.read(optionalOffset + directoryCountOffset, &directoryCount)) {
+		return false;
+	}
+
+	reader.setSections(optionalOffset + optionalSize, sectionCount);
+
+	auto readDirectory = [&](u32 index, u32* rva, u32* dirSize) {
+		size_t offset = directoryCountOffset + 4 + index * 8;
+		if(index >= directoryCount || offset + 8 > optionalSize)
+			return false;
+
+		return reader.read(optionalOffset + offset, rva) &&
+				reader.read(optionalOffset + offset + 4, dirSize) && *rva != 0;
+	};
+
+	u32 rva;
+	u32 dirSize;
+
+	// Export directory, the VST plugin exports the VSTPluginMain or the legacy main
+	// entry point.
+	module->isVstPlugin = false;
+
+	size_t exportOffset;
+	if(readDirectory(kExportDirectory, &rva, &dirSize) &&
+			reader.toOffset(rva, &exportOffset)) {
+		u32 nameCount;
+		u32 namesRva;
+		size_t namesOffset;
+
+		if(reader.read(exportOffset + 24, &nameCount) &&
+				reader.read(exportOffset + 32, &namesRva) &&
+				reader.toOffset(namesRva, &namesOffset)) {
+			nameCount = std::min(nameCount, kMaxExportNames);
+
+			for(u32 i = 0; i < nameCount && !module->isVstPlugin; ++i) {
+				u32 nameRva;
+				std::string name;
+
+				if(!reader.read(namesOffset + i * 4, &nameRva) ||
+						!reader.readString(nameRva, &name)) {
+					break;
+				}
+
+				if(name == "VSTPluginMain" || name == "main")
+					module->isVstPlugin = true;
 			}
-			else if(string.find("x86-64") != std::string::npos) {
-				return kArch64;
+		}
+	}
+
+	// Import directory, the array of descriptors is terminated by the zeroed one.
+	module->imports.clear();
+
+	size_t importOffset;
+	if(readDirectory(kImportDirectory, &rva, &dirSize) &&
+			reader.toOffset(rva, &importOffset)) {
+		for(u32 i = 0; i < kMaxImports; ++i) {
+			u32 nameRva;
+			std::string name;
+
+			if(!reader.read(importOffset + i * kImportEntrySize + 12, &nameRva) ||
+					nameRva == 0 || !reader.readString(nameRva, &name)) {
+				break;
 			}
+
+			module->imports.push_back(name);
 		}
 	}
 
-	return kArchUnknown;
+	return true;
 }
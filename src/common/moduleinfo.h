@@ -1,8 +1,11 @@
 #ifndef COMMON_MODULEINFO_H
 #define COMMON_MODULEINFO_H
 
+#include <map>
+#include <mutex>
 #include <string>
-#include <magic.h>
+#include <vector>
+#include "common/types.h"
 
 
 class ModuleInfo {
@@ -13,6 +16,13 @@ public:
 		kArch64      = 64
 	};
 
+	// Information read from the PE/COFF headers of the Windows module.
+	struct Module {
+		Arch arch;
+		bool isVstPlugin;
+		std::vector<std::string> imports;
+	};
+
 	static ModuleInfo* instance();
 
 	ModuleInfo(const ModuleInfo&) = delete;
@@ -22,11 +32,24 @@ public:
 
 	Arch getArch(const std::string& fileName) const;
 
+	// The results are cached by the file path and are reparsed only when the size or
+	// the modification time of the file changes. This function is thread safe.
+	bool getModule(const std::string& fileName, Module* module) const;
+
 private:
-	bool isInitialized_;
-	magic_t magic_;
+	struct Entry {
+		u64 fileSize;
+		i64 fileTime;
+		bool isValid;
+		Module module;
+	};
+
+	mutable std::mutex mutex_;
+	mutable std::map<std::string, Entry> cache_;
 
 	ModuleInfo();
+
+	static bool parse(const u8* data, size_t size, Module* module);
 };
 
 
@@ -0,0 +1,140 @@
+#include "parametermirror.h"
+
+#include "common/logger.h"
+
+
+namespace Airwave {
+
+
+ParameterMirror::ParameterMirror() :
+	header_(nullptr),
+	values_(nullptr),
+	pending_(nullptr)
+{
+}
+
+
+bool ParameterMirror::create(i32 count)
+{
+	size_t size = sizeof(Header) + (sizeof(std::atomic<float>) +
+			sizeof(std::atomic<u32>)) * count;
+
+	if(!port_.create(size)) {
+		ERROR("Unable to create parameter mirror");
+		return false;
+	}
+
+	header_ = port_.frame<Header>();
+	header_->count = count;
+
+	values_ = reinterpret_cast<std::atomic<float>*>(header_ + 1);
+	pending_ = reinterpret_cast<std::atomic<u32>*>(values_ + count);
+
+	for(i32 i = 0; i < count; ++i) {
+		values_[i].store(0.0f, std::memory_order_relaxed);
+		pending_[i].store(0, std::memory_order_relaxed);
+	}
+
+	return true;
+}
+
+
+bool ParameterMirror::connect(int id, pid_t owner)
+{
+	if(!port_.connect(id, owner)) {
+		ERROR("Unable to connect parameter mirror");
+		return false;
+	}
+
+	header_ = port_.frame<Header>();
+	values_ = reinterpret_cast<std::atomic<float>*>(header_ + 1);
+	pending_ = reinterpret_cast<std::atomic<u32>*>(values_ + header_->count);
+	return true;
+}
+
+
+void ParameterMirror::disconnect()
+{
+	port_.disconnect();
+	header_ = nullptr;
+	values_ = nullptr;
+	pending_ = nullptr;
+}
+
+
+void ParameterMirror::releaseDescriptor()
+{
+	port_.releaseDescriptor();
+}
+
+
+bool ParameterMirror::isNull() const
+{
+	return !header_;
+}
+
+
+int ParameterMirror::id() const
+{
+	return port_.id();
+}
+
+
+pid_t ParameterMirror::owner() const
+{
+	return port_.owner();
+}
+
+
+i32 ParameterMirror::count() const
+{
+	return header_ ? header_->count : 0;
+}
+
+
+float ParameterMirror::value(i32 index) const
+{
+	if(index < 0 || index >= count())
+		return 0.0f;
+
+	return values_[index].load(std::memory_order_relaxed);
+}
+
+
+void ParameterMirror::setValue(i32 index, float value)
+{
+	if(index >= 0 && index < count())
+		values_[index].store(value, std::memory_order_relaxed);
+}
+
+
+bool ParameterMirror::isPending(i32 index) const
+{
+	return index >= 0 && index < count() &&
+			pending_[index].load(std::memory_order_acquire) != 0;
+}
+
+
+void ParameterMirror::addPending(i32 index)
+{
+	if(index >= 0 && index < count())
+		pending_[index].fetch_add(1, std::memory_order_release);
+}
+
+
+bool ParameterMirror::removePending(i32 index)
+{
+	if(index < 0 || index >= count())
+		return true;
+
+	// Never goes below zero, the changes could be queued before the mirror is connected.
+	u32 pending = pending_[index].load(std::memory_order_relaxed);
+	while(pending && !pending_[index].compare_exchange_weak(pending, pending - 1,
+			std::memory_order_acq_rel)) {
+	}
+
+	return pending <= 1;
+}
+
+
+} // namespace Airwave
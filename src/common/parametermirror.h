@@ -0,0 +1,55 @@
+#ifndef COMMON_PARAMETERMIRROR_H
+#define COMMON_PARAMETERMIRROR_H
+
+#include <atomic>
+#include "common/dataport.h"
+#include "common/types.h"
+
+
+namespace Airwave {
+
+
+// Copy of the VST plugin parameter values placed in the shared memory. The host endpoint
+// keeps it up to date, so the plugin endpoint can read the values without requests. Each
+// value is a separate atomic, so neither side ever waits for the other one. The number
+// of the queued changes is counted per value, the host endpoint doesn't refresh such
+// values until the changes are applied to the VST plugin.
+class ParameterMirror {
+public:
+	ParameterMirror();
+
+	bool create(i32 count);
+	bool connect(int id, pid_t owner);
+	void disconnect();
+	void releaseDescriptor();
+
+	bool isNull() const;
+	int id() const;
+	pid_t owner() const;
+	i32 count() const;
+
+	float value(i32 index) const;
+	void setValue(i32 index, float value);
+
+	bool isPending(i32 index) const;
+	void addPending(i32 index);
+
+	// Returns true if there are no more queued changes of the value.
+	bool removePending(i32 index);
+
+private:
+	struct Header {
+		i32 count;
+	};
+
+	DataPort port_;
+	Header* header_;
+	std::atomic<float>* values_;
+	std::atomic<u32>* pending_;
+};
+
+
+} // namespace Airwave
+
+
+#endif // COMMON_PARAMETERMIRROR_H
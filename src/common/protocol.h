@@ -19,7 +19,12 @@ enum class Command {
 	ShowWindow,
 	GetDataBlock,
 	SetDataBlock,
-	AudioMaster
+	AudioMaster,
+	ParameterMirror,
+	ParameterQueue,
+	AutomationQueue,
+	RealtimePort,
+	ChunkPort
 };
 
 
@@ -45,6 +50,107 @@ struct PluginInfo {
 } __attribute__((packed));
 
 
+// Parameter change, queued by the plugin endpoint instead of the SetParameter request.
+// The offset is the estimated position of the change in the next processed block.
+struct ParameterChange {
+	i32   index;
+	float value;
+	i32   offset;
+} __attribute__((packed));
+
+
+// Placed at the beginning of the effGetChunk request and response data. The plugin
+// endpoint sends the hash of the chunk it already has, the host endpoint replies with
+// the hash of the current chunk. The first data block follows the response header,
+// unless both hashes are equal.
+struct ChunkHeader {
+	u64 hash;
+	u64 size;
+} __attribute__((packed));
+
+
+// Automation notification (audioMasterAutomate, audioMasterBeginEdit or
+// audioMasterEndEdit), queued by the host endpoint instead of the AudioMaster request.
+struct AutomationEvent {
+	i32   opcode;
+	i32   index;
+	float value;
+} __attribute__((packed));
+
+
+// Channel buffers of the process requests are aligned to the cache line size, so the
+// SIMD code of the VST plugin can use aligned loads and stores.
+static const size_t kAudioAlignment = 64;
+
+constexpr size_t alignAudio(size_t size)
+{
+	return (size + kAudioAlignment - 1) & ~(kAudioAlignment - 1);
+}
+
+
+// Placed at the beginning of the process request data. The input and output channel
+// buffers don't overlap, so the VST plugin is free to process out of place. The offsets
+// are relative to the beginning of the DataFrame, which is aligned to kAudioAlignment.
+// The eventCount VstEvent structures at the eventOffset are the events, received by the
+// plugin endpoint since the previous process request. They are passed to the VST plugin
+// with the effProcessEvents right before processing the block.
+// The VstTimeInfo at the timeInfoOffset is the snapshot of the VST host transport state
+// for the block, it is zero if the VST host didn't provide it.
+// The priority is the SCHED_FIFO priority for the audio thread of the host endpoint, it
+// is zero if the thread shouldn't be scheduled as realtime.
+struct AudioLayout {
+	i32 timeInfoOffset;
+	i32 inputOffset;
+	i32 outputOffset;
+	i32 channelStride;
+	i32 eventOffset;
+	i32 eventCount;
+	i32 priority;
+} __attribute__((packed));
+
+
+// Sent along with the effSetBlockSize request. The audio port frame is divided into
+// (1 + slotCount) slots of slotSize bytes each. The first slot is used for synchronous
+// requests, the rest ones are used in the round-robin order for pipelined processing.
+// In synchronous mode the slotCount is zero and process requests use the first slot.
+// The spinLimit is the upper bound of the busy-waiting phase in microseconds.
+// The owner is the pid of the process that created the port (see DataPort::connect).
+// If the sampleAccurate is set, the blocks are split at the parameter change offsets.
+// The cpuAffinity is the mask of CPUs for the audio thread, zero means all CPUs.
+struct AudioPortInfo {
+	i32 owner;
+	i32 slotCount;
+	i32 slotSize;
+	i32 spinLimit;
+	i32 priorityInheritance;
+	i32 sampleAccurate;
+	u64 cpuAffinity;
+} __attribute__((packed));
+
+
+// Sent by the plugin endpoint to the host pool daemon over its socket, and forwarded by
+// the daemon to the idle host endpoint through the pool port. The host endpoint then
+// proceeds as if it was started with these arguments. The daemon replies with the pid of
+// the claimed host endpoint, or zero if there is no idle one for the hostPath.
+// In the server mode the host endpoint accepts many claims, the claim with the portId
+// set to kPoolRetire tells it to exit after the last served instance is closed.
+// The claim is followed by the second message with the environment of the plugin
+// endpoint (null terminated strings, up to kPoolEnvironmentSize bytes). The daemon only
+// hands over the host endpoints started with the same environment.
+static const size_t kPoolPathSize = 4096;
+static const size_t kPoolEnvironmentSize = 65536;
+static const i32 kPoolRetire = -1;
+
+struct PoolClaim {
+	i32  portId;
+	i32  portOwner;
+	i32  logLevel;
+	char hostPath[kPoolPathSize];
+	char vstPath[kPoolPathSize];
+	char logSocketPath[kPoolPathSize];
+} __attribute__((packed));
+
+
 } // namespace Airwave
 
 
@@ -0,0 +1,221 @@
+#ifndef COMMON_SHAREDQUEUE_H
+#define COMMON_SHAREDQUEUE_H
+
+#include <atomic>
+#include "common/dataport.h"
+#include "common/logger.h"
+#include "common/types.h"
+
+
+namespace Airwave {
+
+
+// Bounded lock-free queue placed in the shared memory. Any number of threads of both
+// endpoints can push and pop items concurrently, none of the operations ever block.
+// The capacity should be a power of two. The element type must be trivially copyable.
+template<typename T>
+class SharedQueue {
+public:
+	SharedQueue();
+
+	bool create(u32 capacity);
+	bool connect(int id, pid_t owner);
+	void disconnect();
+	void releaseDescriptor();
+
+	bool isNull() const;
+	int id() const;
+	pid_t owner() const;
+
+	// Returns false if the queue is full.
+	bool push(const T& item);
+
+	// Returns false if the queue is empty.
+	bool pop(T* item);
+
+	// The request event of the underlying port is used as a doorbell, so the consumer
+	// can sleep until the producer has pushed something.
+	void notify();
+	bool wait(int msecs = Event::kInfinite);
+
+private:
+	struct Cell {
+		std::atomic<u32> sequence;
+		T data;
+	};
+
+	struct Header {
+		u32 mask;
+		alignas(64) std::atomic<u32> pushPosition;
+		alignas(64) std::atomic<u32> popPosition;
+	};
+
+	DataPort port_;
+	Header* header_;
+	Cell* cells_;
+};
+
+
+template<typename T>
+SharedQueue<T>::SharedQueue() :
+	header_(nullptr),
+	cells_(nullptr)
+{
+}
+
+
+template<typename T>
+bool SharedQueue<T>::create(u32 capacity)
+{
+	if(capacity == 0 || (capacity & (capacity - 1))) {
+		ERROR("Queue capacity should be a power of two (%u)", capacity);
+		return false;
+	}
+
+	if(!port_.create(sizeof(Header) + sizeof(Cell) * capacity))
+		return false;
+
+	header_ = port_.frame<Header>();
+	header_->mask = capacity - 1;
+	header_->pushPosition = 0;
+	header_->popPosition = 0;
+
+	cells_ = reinterpret_cast<Cell*>(header_ + 1);
+	for(u32 i = 0; i < capacity; ++i)
+		cells_[i].sequence.store(i, std::memory_order_relaxed);
+
+	return true;
+}
+
+
+template<typename T>
+bool SharedQueue<T>::connect(int id, pid_t owner)
+{
+	if(!port_.connect(id, owner))
+		return false;
+
+	header_ = port_.frame<Header>();
+	cells_ = reinterpret_cast<Cell*>(header_ + 1);
+	return true;
+}
+
+
+template<typename T>
+void SharedQueue<T>::disconnect()
+{
+	port_.disconnect();
+	header_ = nullptr;
+	cells_ = nullptr;
+}
+
+
+template<typename T>
+void SharedQueue<T>::releaseDescriptor()
+{
+	port_.releaseDescriptor();
+}
+
+
+template<typename T>
+bool SharedQueue<T>::isNull() const
+{
+	return !header_;
+}
+
+
+template<typename T>
+int SharedQueue<T>::id() const
+{
+	return port_.id();
+}
+
+
+template<typename T>
+pid_t SharedQueue<T>::owner() const
+{
+	return port_.owner();
+}
+
+
+template<typename T>
+bool SharedQueue<T>::push(const T& item)
+{
+	if(isNull())
+		return false;
+
+	u32 position = header_->pushPosition.load(std::memory_order_relaxed);
+
+	for(;;) {
+		Cell* cell = &cells_[position & header_->mask];
+		u32 sequence = cell->sequence.load(std::memory_order_acquire);
+		i32 diff = static_cast<i32>(sequence - position);
+
+		if(diff == 0) {
+			if(header_->pushPosition.compare_exchange_weak(position, position + 1,
+					std::memory_order_relaxed)) {
+				cell->data = item;
+				cell->sequence.store(position + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if(diff < 0) {
+			return false;
+		}
+		else {
+			position = header_->pushPosition.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+
+template<typename T>
+bool SharedQueue<T>::pop(T* item)
+{
+	if(isNull())
+		return false;
+
+	u32 position = header_->popPosition.load(std::memory_order_relaxed);
+
+	for(;;) {
+		Cell* cell = &cells_[position & header_->mask];
+		u32 sequence = cell->sequence.load(std::memory_order_acquire);
+		i32 diff = static_cast<i32>(sequence - (position + 1));
+
+		if(diff == 0) {
+			if(header_->popPosition.compare_exchange_weak(position, position + 1,
+					std::memory_order_relaxed)) {
+				*item = cell->data;
+				cell->sequence.store(position + header_->mask + 1,
+						std::memory_order_release);
+				return true;
+			}
+		}
+		else if(diff < 0) {
+			return false;
+		}
+		else {
+			position = header_->popPosition.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+
+template<typename T>
+void SharedQueue<T>::notify()
+{
+	if(!isNull())
+		port_.sendRequest();
+}
+
+
+template<typename T>
+bool SharedQueue<T>::wait(int msecs)
+{
+	return !isNull() && port_.waitRequest(msecs);
+}
+
+
+} // namespace Airwave
+
+
+#endif // COMMON_SHAREDQUEUE_H
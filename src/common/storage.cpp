@@ -9,6 +9,18 @@
 namespace Airwave {
 
 
+static int boundLogBufferSize(int size)
+{
+	if(size < Storage::kMinLogBufferSize)
+		return Storage::kMinLogBufferSize;
+
+	if(size > Storage::kMaxLogBufferSize)
+		return Storage::kMaxLogBufferSize;
+
+	return size;
+}
+
+
 Storage::Storage() :
 	isChanged_(false)
 {
@@ -47,6 +59,7 @@ bool Storage::reload()
 	const char* string = getenv("TMPDIR");
 	std::string tempPath = string ? string : "/tmp";
 	logSocketPath_ = tempPath + "/" PROJECT_NAME ".sock";
+	logBufferSize_ = 1024;
 
 	defaultLogLevel_ = LogLevel::kTrace;
 
@@ -83,6 +96,10 @@ bool Storage::reload()
 	if(!value.isNull())
 		logSocketPath_ = value.asString();
 
+	value = root["log_buffer_size"];
+	if(!value.isNull())
+		logBufferSize_ = boundLogBufferSize(value.asInt());
+
 	value = root["default_log_level"];
 	if(!value.isNull()) {
 		defaultLogLevel_ = static_cast<LogLevel>(value.asInt());
@@ -144,6 +161,32 @@ bool Storage::reload()
 				info.level = LogLevel::kDefault;
 		}
 
+		info.isPipelined = link["pipelined"].asBool();
+
+		info.spinLimit = link["spin_limit"].asInt();
+		if(info.spinLimit < 0)
+			info.spinLimit = 0;
+
+		info.hasPriorityInheritance = link["priority_inheritance"].asBool();
+
+		info.hasHugePages = link["huge_pages"].asBool();
+
+		info.isSampleAccurate = link["sample_accurate"].asBool();
+
+		value = link["realtime_priority"];
+		if(value.isNull()) {
+			info.realtimePriority = Link::kInheritPriority;
+		}
+		else {
+			info.realtimePriority = value.asInt();
+			if(info.realtimePriority < Link::kInheritPriority ||
+					info.realtimePriority > 99) {
+				info.realtimePriority = Link::kInheritPriority;
+			}
+		}
+
+		info.cpuAffinity = link["cpu_affinity"].asString();
+
 		path = link["path"].asString();
 		linkByPath_.emplace(makePair(path, info));
 	}
@@ -172,6 +215,7 @@ bool Storage::save()
 	Json::Value root;
 	root["binaries_path"] = binariesPath_;
 	root["log_socket_path"] = logSocketPath_;
+	root["log_buffer_size"] = logBufferSize_;
 	root["default_log_level"] = static_cast<int>(defaultLogLevel_);
 
 	Json::Value prefixes(Json::arrayValue);
@@ -210,6 +254,13 @@ bool Storage::save()
 		link["prefix"] = it.second.prefix;
 		link["target"] = it.second.target;
 		link["log_level"] = static_cast<int>(it.second.level);
+		link["pipelined"] = it.second.isPipelined;
+		link["spin_limit"] = it.second.spinLimit;
+		link["priority_inheritance"] = it.second.hasPriorityInheritance;
+		link["huge_pages"] = it.second.hasHugePages;
+		link["sample_accurate"] = it.second.isSampleAccurate;
+		link["realtime_priority"] = it.second.realtimePriority;
+		link["cpu_affinity"] = it.second.cpuAffinity;
 
 		links.append(link);
 	}
@@ -237,6 +288,19 @@ void Storage::setLogSocketPath(const std::string& path)
 }
 
 
+int Storage::logBufferSize() const
+{
+	return logBufferSize_;
+}
+
+
+void Storage::setLogBufferSize(int size)
+{
+	logBufferSize_ = boundLogBufferSize(size);
+	isChanged_ = true;
+}
+
+
 std::string Storage::binariesPath() const
 {
 	return binariesPath_;
@@ -356,6 +420,12 @@ Storage::Link Storage::createLink(const std::string& path, const std::string& ta
 	info.prefix = prefix;
 	info.loader = loader;
 	info.level  = LogLevel::kDefault;
+	info.isPipelined = false;
+	info.spinLimit = 0;
+	info.hasPriorityInheritance = false;
+	info.hasHugePages = false;
+	info.isSampleAccurate = false;
+	info.realtimePriority = Link::kInheritPriority;
 
 	auto result = linkByPath_.emplace(makePair(path, info));
 	if(!result.second)
@@ -695,6 +765,132 @@ void Storage::Link::setLogLevel(LogLevel level)
 }
 
 
+bool Storage::Link::isPipelined() const
+{
+	if(isNull())
+		return false;
+
+	return it_->second.isPipelined;
+}
+
+
+void Storage::Link::setPipelined(bool enabled)
+{
+	if(!isNull() && enabled != it_->second.isPipelined) {
+		it_->second.isPipelined = enabled;
+		storage_->isChanged_ = true;
+	}
+}
+
+
+int Storage::Link::spinLimit() const
+{
+	if(isNull())
+		return 0;
+
+	return it_->second.spinLimit;
+}
+
+
+void Storage::Link::setSpinLimit(int usecs)
+{
+	if(!isNull() && usecs != it_->second.spinLimit) {
+		it_->second.spinLimit = usecs;
+		storage_->isChanged_ = true;
+	}
+}
+
+
+bool Storage::Link::hasPriorityInheritance() const
+{
+	if(isNull())
+		return false;
+
+	return it_->second.hasPriorityInheritance;
+}
+
+
+void Storage::Link::setPriorityInheritance(bool enabled)
+{
+	if(!isNull() && enabled != it_->second.hasPriorityInheritance) {
+		it_->second.hasPriorityInheritance = enabled;
+		storage_->isChanged_ = true;
+	}
+}
+
+
+bool Storage::Link::hasHugePages() const
+{
+	if(isNull())
+		return false;
+
+	return it_->second.hasHugePages;
+}
+
+
+void Storage::Link::setHugePages(bool enabled)
+{
+	if(!isNull() && enabled != it_->second.hasHugePages) {
+		it_->second.hasHugePages = enabled;
+		storage_->isChanged_ = true;
+	}
+}
+
+
+bool Storage::Link::isSampleAccurate() const
+{
+	if(isNull())
+		return false;
+
+	return it_->second.isSampleAccurate;
+}
+
+
+void Storage::Link::setSampleAccurate(bool enabled)
+{
+	if(!isNull() && enabled != it_->second.isSampleAccurate) {
+		it_->second.isSampleAccurate = enabled;
+		storage_->isChanged_ = true;
+	}
+}
+
+
+int Storage::Link::realtimePriority() const
+{
+	if(isNull())
+		return kInheritPriority;
+
+	return it_->second.realtimePriority;
+}
+
+
+void Storage::Link::setRealtimePriority(int priority)
+{
+	if(!isNull() && priority != it_->second.realtimePriority) {
+		it_->second.realtimePriority = priority;
+		storage_->isChanged_ = true;
+	}
+}
+
+
+std::string Storage::Link::cpuAffinity() const
+{
+	if(isNull())
+		return std::string();
+
+	return it_->second.cpuAffinity;
+}
+
+
+void Storage::Link::setCpuAffinity(const std::string& cpus)
+{
+	if(!isNull() && cpus != it_->second.cpuAffinity) {
+		it_->second.cpuAffinity = cpus;
+		storage_->isChanged_ = true;
+	}
+}
+
+
 Storage::Link Storage::Link::next() const
 {
 	if(storage_ && it_ != storage_->linkByPath_.end()) {
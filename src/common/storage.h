@@ -66,6 +66,13 @@ public:
 		std::string prefix;
 		std::string loader;
 		LogLevel level;
+		bool isPipelined;
+		int spinLimit;
+		bool hasPriorityInheritance;
+		bool hasHugePages;
+		bool isSampleAccurate;
+		int realtimePriority;
+		std::string cpuAffinity;
 	};
 
 	class Link {
@@ -88,6 +95,32 @@ public:
 		LogLevel logLevel() const;
 		void setLogLevel(LogLevel level);
 
+		bool isPipelined() const;
+		void setPipelined(bool enabled);
+
+		int spinLimit() const;
+		void setSpinLimit(int usecs);
+
+		bool hasPriorityInheritance() const;
+		void setPriorityInheritance(bool enabled);
+
+		bool hasHugePages() const;
+		void setHugePages(bool enabled);
+
+		bool isSampleAccurate() const;
+		void setSampleAccurate(bool enabled);
+
+		// The kInheritPriority means the priority of the VST host audio thread, zero
+		// disables the realtime scheduling.
+		static const int kInheritPriority = -1;
+
+		int realtimePriority() const;
+		void setRealtimePriority(int priority);
+
+		// List of CPUs in the "0-3,6" format, the empty list means all CPUs.
+		std::string cpuAffinity() const;
+		void setCpuAffinity(const std::string& cpus);
+
 		Link next() const;
 		bool operator!() const;
 
@@ -101,6 +134,10 @@ public:
 		Link(Storage* storage, LinkMap::iterator it);
 	};
 
+	// Limits of the log socket receive buffer size (in kilobytes).
+	static const int kMinLogBufferSize = 64;
+	static const int kMaxLogBufferSize = 65536;
+
 	Storage();
 	~Storage();
 
@@ -110,6 +147,9 @@ public:
 	std::string logSocketPath() const;
 	void setLogSocketPath(const std::string& path);
 
+	int logBufferSize() const;
+	void setLogBufferSize(int size);
+
 	std::string binariesPath() const;
 	void setBinariesPath(const std::string& path);
 
@@ -140,6 +180,7 @@ private:
 
 	std::string storageFilePath_;
 	std::string logSocketPath_;
+	int logBufferSize_;
 	std::string binariesPath_;
 	LogLevel defaultLogLevel_;
 
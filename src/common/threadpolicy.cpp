@@ -0,0 +1,123 @@
+#include "threadpolicy.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include "common/logger.h"
+
+
+namespace Airwave {
+
+
+static const int kMaxCpuCount = 64;
+
+
+int threadPriority()
+{
+	int policy;
+	sched_param param;
+
+	if(pthread_getschedparam(pthread_self(), &policy, &param) != 0)
+		return 0;
+
+	if(policy != SCHED_FIFO && policy != SCHED_RR)
+		return 0;
+
+	return param.sched_priority;
+}
+
+
+bool setThreadPriority(int priority)
+{
+	sched_param param;
+	std::memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+
+	int policy = priority > 0 ? SCHED_FIFO : SCHED_OTHER;
+	int result = pthread_setschedparam(pthread_self(), policy, &param);
+
+	if(result == EPERM) {
+		rlimit limit;
+		getrlimit(RLIMIT_RTPRIO, &limit);
+
+		ERROR("Realtime priority %d is not allowed, RLIMIT_RTPRIO is %d (check the "
+				"rtprio limit in /etc/security/limits.conf)", priority,
+				static_cast<int>(limit.rlim_cur));
+		return false;
+	}
+	else if(result != 0) {
+		ERROR("Unable to set realtime priority %d: %s", priority, strerror(result));
+		return false;
+	}
+
+	return true;
+}
+
+
+bool setThreadAffinity(u64 mask)
+{
+	if(!mask)
+		return true;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	for(int i = 0; i < kMaxCpuCount; ++i) {
+		if(mask & (1ULL << i))
+			CPU_SET(i, &set);
+	}
+
+	int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if(result != 0) {
+		ERROR("Unable to set CPU affinity 0x%llx: %s", static_cast<ulonglong>(mask),
+				strerror(result));
+		return false;
+	}
+
+	return true;
+}
+
+
+bool parseCpuList(const std::string& list, u64* mask)
+{
+	*mask = 0;
+
+	const char* pos = list.c_str();
+	while(*pos) {
+		char* end;
+		long first = std::strtol(pos, &end, 10);
+		if(end == pos)
+			return false;
+
+		long last = first;
+		if(*end == '-') {
+			pos = end + 1;
+			last = std::strtol(pos, &end, 10);
+			if(end == pos)
+				return false;
+		}
+
+		if(first < 0 || last < first || last >= kMaxCpuCount)
+			return false;
+
+		for(long i = first; i <= last; ++i)
+			*mask |= 1ULL << i;
+
+		if(*end == ',') {
+			end++;
+		}
+		else if(*end) {
+			return false;
+		}
+
+		pos = end;
+	}
+
+	return true;
+}
+
+
+} // namespace Airwave
@@ -0,0 +1,31 @@
+#ifndef COMMON_THREADPOLICY_H
+#define COMMON_THREADPOLICY_H
+
+#include <string>
+#include "common/types.h"
+
+
+namespace Airwave {
+
+
+// Realtime priority of the calling thread, zero if the thread isn't scheduled with the
+// SCHED_FIFO or SCHED_RR policy.
+int threadPriority();
+
+// Switches the calling thread to the SCHED_FIFO policy with the given priority, or back
+// to the SCHED_OTHER policy if the priority is zero. The failure is logged along with
+// the RLIMIT_RTPRIO limit, which is the usual cause.
+bool setThreadPriority(int priority);
+
+// Binds the calling thread to the CPUs set in the mask. The zero mask leaves the
+// affinity unchanged.
+bool setThreadAffinity(u64 mask);
+
+// Parses the CPU list in the "0-3,6" format. Only the first 64 CPUs can be listed.
+bool parseCpuList(const std::string& list, u64* mask);
+
+
+} // namespace Airwave
+
+
+#endif // COMMON_THREADPOLICY_H
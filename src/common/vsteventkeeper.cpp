@@ -9,7 +9,8 @@ namespace Airwave {
 
 VstEventKeeper::VstEventKeeper() :
 	events_(nullptr),
-	data_(nullptr)
+	data_(nullptr),
+	capacity_(0)
 {
 }
 
@@ -22,7 +23,9 @@ VstEventKeeper::~VstEventKeeper()
 
 void VstEventKeeper::reload(int count, const VstEvent events[])
 {
-	if(!events_ || events_->numEvents < count) {
+	// The buffer is reused, so there are no memory allocations in the audio thread once
+	// the buffer is large enough.
+	if(!events_ || capacity_ < count) {
 		delete [] events_;
 
 		int extraCount = std::max(count - 2, 0);
@@ -35,6 +38,7 @@ void VstEventKeeper::reload(int count, const VstEvent events[])
 
 		size_t offset = sizeof(VstEvents) + extraCount * sizeof(VstEvent*);
 		data_ = reinterpret_cast<VstEvent*>(buffer + offset);
+		capacity_ = count;
 	}
 
 	events_->numEvents = count;
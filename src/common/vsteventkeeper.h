@@ -18,6 +18,7 @@ public:
 private:
 	VstEvents* events_;
 	VstEvent* data_;
+	int capacity_;
 };
 
 
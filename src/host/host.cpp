@@ -1,14 +1,20 @@
 #include "host.h"
 
 #include <cstring>
+#include "common/hash.h"
 #include "common/logger.h"
 #include "common/protocol.h"
+#include "common/threadpolicy.h"
 
 
 namespace Airwave {
 
 
-Host* Host::self_ = nullptr;
+std::atomic<int> Host::instanceCount_(0);
+std::atomic<Host*> Host::soleInstance_(nullptr);
+
+// The instance, which is calling the VST plugin main function in the current thread.
+static thread_local Host* initializingHost = nullptr;
 
 
 Host::Host() :
@@ -16,12 +22,27 @@ Host::Host() :
 	hwnd_(0),
 	data_(nullptr),
 	dataLength_(0),
+	hasBlockTimeInfo_(false),
+	processThreadId_(0),
+	audioThreadId_(0),
+	nextParameter_(0),
+	isQueueBusy_(ATOMIC_FLAG_INIT),
+	isSampleAccurate_(false),
+	scratchStride_(0),
+	slotCount_(0),
+	slotSize_(0),
+	nextSlot_(0),
 	runAudio_(ATOMIC_FLAG_INIT),
+	audioPriority_(0),
+	cpuAffinity_(0),
 	isEditorOpen_(false),
 	oldWndProc_(nullptr),
 	childHwnd_(0)
 {
 	DEBUG("Main thread id: %p", GetCurrentThreadId());
+
+	// Avoid memory allocations in the audio thread.
+	changes_.reserve(kMaxParameterChanges);
 }
 
 
@@ -37,11 +58,15 @@ Host::~Host()
 
 		DeleteCriticalSection(&cs_);
 		FreeLibrary(module_);
+
+		Host* self = this;
+		soleInstance_.compare_exchange_strong(self, nullptr);
+		instanceCount_--;
 	}
 }
 
 
-bool Host::initialize(const char* fileName, int portId)
+bool Host::initialize(const char* fileName, int portId, pid_t portOwner)
 {
 	if(isInitialized_) {
 		TRACE("Host endpoint is already initialized");
@@ -74,7 +99,7 @@ bool Host::initialize(const char* fileName, int portId)
 		}
 	}
 
-	if(!controlPort_.connect(portId)) {
+	if(!controlPort_.connect(portId, portOwner)) {
 		ERROR("Unable to connect control port (id = %d)", portId);
 		DeleteCriticalSection(&cs_);
 		FreeLibrary(module_);
@@ -94,7 +119,7 @@ bool Host::initialize(const char* fileName, int portId)
 	TRACE("Request from plugin endpoint received, sending response");
 
 	DataFrame* frame = controlPort_.frame<DataFrame>();
-	if(!callbackPort_.connect(frame->opcode)) {
+	if(!callbackPort_.connect(frame->opcode, frame->index)) {
 		ERROR("Unable to connect callback port (id = %d)", frame->opcode);
 		controlPort_.disconnect();
 		DeleteCriticalSection(&cs_);
@@ -104,15 +129,14 @@ bool Host::initialize(const char* fileName, int portId)
 
 	// When we call vstMainProc(), the audioMasterProc() can be called from there with
 	// effect argument set to the nullptr. This is because VST plugin object is not yet
-	// initialized at this point. Since we need the pointer to our object inside of
-	// audioMasterProc(), we must store it in some accessible place. Static member
-	// pointer is very ugly, but very effective solution, since we don't need more than
-	// one instance of host endpoint anyway.
-	self_ = this;
-
+	// initialized at this point. Such callbacks are routed to the instance, which is
+	// initializing in the calling thread.
 	TRACE("Initializing VST plugin...");
 
+	initializingHost = this;
 	effect_ = vstMainProc(audioMasterProc);
+	initializingHost = nullptr;
+
 	if(!effect_ || effect_->magic != kEffectMagic) {
 		ERROR("Unable to initialize VST plugin");
 		controlPort_.disconnect();
@@ -124,7 +148,19 @@ bool Host::initialize(const char* fileName, int portId)
 
 	TRACE("VST plugin is initialized");
 
+	// The resvd1 field is reserved for the VST host, the server mode can host many
+	// effects in one process, so the callbacks are routed by it.
+	effect_->resvd1 = reinterpret_cast<intptr_t>(this);
+
+	if(instanceCount_++ == 0) {
+		soleInstance_ = this;
+	}
+	else {
+		soleInstance_ = nullptr;
+	}
+
 	std::memset(&timeInfo_, 0, sizeof(VstTimeInfo));
+	std::memset(&realtimeTimeInfo_, 0, sizeof(VstTimeInfo));
 
 	frame->command = Command::PluginInfo;
 	PluginInfo* info = reinterpret_cast<PluginInfo*>(frame->data);
@@ -178,6 +214,26 @@ bool Host::processRequest()
 		handleSetDataBlock(frame);
 		break;
 
+	case Command::ParameterMirror:
+		handleParameterMirror(frame);
+		break;
+
+	case Command::ParameterQueue:
+		handleParameterQueue(frame);
+		break;
+
+	case Command::AutomationQueue:
+		handleAutomationQueue(frame);
+		break;
+
+	case Command::RealtimePort:
+		handleRealtimePort(frame);
+		break;
+
+	case Command::ChunkPort:
+		handleChunkPort(frame);
+		break;
+
 	case Command::ShowWindow: {
 		if(hwnd_) {
 			ShowWindow(hwnd_, SW_SHOW);
@@ -187,6 +243,7 @@ bool Host::processRequest()
 
 	default:
 		ERROR("processRequest() unacceptable command: %d", frame->command);
+		frame->value = 0;
 		break;
 	}
 
@@ -227,6 +284,9 @@ void Host::destroyEditorWindow()
 	if(hwnd_) {
 		KillTimer(hwnd_, timerId_);
 		DestroyWindow(hwnd_);
+		childHwnd_ = 0;
+
+		// Fails while the other instances have their windows open.
 		UnregisterClass(kWindowClass, GetModuleHandle(nullptr));
 		hwnd_ = 0;
 	}
@@ -235,14 +295,47 @@ void Host::destroyEditorWindow()
 
 void Host::audioThread()
 {
+	// The service lock should be held before the plugin endpoint can send a request.
+	audioPort_.acquireService();
+
 	condition_.post();
 
 	while(runAudio_.test_and_set()) {
 		if(audioPort_.waitRequest(100)) {
+			// In pipelined mode process requests are placed into the dedicated slots.
+			// The plugin endpoint issues synchronous requests only when there are no
+			// process requests in flight, so if the next process slot doesn't contain
+			// a request, this one is placed into the first slot.
+			if(slotCount_) {
+				DataFrame* slot = processSlot(nextSlot_);
+
+				if(slot->command == Command::ProcessSingle ||
+						slot->command == Command::ProcessDouble) {
+					updatePriority(slot);
+
+					if(slot->command == Command::ProcessSingle) {
+						handleProcessSingle(slot);
+					}
+					else {
+						handleProcessDouble(slot);
+					}
+
+					nextSlot_ = (nextSlot_ + 1) % slotCount_;
+					slot->command = Command::Response;
+					audioPort_.sendResponse();
+					continue;
+				}
+			}
+
 			DataFrame* frame = audioPort_.frame<DataFrame>();
 
+			if(frame->command == Command::ProcessSingle ||
+					frame->command == Command::ProcessDouble) {
+				updatePriority(frame);
+			}
+
 			if(frame->command == Command::ProcessSingle) {
-				handleProcessSingle();
+				handleProcessSingle(frame);
 			}
 			else if(frame->command == Command::GetParameter) {
 				handleGetParameter();
@@ -251,18 +344,58 @@ void Host::audioThread()
 				handleSetParameter();
 			}
 			else if(frame->command == Command::ProcessDouble) {
-				handleProcessDouble();
+				handleProcessDouble(frame);
 			}
 			else if(frame->command == Command::Dispatch) {
 				handleDispatch(frame);
 			}
+			else if(frame->command == Command::GetDataBlock) {
+				handleGetDataBlock(frame);
+			}
+			else if(frame->command == Command::SetDataBlock) {
+				handleSetDataBlock(frame);
+			}
+			else if(frame->command == Command::ChunkPort) {
+				handleChunkPort(frame);
+			}
 			else {
 				ERROR("audioThread() unacceptable command: %d", frame->command);
+				frame->value = 0;
 			}
 
 			frame->command = Command::Response;
 			audioPort_.sendResponse();
 		}
+		else {
+			// The VST host doesn't process audio at the moment, but the parameter
+			// changes still should be delivered, and the mirror kept up to date.
+			applyParameterChanges();
+			refreshNextParameters();
+		}
+	}
+
+	audioPort_.releaseService();
+}
+
+
+DataFrame* Host::processSlot(i32 index)
+{
+	u8* buffer = static_cast<u8*>(audioPort_.frameBuffer());
+	return reinterpret_cast<DataFrame*>(buffer + (index + 1) * slotSize_);
+}
+
+
+void Host::updatePriority(DataFrame* frame)
+{
+	// The priority is changed rarely, so the system call is made only when it does. The
+	// failure is logged once, the request isn't repeated for the same priority.
+	AudioLayout* layout = reinterpret_cast<AudioLayout*>(frame->data);
+
+	if(layout->priority != audioPriority_) {
+		audioPriority_ = layout->priority;
+
+		if(setThreadPriority(audioPriority_))
+			DEBUG("Audio thread realtime priority is set to %d", audioPriority_);
 	}
 }
 
@@ -284,6 +417,42 @@ void Host::handleSetDataBlock(DataFrame* frame)
 }
 
 
+void Host::handleChunkPort(DataFrame* frame)
+{
+	bool isReceiving = frame->value;
+
+	chunkPort_.disconnect();
+	if(!chunkPort_.connect(frame->opcode, frame->index)) {
+		frame->value = 0;
+		return;
+	}
+
+	// The rest of the effGetChunk data goes to the end of the port, the beginning of the
+	// chunk was sent along with the effGetChunk response. Otherwise the port is held
+	// until the effSetChunk request.
+	if(isReceiving) {
+		if(dataLength_ > chunkPort_.frameSize()) {
+			ERROR("Chunk port is too small (%d < %d)", chunkPort_.frameSize(),
+					dataLength_);
+			chunkPort_.disconnect();
+			frame->value = 0;
+			return;
+		}
+
+		u8* dest = chunkPort_.frame<u8>() + chunkPort_.frameSize() - dataLength_;
+		std::memcpy(dest, data_, dataLength_);
+
+		DEBUG("handleChunkPort: %d bytes", dataLength_);
+
+		data_ += dataLength_;
+		dataLength_ = 0;
+		chunkPort_.disconnect();
+	}
+
+	frame->value = 1;
+}
+
+
 bool Host::handleDispatch(DataFrame* frame)
 {
 	FLOOD("handleDispatch: %s", kDispatchEvents[frame->opcode]);
@@ -340,18 +509,46 @@ bool Host::handleDispatch(DataFrame* frame)
 		isEditorOpen_ = false;
 		break;
 
-	case effSetBlockSize:
+	case effSetBlockSize: {
 		if(runAudio_.test_and_set()) {
 			runAudio_.clear();
 			WaitForSingleObject(audioThread_, INFINITE);
 		}
 
+		AudioPortInfo* info = reinterpret_cast<AudioPortInfo*>(frame->data);
+
 		audioPort_.disconnect();
-		if(!audioPort_.connect(frame->index)) {
+		if(!audioPort_.connect(frame->index, info->owner)) {
 			ERROR("Unable to connect audio port");
 			return false;
 		}
 
+		slotCount_ = info->slotCount;
+		slotSize_  = info->slotSize;
+		nextSlot_  = 0;
+
+		if(slotCount_)
+			DEBUG("Pipelined processing enabled (%d slots)", slotCount_);
+
+		isSampleAccurate_ = info->sampleAccurate;
+		scratch_.clear();
+		scratchStride_ = 0;
+
+		if(isSampleAccurate_) {
+			DEBUG("Sample accurate automation enabled");
+
+			scratchStride_ = alignAudio(sizeof(double) * frame->value);
+			scratch_.resize(scratchStride_ * (effect_->numInputs + effect_->numOutputs) +
+					kAudioAlignment);
+		}
+
+		cpuAffinity_ = info->cpuAffinity;
+		audioPort_.spinPolicy()->setLimit(info->spinLimit);
+		audioPort_.setPriorityInheritance(info->priorityInheritance != 0);
+
+		if(audioPort_.hasPriorityInheritance())
+			DEBUG("Priority inheritance enabled for the audio port");
+
 		runAudio_.test_and_set();
 		audioThread_ = CreateThread(nullptr, 0, audioThreadProc, this, 0, nullptr);
 
@@ -359,7 +556,7 @@ bool Host::handleDispatch(DataFrame* frame)
 
 		frame->value = effect_->dispatcher(effect_, frame->opcode, frame->index,
 				frame->value, nullptr, frame->opt);
-		break;
+		break; }
 
 	case effEditOpen: {
 		WNDCLASSEX wclass;
@@ -375,7 +572,8 @@ bool Host::handleDispatch(DataFrame* frame)
 		wclass.hCursor       = LoadCursor(nullptr, IDC_ARROW);
 		wclass.lpszClassName = kWindowClass;
 
-		if(!RegisterClassEx(&wclass)) {
+		// The class is shared by all instances in the server mode.
+		if(!RegisterClassEx(&wclass) && GetLastError() != ERROR_CLASS_ALREADY_EXISTS) {
 			ERROR("Unable to register window class: %s", errorString().c_str());
 			return false;
 		}
@@ -389,6 +587,8 @@ bool Host::handleDispatch(DataFrame* frame)
 			return false;
 		}
 
+		SetPropA(hwnd_, kHostProperty, this);
+
 		frame->value = effect_->dispatcher(effect_, frame->opcode, frame->index,
 				frame->value, hwnd_, frame->opt);
 
@@ -455,22 +655,51 @@ bool Host::handleDispatch(DataFrame* frame)
 	case effGetChunk: {
 		size_t blockSize = frame->value;
 
+		ChunkHeader* header = reinterpret_cast<ChunkHeader*>(frame->data);
+		u64 knownHash = header->hash;
+		u64 knownSize = header->size;
+
+		// The chunk should include the queued parameter changes.
+		applyParameterChanges();
+
 		frame->value = effect_->dispatcher(effect_, frame->opcode, frame->index, 0,
 			&data_, frame->opt);
 
 		dataLength_ = frame->value;
+		frame->index = 0;
 
 		DEBUG("effGetChunk: %d", dataLength_);
 		if(dataLength_ == 0)
 			break;
 
+		header->hash = hash64(data_, dataLength_);
+		header->size = dataLength_;
+
+		// The plugin endpoint already has the same chunk.
+		if(header->hash == knownHash && header->size == knownSize) {
+			DEBUG("effGetChunk: chunk is unchanged");
+			dataLength_ = 0;
+			break;
+		}
+
+		u8* dest = frame->data + sizeof(ChunkHeader);
 		frame->index = dataLength_ < blockSize ? dataLength_ : blockSize;
-		std::copy(data_, data_ + frame->index, frame->data);
+		std::copy(data_, data_ + frame->index, dest);
 		data_ += frame->index;
 		dataLength_ -= frame->index;
 		break; }
 
 	case effSetChunk: {
+		// The entire chunk is in the chunk port, if the plugin endpoint has sent it.
+		if(!chunkPort_.isNull()) {
+			DEBUG("effSetChunk: %d bytes (chunk port)", chunkPort_.frameSize());
+			frame->value = effect_->dispatcher(effect_, frame->opcode, frame->index,
+					chunkPort_.frameSize(), chunkPort_.frameBuffer(), frame->opt);
+
+			chunkPort_.disconnect();
+			break;
+		}
+
 		DEBUG("effSetChunk: %d bytes", chunk_.size());
 		frame->value = effect_->dispatcher(effect_, frame->opcode, frame->index,
 				chunk_.size(), chunk_.data(), frame->opt);
@@ -493,10 +722,49 @@ bool Host::handleDispatch(DataFrame* frame)
 		ERROR("Unhandled dispatch event: %s", kDispatchEvents[frame->opcode]);
 	}
 
+	// All of the parameters could be changed at once.
+	if(frame->opcode == effSetProgram || frame->opcode == effSetChunk)
+		refreshParameters(0, parameters_.count());
+
 	return true;
 }
 
 
+void Host::handleParameterMirror(DataFrame* frame)
+{
+	parameters_.disconnect();
+	frame->value = parameters_.connect(frame->opcode, frame->index);
+
+	if(frame->value)
+		refreshParameters(0, parameters_.count());
+}
+
+
+void Host::refreshParameters(i32 first, i32 count)
+{
+	// The mirror already has the values of the queued changes, but the VST plugin still
+	// has the old ones.
+	for(i32 i = first; i < first + count; ++i) {
+		if(!parameters_.isPending(i))
+			parameters_.setValue(i, effect_->getParameter(effect_, i));
+	}
+}
+
+
+void Host::refreshNextParameters()
+{
+	i32 count = parameters_.count();
+	if(count > 0) {
+		i32 size = std::min(count - nextParameter_, kParameterRefreshCount);
+		refreshParameters(nextParameter_, size);
+
+		nextParameter_ += size;
+		if(nextParameter_ >= count)
+			nextParameter_ = 0;
+	}
+}
+
+
 void Host::handleGetParameter()
 {
 //	DataFrame* frame = controlPort_.frame<DataFrame>();
@@ -509,54 +777,331 @@ void Host::handleSetParameter()
 {
 //	DataFrame* frame = controlPort_.frame<DataFrame>();
 	DataFrame* frame = audioPort_.frame<DataFrame>();
+
+	// The queued changes were made before this one.
+	applyParameterChanges();
 	effect_->setParameter(effect_, frame->index, frame->opt);
+
+	// The VST plugin could adjust the value, so ask it back.
+	parameters_.setValue(frame->index, effect_->getParameter(effect_, frame->index));
 }
 
 
-void Host::handleProcessSingle()
+void Host::beginProcessing(DataFrame* frame)
 {
-	DataFrame* frame = audioPort_.frame<DataFrame>();
+	AudioLayout* layout = reinterpret_cast<AudioLayout*>(frame->data);
 
-	float* inputs[effect_->numInputs];
-	float* outputs[effect_->numOutputs];
-	i32 sampleCount = frame->value;
-	float* data = reinterpret_cast<float*>(frame->data);
+	hasBlockTimeInfo_ = layout->timeInfoOffset != 0;
+	if(hasBlockTimeInfo_) {
+		u8* data = reinterpret_cast<u8*>(frame) + layout->timeInfoOffset;
+		std::memcpy(&blockTimeInfo_, data, sizeof(VstTimeInfo));
+	}
 
-	for(int i = 0; i < effect_->numInputs; ++i)
-		inputs[i] = data + i * sampleCount;
+	processThreadId_ = GetCurrentThreadId();
 
-	for(int i = 0; i < effect_->numOutputs; ++i)
-		outputs[i] = data + i * sampleCount;
+	// In sample accurate mode the events are sent along with each sub-block.
+	if(!isSampleAccurate_ && layout->eventCount > 0) {
+		u8* data = reinterpret_cast<u8*>(frame) + layout->eventOffset;
+		sendEvents(reinterpret_cast<VstEvent*>(data), layout->eventCount, 0);
+	}
+}
 
-	effect_->processReplacing(effect_, inputs, outputs, sampleCount);
+
+void Host::sendEvents(VstEvent* events, i32 count, i32 offset)
+{
+	// The events are stored in the audio port frame, so they can be rebased in place.
+	for(i32 i = 0; offset && i < count; ++i)
+		events[i].deltaFrames -= offset;
+
+	events_.reload(count, events);
+	effect_->dispatcher(effect_, effProcessEvents, 0, 0, events_.events(), 0.0f);
 }
 
 
-void Host::handleProcessDouble()
+u8* Host::scratchChannel(i32 index)
 {
-	DataFrame* frame = audioPort_.frame<DataFrame>();
+	uintptr_t address = reinterpret_cast<uintptr_t>(scratch_.data());
+	address = (address + kAudioAlignment - 1) & ~(kAudioAlignment - 1);
+	return reinterpret_cast<u8*>(address) + index * scratchStride_;
+}
+
+
+void Host::endProcessing()
+{
+	processThreadId_ = 0;
+
+	// Parameters could be changed during processing without any notification, e.g. by
+	// the VST plugin's internal modulation. Refresh a part of them after each block.
+	refreshNextParameters();
+}
+
+
+void Host::handleProcessSingle(DataFrame* frame)
+{
+	handleProcess<float>(frame, effect_->processReplacing);
+}
+
 
-	double* inputs[effect_->numInputs];
-	double* outputs[effect_->numOutputs];
+void Host::handleProcessDouble(DataFrame* frame)
+{
+	handleProcess<double>(frame, effect_->processDoubleReplacing);
+}
+
+
+template<typename T, typename ProcessProc>
+void Host::handleProcess(DataFrame* frame, ProcessProc process)
+{
+	beginProcessing(frame);
+
+	T* inputs[effect_->numInputs];
+	T* outputs[effect_->numOutputs];
 	i32 sampleCount = frame->value;
-	double* data = reinterpret_cast<double*>(frame->data);
+	AudioLayout* layout = reinterpret_cast<AudioLayout*>(frame->data);
+	u8* data = reinterpret_cast<u8*>(frame);
+
+	for(int i = 0; i < effect_->numInputs; ++i) {
+		inputs[i] = reinterpret_cast<T*>(data + layout->inputOffset +
+				i * layout->channelStride);
+	}
+
+	for(int i = 0; i < effect_->numOutputs; ++i) {
+		outputs[i] = reinterpret_cast<T*>(data + layout->outputOffset +
+				i * layout->channelStride);
+	}
+
+	if(!isSampleAccurate_) {
+		applyParameterChanges(false);
+		process(effect_, inputs, outputs, sampleCount);
+		endProcessing();
+		return;
+	}
+
+	// Split the block at the offsets of the parameter changes, so each change takes
+	// effect exactly at its sample position.
+	bool isQueueLocked = collectParameterChanges(sampleCount);
+
+	// Each sub-block gets the events, which belong to it. They are ordered by the
+	// position, the insertion sort is stable and doesn't allocate memory.
+	VstEvent* events = reinterpret_cast<VstEvent*>(data + layout->eventOffset);
+	i32 eventCount = layout->eventCount;
+
+	for(i32 i = 0; i < eventCount; ++i) {
+		VstEvent& event = events[i];
+		event.deltaFrames = std::max(0, std::min(event.deltaFrames, sampleCount - 1));
 
-	for(int i = 0; i < effect_->numInputs; ++i)
-		inputs[i] = data + i * sampleCount;
+		for(i32 j = i; j > 0 && events[j - 1].deltaFrames > events[j].deltaFrames; --j)
+			std::swap(events[j - 1], events[j]);
+	}
+
+	size_t index = 0;
+	i32 eventIndex = 0;
+	i32 position = 0;
+
+	while(position < sampleCount) {
+		while(index < changes_.size() && changes_[index].offset <= position)
+			applyParameterChange(changes_[index++]);
+
+		i32 end = index < changes_.size() ? changes_[index].offset : sampleCount;
+
+		i32 firstEvent = eventIndex;
+		while(eventIndex < eventCount && events[eventIndex].deltaFrames < end)
+			eventIndex++;
+
+		if(eventIndex > firstEvent)
+			sendEvents(events + firstEvent, eventIndex - firstEvent, position);
+
+		processPart(process, inputs, outputs, position, end - position);
+		position = end;
+	}
+
+	while(index < changes_.size())
+		applyParameterChange(changes_[index++]);
+
+	if(isQueueLocked)
+		unlockParameterQueue();
+
+	endProcessing();
+}
+
+
+template<typename T, typename ProcessProc>
+void Host::processPart(ProcessProc process, T** inputs, T** outputs, i32 offset,
+		i32 count)
+{
+	T* partInputs[effect_->numInputs];
+	T* partOutputs[effect_->numOutputs];
+
+	i32 channelCount = effect_->numInputs + effect_->numOutputs;
+	size_t stride = alignAudio(sizeof(T) * count);
+
+	// The channels of the audio port are aligned, so are the sub-blocks starting at the
+	// multiples of the alignment.
+	bool isAligned = (sizeof(T) * offset) % kAudioAlignment == 0;
+	bool hasScratch = stride <= scratchStride_ &&
+			scratch_.size() >= scratchStride_ * channelCount + kAudioAlignment;
+
+	if(isAligned || !hasScratch) {
+		for(int i = 0; i < effect_->numInputs; ++i)
+			partInputs[i] = inputs[i] + offset;
+
+		for(int i = 0; i < effect_->numOutputs; ++i)
+			partOutputs[i] = outputs[i] + offset;
+
+		process(effect_, partInputs, partOutputs, count);
+		return;
+	}
+
+	for(int i = 0; i < effect_->numInputs; ++i) {
+		partInputs[i] = reinterpret_cast<T*>(scratchChannel(i));
+		std::memcpy(partInputs[i], inputs[i] + offset, sizeof(T) * count);
+	}
 
 	for(int i = 0; i < effect_->numOutputs; ++i)
-		outputs[i] = data + i * sampleCount;
+		partOutputs[i] = reinterpret_cast<T*>(scratchChannel(effect_->numInputs + i));
+
+	process(effect_, partInputs, partOutputs, count);
+
+	for(int i = 0; i < effect_->numOutputs; ++i)
+		std::memcpy(outputs[i] + offset, partOutputs[i], sizeof(T) * count);
+}
+
+
+void Host::handleParameterQueue(DataFrame* frame)
+{
+	parameterQueue_.disconnect();
+	frame->value = parameterQueue_.connect(frame->opcode, frame->index);
+}
+
+
+void Host::applyParameterChange(const ParameterChange& change)
+{
+	if(change.index < 0 || change.index >= effect_->numParams)
+		return;
+
+	effect_->setParameter(effect_, change.index, change.value);
+
+	// The VST plugin could adjust the value. The later changes of the same parameter
+	// are in the mirror already, so it's updated only by the last one.
+	if(parameters_.removePending(change.index))
+		parameters_.setValue(change.index, effect_->getParameter(effect_, change.index));
+}
+
+
+void Host::applyParameterChanges(bool wait)
+{
+	if(!lockParameterQueue(wait))
+		return;
+
+	ParameterChange change;
+	while(parameterQueue_.pop(&change))
+		applyParameterChange(change);
+
+	unlockParameterQueue();
+}
+
+
+bool Host::collectParameterChanges(i32 sampleCount)
+{
+	changes_.clear();
+
+	// The queue stays locked until the collected changes are applied.
+	if(!lockParameterQueue(false))
+		return false;
+
+	ParameterChange change;
+	while(changes_.size() < changes_.capacity() && parameterQueue_.pop(&change)) {
+		change.offset = std::max(0, std::min(change.offset, sampleCount - 1));
+
+		// Keep the changes ordered by offset. The insertion sort is stable and doesn't
+		// allocate memory, and there are only a few changes per block usually.
+		changes_.push_back(change);
+		for(size_t i = changes_.size() - 1; i > 0; --i) {
+			if(changes_[i - 1].offset <= changes_[i].offset)
+				break;
+
+			std::swap(changes_[i - 1], changes_[i]);
+		}
+	}
 
-	effect_->processDoubleReplacing(effect_, inputs, outputs, sampleCount);
+	return true;
+}
+
+
+bool Host::lockParameterQueue(bool wait)
+{
+	while(isQueueBusy_.test_and_set(std::memory_order_acquire)) {
+		if(!wait)
+			return false;
+
+		Sleep(0);
+	}
+
+	return true;
+}
+
+
+void Host::unlockParameterQueue()
+{
+	isQueueBusy_.clear(std::memory_order_release);
+}
+
+
+void Host::handleAutomationQueue(DataFrame* frame)
+{
+	automationQueue_.disconnect();
+	frame->value = automationQueue_.connect(frame->opcode, frame->index);
+}
+
+
+bool Host::queueAutomation(i32 opcode, i32 index, float opt)
+{
+	AutomationEvent event;
+	event.opcode = opcode;
+	event.index  = index;
+	event.value  = opt;
+
+	// Update the mirror first, the VST host could ask for the value right away.
+	if(opcode == audioMasterAutomate)
+		parameters_.setValue(index, opt);
+
+	if(!automationQueue_.push(event))
+		return false;
+
+	automationQueue_.notify();
+	return true;
+}
+
+
+void Host::handleRealtimePort(DataFrame* frame)
+{
+	realtimePort_.disconnect();
+	frame->value = realtimePort_.connect(frame->opcode, frame->index);
 }
 
 
-intptr_t Host::audioMaster(i32 opcode, i32 index, intptr_t value, void* ptr, float opt)
+void Host::sendCallbackRequest(DataPort* port)
+{
+	port->sendRequest();
+
+	// The general callback thread of the plugin endpoint sleeps on the automation queue
+	// doorbell, when the queue is used. The queued events are delivered before the
+	// request.
+	if(port == &callbackPort_)
+		automationQueue_.notify();
+}
+
+
+intptr_t Host::audioMaster(DataPort* port, VstTimeInfo* timeInfo, i32 opcode, i32 index,
+		intptr_t value, void* ptr, float opt)
 {
 	if(opcode != audioMasterGetTime && opcode != audioMasterIdle)
 		FLOOD("handleAudioMaster(%s)", kAudioMasterEvents[opcode]);
 
-	DataFrame* frame = callbackPort_.frame<DataFrame>();
+	// Update the mirror first, the VST host could ask for the value right away.
+	if(opcode == audioMasterAutomate)
+		parameters_.setValue(index, opt);
+
+	DataFrame* frame = port->frame<DataFrame>();
 	frame->command = Command::AudioMaster;
 	frame->opcode  = opcode;
 	frame->index   = index;
@@ -577,8 +1122,8 @@ intptr_t Host::audioMaster(i32 opcode, i32 index, intptr_t value, void* ptr, flo
 	case audioMasterGetAutomationState:
 	case audioMasterCurrentId:
 	case audioMasterGetSampleRate:
-		callbackPort_.sendRequest();
-		callbackPort_.waitResponse();
+		sendCallbackRequest(port);
+		port->waitResponse();
 		return frame->value;
 
 	case audioMasterIOChanged: {
@@ -595,15 +1140,15 @@ intptr_t Host::audioMaster(i32 opcode, i32 index, intptr_t value, void* ptr, flo
 		info->uniqueId     = effect_->uniqueID;
 		info->version      = effect_->version;
 
-		callbackPort_.sendRequest();
-		callbackPort_.waitResponse();
+		sendCallbackRequest(port);
+		port->waitResponse();
 		return frame->value; }
 
 	// FIXME Passing the audioMasterUpdateDisplay request to the plugin endpoint leads to
 	// crash (or lock in Renoise) with some plugins (u-he TripleCheese).
 	case audioMasterUpdateDisplay:
-//		callbackPort_.sendRequest();
-//		callbackPort_.waitResponse();
+//		port->sendRequest();
+//		port->waitResponse();
 		return 1;
 
 	case audioMasterIdle:
@@ -617,8 +1162,8 @@ intptr_t Host::audioMaster(i32 opcode, i32 index, intptr_t value, void* ptr, flo
 		return 1;
 
 	case audioMasterGetVendorString: {
-		callbackPort_.sendRequest();
-		callbackPort_.waitResponse();
+		sendCallbackRequest(port);
+		port->waitResponse();
 
 		if(!frame->value)
 			return 0;
@@ -631,8 +1176,8 @@ intptr_t Host::audioMaster(i32 opcode, i32 index, intptr_t value, void* ptr, flo
 		return frame->value; }
 
 	case audioMasterGetProductString: {
-		callbackPort_.sendRequest();
-		callbackPort_.waitResponse();
+		sendCallbackRequest(port);
+		port->waitResponse();
 
 		if(!frame->value)
 			return 0;
@@ -647,24 +1192,24 @@ intptr_t Host::audioMaster(i32 opcode, i32 index, intptr_t value, void* ptr, flo
 	case audioMasterCanDo: {
 		const char* source = static_cast<const char*>(ptr);
 		char* dest         = reinterpret_cast<char*>(frame->data);
-		size_t maxLength   = callbackPort_.frameSize() - sizeof(DataFrame);
+		size_t maxLength   = port->frameSize() - sizeof(DataFrame);
 
 		std::strncpy(dest, source, maxLength);
 		dest[maxLength-1] = '\0';
 
-		callbackPort_.sendRequest();
-		callbackPort_.waitResponse();
+		sendCallbackRequest(port);
+		port->waitResponse();
 		return frame->value; }
 
 	case audioMasterGetTime:
-		callbackPort_.sendRequest();
-		callbackPort_.waitResponse();
+		sendCallbackRequest(port);
+		port->waitResponse();
 
 		if(!frame->value)
 			return 0;
 
-		std::memcpy(&timeInfo_, frame->data, sizeof(VstTimeInfo));
-		return reinterpret_cast<intptr_t>(&timeInfo_);
+		std::memcpy(timeInfo, frame->data, sizeof(VstTimeInfo));
+		return reinterpret_cast<intptr_t>(timeInfo);
 
 	case audioMasterProcessEvents: {
 		VstEvents* events = static_cast<VstEvents*>(ptr);
@@ -674,8 +1219,8 @@ intptr_t Host::audioMaster(i32 opcode, i32 index, intptr_t value, void* ptr, flo
 		for(int i = 0; i < events->numEvents; ++i)
 			event[i] = *events->events[i];
 
-		callbackPort_.sendRequest();
-		callbackPort_.waitResponse();
+		sendCallbackRequest(port);
+		port->waitResponse();
 		return frame->value; }
 	}
 
@@ -684,15 +1229,58 @@ intptr_t Host::audioMaster(i32 opcode, i32 index, intptr_t value, void* ptr, flo
 }
 
 
+Host* Host::fromEffect(AEffect* effect)
+{
+	if(effect && effect->resvd1)
+		return reinterpret_cast<Host*>(effect->resvd1);
+
+	if(initializingHost)
+		return initializingHost;
+
+	return soleInstance_;
+}
+
+
 intptr_t VSTCALLBACK Host::audioMasterProc(AEffect* effect, i32 opcode, i32 index,
 		intptr_t value, void* ptr, float opt)
 {
-	UNUSED(effect);
+	Host* self = fromEffect(effect);
+	if(!self) {
+		ERROR("Unable to route audio master request: %s", kAudioMasterEvents[opcode]);
+		return 0;
+	}
+
+	// While the block is being processed, the transport state is taken from the snapshot
+	// sent along with the process request, so there is no need to call the VST host.
+	if(opcode == audioMasterGetTime && self->processThreadId_ == GetCurrentThreadId()) {
+		if(!self->hasBlockTimeInfo_)
+			return 0;
+
+		return reinterpret_cast<intptr_t>(&self->blockTimeInfo_);
+	}
+
+	// Automation notifications don't wait for the VST host. The calling thread could be
+	// the audio or GUI thread of the VST plugin, which shouldn't be stalled by a slow
+	// automation handler. The synchronous request is used when the queue is full.
+	if(opcode == audioMasterAutomate || opcode == audioMasterBeginEdit ||
+			opcode == audioMasterEndEdit) {
+		if(self->queueAutomation(opcode, index, opt))
+			return 1;
+	}
+
+	// The audio thread has its own callback channel, so its callbacks are never queued
+	// behind the callbacks of the GUI thread. There is only one audio thread, hence the
+	// channel doesn't need a lock.
+	if(self->audioThreadId_ == GetCurrentThreadId() && !self->realtimePort_.isNull()) {
+		return self->audioMaster(&self->realtimePort_, &self->realtimeTimeInfo_, opcode,
+				index, value, ptr, opt);
+	}
 
-	EnterCriticalSection(&self_->cs_);
-	intptr_t result = self_->audioMaster(opcode, index, value, ptr, opt);
+	EnterCriticalSection(&self->cs_);
+	intptr_t result = self->audioMaster(&self->callbackPort_, &self->timeInfo_, opcode,
+			index, value, ptr, opt);
 
-	LeaveCriticalSection(&self_->cs_);
+	LeaveCriticalSection(&self->cs_);
 	return result;
 }
 
@@ -702,7 +1290,21 @@ DWORD CALLBACK Host::audioThreadProc(void* param)
 	TRACE("Audio thread started");
 
 	Host* host = static_cast<Host*>(param);
+	host->audioThreadId_ = GetCurrentThreadId();
+
+	// The new audio thread is scheduled normally until the first block is received.
+	host->audioPriority_ = 0;
+	setThreadAffinity(host->cpuAffinity_);
+
 	host->audioThread();
+	host->audioThreadId_ = 0;
+
+	SpinPolicy* policy = host->audioPort_.spinPolicy();
+	if(policy->limit()) {
+		DEBUG("Audio port spin wait: %llu hits, %llu misses",
+				static_cast<ulonglong>(policy->hitCount()),
+				static_cast<ulonglong>(policy->missCount()));
+	}
 
 	TRACE("Audio thread terminated");
 	return 0;
@@ -711,7 +1313,9 @@ DWORD CALLBACK Host::audioThreadProc(void* param)
 
 LRESULT CALLBACK Host::windowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
 {
-	if(hwnd == self_->hwnd_) {
+	Host* self = static_cast<Host*>(GetPropA(hwnd, kHostProperty));
+
+	if(self && hwnd == self->hwnd_) {
 		switch(message) {
 		case WM_CLOSE:
 			DEBUG("Received WM_CLOSE event");
@@ -720,22 +1324,30 @@ LRESULT CALLBACK Host::windowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM
 
 		case WM_PARENTNOTIFY:
 			if(wParam == WM_CREATE) {
-				self_->childHwnd_ = reinterpret_cast<HWND>(lParam);
+				self->childHwnd_ = reinterpret_cast<HWND>(lParam);
+				SetPropA(self->childHwnd_, kHostProperty, self);
 
-				LONG_PTR value = SetWindowLongPtr(self_->childHwnd_, GWLP_WNDPROC,
+				LONG_PTR value = SetWindowLongPtr(self->childHwnd_, GWLP_WNDPROC,
 						reinterpret_cast<LONG_PTR>(windowProc));
 
-				self_->oldWndProc_ = reinterpret_cast<WNDPROC>(value);
+				self->oldWndProc_ = reinterpret_cast<WNDPROC>(value);
 			}
 			break;
 
 		case WM_TIMER:
-			self_->effect_->dispatcher(self_->effect_, effEditIdle, 0, 0, nullptr, 0.0f);
+			self->effect_->dispatcher(self->effect_, effEditIdle, 0, 0, nullptr, 0.0f);
+			break;
+
+		case WM_NCDESTROY:
+			RemovePropA(hwnd, kHostProperty);
 			break;
 		}
 	}
-	else if(self_->childHwnd_ && hwnd == self_->childHwnd_) {
-		return CallWindowProc(self_->oldWndProc_, hwnd, message, wParam, lParam);
+	else if(self && hwnd == self->childHwnd_) {
+		if(message == WM_NCDESTROY)
+			RemovePropA(hwnd, kHostProperty);
+
+		return CallWindowProc(self->oldWndProc_, hwnd, message, wParam, lParam);
 	}
 
 	return DefWindowProc(hwnd, message, wParam, lParam);
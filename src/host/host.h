@@ -8,6 +8,9 @@
 #include "common/config.h"
 #include "common/dataport.h"
 #include "common/event.h"
+#include "common/parametermirror.h"
+#include "common/protocol.h"
+#include "common/sharedqueue.h"
 #include "common/vst24.h"
 #include "common/vsteventkeeper.h"
 
@@ -15,15 +18,12 @@
 namespace Airwave {
 
 
-struct DataFrame;
-
-
 class Host {
 public:
 	Host();
 	~Host();
 
-	bool initialize(const char* fileName, int portId);
+	bool initialize(const char* fileName, int portId, pid_t portOwner);
 	bool processRequest();
 
 private:
@@ -38,40 +38,123 @@ private:
 
 	u8* data_;
 	size_t dataLength_;
+
+	// Transport state snapshot of the block being processed.
+	VstTimeInfo blockTimeInfo_;
+	bool hasBlockTimeInfo_;
+	std::atomic<DWORD> processThreadId_;
+	std::atomic<DWORD> audioThreadId_;
 	std::vector<u8> chunk_;
 
+	// Transient port holding the entire chunk of the effGetChunk/effSetChunk request.
+	DataPort chunkPort_;
+
 	DataPort controlPort_;
 	DataPort callbackPort_;
 	DataPort audioPort_;
 
+	// Callback channel of the audio thread.
+	DataPort realtimePort_;
+	VstTimeInfo realtimeTimeInfo_;
+
+	ParameterMirror parameters_;
+	i32 nextParameter_;
+	SharedQueue<ParameterChange> parameterQueue_;
+	std::vector<ParameterChange> changes_;
+
+	// Serializes the consumers of the parameter queue, so the changes aren't reordered.
+	// The processing never waits for it, the changes are left for the next block.
+	std::atomic_flag isQueueBusy_;
+	SharedQueue<AutomationEvent> automationQueue_;
+	bool isSampleAccurate_;
+
+	// Channels for the sub-blocks split at unaligned offsets, so the VST plugin always
+	// gets the buffers aligned to kAudioAlignment.
+	std::vector<u8> scratch_;
+	size_t scratchStride_;
+
+	i32 slotCount_;
+	size_t slotSize_;
+	i32 nextSlot_;
+
 	Event condition_;
 
 	HANDLE audioThread_;
 	std::atomic_flag runAudio_;
 
+	// Scheduling of the audio thread, the priority is requested along with each block.
+	int audioPriority_;
+	u64 cpuAffinity_;
+
 	bool isEditorOpen_;
 
 	WNDPROC oldWndProc_;
 	HWND childHwnd_;
 
-	static Host* self_;
+	// Used to route the callbacks, which can't be routed by the effect pointer, when the
+	// process serves the only instance.
+	static std::atomic<int> instanceCount_;
+	static std::atomic<Host*> soleInstance_;
+
 	static constexpr const char* kWindowClass = PROJECT_NAME;
+	static constexpr const char* kHostProperty = PROJECT_NAME ".host";
+
+	// Number of parameters refreshed in the mirror after each processed block, and after
+	// each idle wait of the audio thread.
+	static const i32 kParameterRefreshCount = 64;
+
+	// Maximum number of parameter changes applied within a single block.
+	static const size_t kMaxParameterChanges = 1024;
 
 	std::string errorString() const;
 	void destroyEditorWindow();
 
 	void audioThread();
+	DataFrame* processSlot(i32 index);
+	void updatePriority(DataFrame* frame);
 
 	void handleGetDataBlock(DataFrame* frame);
 	void handleSetDataBlock(DataFrame* frame);
+	void handleChunkPort(DataFrame* frame);
 
 	bool handleDispatch(DataFrame* frame);
+	void handleParameterMirror(DataFrame* frame);
+	void refreshParameters(i32 first, i32 count);
+	void refreshNextParameters();
+
 	void handleGetParameter();
 	void handleSetParameter();
-	void handleProcessSingle();
-	void handleProcessDouble();
+	void beginProcessing(DataFrame* frame);
+	void endProcessing();
+	void handleProcessSingle(DataFrame* frame);
+	void handleProcessDouble(DataFrame* frame);
+
+	template<typename T, typename ProcessProc>
+	void handleProcess(DataFrame* frame, ProcessProc process);
+
+	template<typename T, typename ProcessProc>
+	void processPart(ProcessProc process, T** inputs, T** outputs, i32 offset,
+			i32 count);
 
-	intptr_t audioMaster(i32 opcode, i32 index, intptr_t value, void* ptr, float opt);
+	void sendEvents(VstEvent* events, i32 count, i32 offset);
+	u8* scratchChannel(i32 index);
+
+	void handleParameterQueue(DataFrame* frame);
+	void applyParameterChange(const ParameterChange& change);
+	void applyParameterChanges(bool wait = true);
+	bool collectParameterChanges(i32 sampleCount);
+	bool lockParameterQueue(bool wait);
+	void unlockParameterQueue();
+
+	void handleAutomationQueue(DataFrame* frame);
+	bool queueAutomation(i32 opcode, i32 index, float opt);
+	void handleRealtimePort(DataFrame* frame);
+	void sendCallbackRequest(DataPort* port);
+
+	static Host* fromEffect(AEffect* effect);
+
+	intptr_t audioMaster(DataPort* port, VstTimeInfo* timeInfo, i32 opcode, i32 index,
+			intptr_t value, void* ptr, float opt);
 
 	static intptr_t VSTCALLBACK audioMasterProc(AEffect* effect, i32 opcode, i32 index,
 			intptr_t value, void* ptr, float opt);
@@ -1,44 +1,48 @@
+#include <atomic>
 #include <cstdlib>
+#include <cstring>
+#include <signal.h>
 #include "host.h"
 #include "common/config.h"
+#include "common/dataport.h"
 #include "common/filesystem.h"
 #include "common/logger.h"
+#include "common/protocol.h"
 
 
 using namespace Airwave;
 
 
-int __cdecl main(int argc, const char* argv[])
-{
-	if(argc != 5) {
-		fprintf(stderr, "Airwave host endpoint, version " VERSION_STRING);
-		fprintf(stderr, "error: wrong number of arguments: %d", argc);
-		fprintf(stderr, "usage: %s <vst path> <port id> <log level> <log socket path>",
-				argv[0]);
+// Number of instances served by the process in the server mode.
+static std::atomic<int> instanceCount(0);
 
-		loggerFree();
-		return -1;
-	}
 
-	loggerInit(argv[4], HOST_BASENAME);
-	loggerSetSenderId(FileSystem::baseName(argv[1]));
+static void initLogger(const std::string& socketPath, const std::string& senderId,
+		int logLevel)
+{
+	loggerInit(socketPath, HOST_BASENAME);
+	loggerSetSenderId(senderId);
 
-	LogLevel level = static_cast<LogLevel>(atoi(argv[3]));
+	LogLevel level = static_cast<LogLevel>(logLevel);
 	if(level < LogLevel::kQuiet || level > LogLevel::kFlood) {
 		loggerSetLogLevel(LogLevel::kTrace);
-		ERROR("Invalid log level '%d', using log level 'trace' instead", argc);
+		ERROR("Invalid log level '%d', using log level 'trace' instead", logLevel);
 	}
 	else {
 		loggerSetLogLevel(level);
 	}
+}
+
 
+static bool runHost(const std::string& vstPath, int portId, pid_t portOwner)
+{
 	TRACE("Initializing host endpoint %s", VERSION_STRING);
 
 	Host* host = new Host;
-	if(!host->initialize(argv[1], atoi(argv[2]))) {
+	if(!host->initialize(vstPath.c_str(), portId, portOwner)) {
 		ERROR("Unable to initialize host endpoint");
-		loggerFree();
-		return -2;
+		delete host;
+		return false;
 	}
 
 	TRACE("Host endpoint is initialized");
@@ -56,6 +60,161 @@ int __cdecl main(int argc, const char* argv[])
 	delete host;
 
 	TRACE("Host endpoint terminated");
+	return true;
+}
+
+
+// Waits until the pool daemon hands over a plugin endpoint. By this time WINE is already
+// booted, so the claim is served almost immediately. Returns false if the pool daemon
+// has terminated.
+static bool waitClaim(DataPort* port, pid_t portOwner, PoolClaim* claim)
+{
+	while(!port->waitRequest(1000)) {
+		// Don't outlive the pool daemon.
+		if(kill(portOwner, 0) != 0)
+			return false;
+	}
+
+	std::memcpy(claim, port->frameBuffer(), sizeof(PoolClaim));
+	port->sendResponse();
+
+	claim->vstPath[kPoolPathSize - 1] = '\0';
+	claim->logSocketPath[kPoolPathSize - 1] = '\0';
+	return true;
+}
+
+
+static DWORD CALLBACK instanceThreadProc(void* param)
+{
+	PoolClaim* claim = static_cast<PoolClaim*>(param);
+
+	runHost(claim->vstPath, claim->portId, claim->portOwner);
+
+	delete claim;
+	instanceCount--;
+	return 0;
+}
+
+
+// Serves the instances claimed through the pool port, each one in its own thread, until
+// the pool daemon retires the process (or terminates) and the last instance is closed.
+static int runServer(int portId, pid_t portOwner)
+{
+	DataPort port;
+	if(!port.connect(portId, portOwner))
+		return -3;
+
+	// Tell the daemon that we are ready to be claimed.
+	port.sendResponse();
+
+	bool isRetired = false;
+	bool isLoggerInitialized = false;
+
+	while(!isRetired || instanceCount > 0) {
+		if(isRetired) {
+			Sleep(1000);
+			continue;
+		}
+
+		// The terminated pool daemon doesn't send any more claims.
+		PoolClaim* claim = new PoolClaim;
+		if(!waitClaim(&port, portOwner, claim)) {
+			delete claim;
+			isRetired = true;
+			continue;
+		}
+
+		if(claim->portId == kPoolRetire) {
+			delete claim;
+			isRetired = true;
+			continue;
+		}
+
+		// The logger is shared by all instances.
+		if(!isLoggerInitialized) {
+			initLogger(claim->logSocketPath, "server-" + std::to_string(getpid()),
+					claim->logLevel);
+			isLoggerInitialized = true;
+		}
+
+		TRACE("Serving instance of %s", claim->vstPath);
+
+		instanceCount++;
+
+		HANDLE thread = CreateThread(nullptr, 0, instanceThreadProc, claim, 0, nullptr);
+		if(!thread) {
+			ERROR("Unable to create instance thread");
+			delete claim;
+			instanceCount--;
+			continue;
+		}
+
+		CloseHandle(thread);
+	}
+
+	port.disconnect();
+	loggerFree();
+	return 0;
+}
+
+
+int __cdecl main(int argc, const char* argv[])
+{
+	if(argc == 4 && std::strcmp(argv[1], "--server") == 0)
+		return runServer(atoi(argv[2]), atoi(argv[3]));
+
+	std::string vstPath;
+	int portId;
+	pid_t portOwner;
+	int logLevel;
+	std::string logSocketPath;
+
+	if(argc == 4 && std::strcmp(argv[1], "--pool") == 0) {
+		DataPort port;
+		if(!port.connect(atoi(argv[2]), atoi(argv[3])))
+			return -3;
+
+		// Tell the daemon that we are ready to be claimed.
+		port.sendResponse();
+
+		PoolClaim claim;
+		if(!waitClaim(&port, atoi(argv[3]), &claim))
+			return -3;
+
+		port.disconnect();
+
+		vstPath = claim.vstPath;
+		portId = claim.portId;
+		portOwner = claim.portOwner;
+		logLevel = claim.logLevel;
+		logSocketPath = claim.logSocketPath;
+	}
+	else if(argc == 6) {
+		vstPath = argv[1];
+		portId = atoi(argv[2]);
+		portOwner = atoi(argv[3]);
+		logLevel = atoi(argv[4]);
+		logSocketPath = argv[5];
+	}
+	else {
+		fprintf(stderr, "Airwave host endpoint, version " VERSION_STRING);
+		fprintf(stderr, "error: wrong number of arguments: %d", argc);
+		fprintf(stderr, "usage: %s <vst path> <port id> <port owner> <log level> "
+				"<log socket path>", argv[0]);
+		fprintf(stderr, "       %s --pool <pool port id> <pool port owner>", argv[0]);
+		fprintf(stderr, "       %s --server <pool port id> <pool port owner>", argv[0]);
+
+		loggerFree();
+		return -1;
+	}
+
+	initLogger(logSocketPath, FileSystem::baseName(vstPath), logLevel);
+
+	if(!runHost(vstPath, portId, portOwner)) {
+		loggerFree();
+		return -2;
+	}
+
 	loggerFree();
 	return 0;
 }
@@ -2,18 +2,42 @@
 
 #include <cerrno>
 #include <cstring>
+#include <poll.h>
 #include <unistd.h>
 #include <linux/un.h>
-#include <sys/ioctl.h>
-#include <sys/socket.h>
+#include <sys/eventfd.h>
 #include <QByteArray>
 
 
+// Number of the datagrams received by the single recvmmsg() call.
+static const int kBatchSize = 64;
+
+// Maximum size of the datagram sent by the logger.
+static const size_t kDatagramSize = 1024;
+
+// The buffer size used before the setBufferSize() call (in bytes).
+static const int kDefaultBufferSize = 1024 * 1024;
+
+
 LogSocket::LogSocket(QObject* parent) :
 	QObject(parent),
 	fd_(-1),
-	notifier_(nullptr)
+	stopFd_(-1),
+	reader_(nullptr),
+	bufferSize_(kDefaultBufferSize),
+	droppedCount_(0),
+	reportedCount_(0),
+	rejectedCount_(0),
+	buffers_(kBatchSize * kDatagramSize),
+	vectors_(kBatchSize),
+	headers_(kBatchSize),
+	pendingSize_(0),
+	isDeliveryQueued_(false)
 {
+	for(int i = 0; i < kBatchSize; ++i) {
+		vectors_[i].iov_base = &buffers_[i * kDatagramSize];
+		vectors_[i].iov_len = kDatagramSize;
+	}
 }
 
 
@@ -52,9 +76,17 @@ bool LogSocket::listen(const QString& id)
 		return false;
 	}
 
+	stopFd_ = eventfd(0, EFD_CLOEXEC);
+	if(stopFd_ < 0) {
+		qDebug("Unable to create event descriptor: %s", strerror(errno));
+		::close(fd_);
+		fd_ = -1;
+		unlink(id.toUtf8().constData());
+		return false;
+	}
+
 	id_ = id;
-	notifier_ = new QSocketNotifier(fd_, QSocketNotifier::Read);
-	connect(notifier_, SIGNAL(activated(int)), SLOT(handleDatagram()));
+	reader_ = new std::thread(&LogSocket::readerProc, this);
 	return true;
 }
 
@@ -62,42 +94,166 @@ bool LogSocket::listen(const QString& id)
 void LogSocket::close()
 {
 	if(fd_ != -1) {
-		delete notifier_;
+		u64 value = 1;
+		if(write(stopFd_, &value, sizeof(value)) < 0)
+			qDebug("Unable to stop the log reader: %s", strerror(errno));
+
+		reader_->join();
+		delete reader_;
+		reader_ = nullptr;
+
+		::close(stopFd_);
+		stopFd_ = -1;
+
 		::close(fd_);
+		fd_ = -1;
+
 		unlink(id_.toUtf8().constData());
 	}
 }
 
 
-void LogSocket::handleDatagram()
+int LogSocket::bufferSize() const
+{
+	return bufferSize_;
+}
+
+
+void LogSocket::setBufferSize(int size)
+{
+	bufferSize_ = size;
+}
+
+
+quint64 LogSocket::droppedCount() const
+{
+	return droppedCount_;
+}
+
+
+void LogSocket::readerProc()
+{
+	pollfd fds[2];
+	fds[0].fd = fd_;
+	fds[0].events = POLLIN;
+	fds[1].fd = stopFd_;
+	fds[1].events = POLLIN;
+
+	while(true) {
+		if(poll(fds, 2, -1) < 0) {
+			if(errno == EINTR)
+				continue;
+
+			qDebug("poll() call failed: %s", strerror(errno));
+			return;
+		}
+
+		if(fds[1].revents)
+			return;
+
+		// Drain the socket, the blocked senders refill the queue meanwhile.
+		int count;
+
+		do {
+			for(int i = 0; i < kBatchSize; ++i) {
+				std::memset(&headers_[i], 0, sizeof(mmsghdr));
+				headers_[i].msg_hdr.msg_iov = &vectors_[i];
+				headers_[i].msg_hdr.msg_iovlen = 1;
+			}
+
+			count = recvmmsg(fd_, headers_.data(), kBatchSize, MSG_DONTWAIT, nullptr);
+			if(count > 0)
+				receiveBatch(count);
+		} while(count == kBatchSize);
+
+		if(count < 0 && errno != EAGAIN && errno != EINTR)
+			qDebug("recvmmsg() call failed: %s", strerror(errno));
+	}
+}
+
+
+void LogSocket::receiveBatch(int count)
 {
-	size_t length = 0;
-	if(ioctl(fd_, FIONREAD, &length) < 0) {
-		qDebug("ioctl() call failed: %s", strerror(errno));
-		return;
+	QVector<LogMessage> messages;
+	messages.reserve(count);
+	size_t size = 0;
+
+	u64 timeStamp;
+	Airwave::LogLevel level;
+	std::string sender;
+	std::string text;
+
+	for(int i = 0; i < count; ++i) {
+		const mmsghdr& header = headers_[i];
+
+		if(header.msg_hdr.msg_flags & MSG_TRUNC) {
+			rejectedCount_++;
+			continue;
+		}
+
+		// The format datagrams don't carry any message.
+		const char* data = static_cast<const char*>(vectors_[i].iov_base);
+		if(!decoder_.decode(data, header.msg_len, &timeStamp, &level, &sender, &text))
+			continue;
+
+		LogMessage message;
+		message.time = timeStamp;
+		message.level = level;
+		message.sender = QString::fromStdString(sender);
+		message.text = QString::fromStdString(text);
+
+		messages.append(message);
+		size += header.msg_len;
 	}
 
-	char* buffer = new char[length];
+	bool isDeliveryNeeded = false;
+
+	{
+		std::lock_guard<std::mutex> lock(guard_);
+
+		// The whole batch is dropped if it doesn't fit the buffer, the GUI thread is
+		// too busy to take the messages anyway.
+		if(pendingSize_ + size > static_cast<size_t>(bufferSize_)) {
+			rejectedCount_ += messages.size();
+		}
+		else {
+			pending_ += messages;
+			pendingSize_ += size;
+		}
+
+		quint64 droppedCount = rejectedCount_ + decoder_.droppedCount();
+		bool isChanged = droppedCount != droppedCount_;
+		droppedCount_ = droppedCount;
 
-	if(recvfrom(fd_, buffer, length, 0, nullptr, nullptr) < 0) {
-		qDebug("recvfrom() call failed: %s", strerror(errno));
-		delete [] buffer;
-		return;
+		if((!pending_.isEmpty() || isChanged) && !isDeliveryQueued_) {
+			isDeliveryQueued_ = true;
+			isDeliveryNeeded = true;
+		}
 	}
 
-	quint64* timeStamp = reinterpret_cast<quint64*>(buffer);
-	const char* sender = buffer + sizeof(quint64);
+	// The deliveries are coalesced, so the batch grows while the GUI thread is busy.
+	if(isDeliveryNeeded)
+		QMetaObject::invokeMethod(this, "deliverMessages", Qt::QueuedConnection);
+}
+
+
+void LogSocket::deliverMessages()
+{
+	QVector<LogMessage> messages;
 
-	const char* message;
-	message = static_cast<const char*>(std::memchr(sender, 0x01, length));
-	if(!message) {
-		qDebug("Discarding invalid datagram.");
-		delete [] buffer;
-		return;
+	{
+		std::lock_guard<std::mutex> lock(guard_);
+		messages.swap(pending_);
+		pendingSize_ = 0;
+		isDeliveryQueued_ = false;
 	}
 
-	QString senderId;
-	senderId = QString::fromUtf8(sender, message - sender);
-	emit newMessage(*timeStamp, senderId, message + 1);
-	delete [] buffer;
+	if(!messages.isEmpty())
+		emit newMessages(messages);
+
+	quint64 droppedCount = droppedCount_;
+	if(droppedCount != reportedCount_) {
+		reportedCount_ = droppedCount;
+		emit droppedCountChanged(droppedCount);
+	}
 }
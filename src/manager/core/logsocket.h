@@ -1,10 +1,29 @@
 #ifndef CORE_LOGSOCKET_H
 #define CORE_LOGSOCKET_H
 
-#include <QSocketNotifier>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <QObject>
 #include <QString>
+#include <QVector>
+#include "common/logdecoder.h"
 
 
+struct LogMessage {
+	quint64 time;
+	Airwave::LogLevel level;
+	QString sender;
+	QString text;
+};
+
+
+// The datagrams are received by the background thread, since the kernel queues only a
+// few of them (see the net.unix.max_dgram_qlen) and the senders are blocked while the
+// manager is busy. The received messages are kept in the buffer of the limited size
+// until the GUI thread takes them as a single batch.
 class LogSocket : public QObject {
 	Q_OBJECT
 public:
@@ -15,16 +34,46 @@ public:
 	bool listen(const QString& id);
 	void close();
 
+	// The size of the buffer (in bytes), which holds the messages not yet taken by the
+	// GUI thread. The messages, which don't fit it, are dropped.
+	int bufferSize() const;
+	void setBufferSize(int size);
+
+	// Count of the messages dropped by the senders and by the manager.
+	quint64 droppedCount() const;
+
 signals:
-	void newMessage(quint64 time, const QString& sender, const QString& text);
+	void newMessages(const QVector<LogMessage>& messages);
+	void droppedCountChanged(quint64 count);
 
 private:
 	int fd_;
-	QSocketNotifier* notifier_;
+	int stopFd_;
+	std::thread* reader_;
 	QString id_;
 
+	std::atomic<int> bufferSize_;
+	std::atomic<quint64> droppedCount_;
+	quint64 reportedCount_;
+
+	// Used by the reader thread only, the buffers are reused between the batches.
+	Airwave::LogDecoder decoder_;
+	quint64 rejectedCount_;
+	std::vector<char> buffers_;
+	std::vector<iovec> vectors_;
+	std::vector<mmsghdr> headers_;
+
+	// Shared between the reader and the GUI threads.
+	std::mutex guard_;
+	QVector<LogMessage> pending_;
+	size_t pendingSize_;
+	bool isDeliveryQueued_;
+
+	void readerProc();
+	void receiveBatch(int count);
+
 private slots:
-	void handleDatagram();
+	void deliverMessages();
 };
 
 
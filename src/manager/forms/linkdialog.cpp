@@ -1,12 +1,15 @@
 #include "linkdialog.h"
 
+#include <QCheckBox>
 #include <QComboBox>
 #include <QDialogButtonBox>
 #include <QFile>
 #include <QGridLayout>
 #include <QLabel>
 #include <QMessageBox>
+#include <QRegularExpressionValidator>
 #include <QSettings>
+#include <QSpinBox>
 #include "common/config.h"
 #include "core/application.h"
 #include "forms/filedialog.h"
@@ -46,6 +49,14 @@ void LinkDialog::setItem(LinkItem* item)
 		index = static_cast<int>(item->logLevel()) + 1;
 		logLevelCombo_->setCurrentIndex(index);
 
+		pipelinedCheck_->setChecked(item->isPipelined());
+		spinLimitSpin_->setValue(item->spinLimit());
+		prioritySpin_->setValue(item->realtimePriority());
+		affinityEdit_->setText(item->cpuAffinity());
+		inheritanceCheck_->setChecked(item->hasPriorityInheritance());
+		hugePagesCheck_->setChecked(item->hasHugePages());
+		sampleAccurateCheck_->setChecked(item->isSampleAccurate());
+
 		nameEdit_->setText(item->name());
 		targetEdit_->setText(item->target());
 	}
@@ -59,6 +70,14 @@ void LinkDialog::setItem(LinkItem* item)
 
 		index = loaderCombo_->findText("default");
 		loaderCombo_->setCurrentIndex(index);
+
+		pipelinedCheck_->setChecked(false);
+		spinLimitSpin_->setValue(0);
+		prioritySpin_->setValue(Storage::Link::kInheritPriority);
+		affinityEdit_->clear();
+		inheritanceCheck_->setChecked(false);
+		hugePagesCheck_->setChecked(false);
+		sampleAccurateCheck_->setChecked(false);
 	}
 }
 
@@ -88,6 +107,46 @@ void LinkDialog::setupUi()
 	logLevelCombo_->addItem(QIcon(":/bug.png"), "debug");
 	logLevelCombo_->addItem(QIcon(":/scull.png"), "flood");
 
+	pipelinedCheck_ = new QCheckBox("Pipelined processing");
+	pipelinedCheck_->setToolTip("Render the audio block in parallel with the VST host.\n"
+			"This adds the latency of one block, which is reported to the host.");
+
+	spinLimitSpin_ = new QSpinBox;
+	spinLimitSpin_->setRange(0, 1000);
+	spinLimitSpin_->setSingleStep(10);
+	spinLimitSpin_->setSuffix(" us");
+	spinLimitSpin_->setSpecialValueText("disabled");
+	spinLimitSpin_->setToolTip("Maximum time to busy-wait for the audio thread of the "
+			"other endpoint\nbefore going to sleep. The actual spin time adapts to the "
+			"measured\nround trip times. Reduces the latency at the cost of CPU time.");
+
+	prioritySpin_ = new QSpinBox;
+	prioritySpin_->setRange(Storage::Link::kInheritPriority, 99);
+	prioritySpin_->setSpecialValueText("inherited");
+	prioritySpin_->setToolTip("SCHED_FIFO priority of the WINE audio thread and the "
+			"callback threads.\nBy default it's inherited from the VST host audio "
+			"thread, zero disables\nthe realtime scheduling. Limited by the rtprio "
+			"limit of the user.");
+
+	affinityEdit_ = new LineEdit;
+	affinityEdit_->setPlaceholderText("all");
+	affinityEdit_->setValidator(new QRegularExpressionValidator(
+			QRegularExpression("(\\d+(-\\d+)?(,\\d+(-\\d+)?)*)?"), affinityEdit_));
+	affinityEdit_->setToolTip("CPUs for the WINE audio thread and the callback threads, "
+			"e.g. \"2,3\" or \"4-7\".");
+
+	inheritanceCheck_ = new QCheckBox("Priority inheritance");
+	inheritanceCheck_->setToolTip("Lend the priority of the VST host audio thread to the "
+			"WINE audio thread\nwhile the VST host is waiting for the processed block.");
+
+	hugePagesCheck_ = new QCheckBox("Huge pages");
+	hugePagesCheck_->setToolTip("Back the audio port with huge pages to reduce the TLB "
+			"misses.\nRequires huge pages to be reserved in the system (vm.nr_hugepages).");
+
+	sampleAccurateCheck_ = new QCheckBox("Sample accurate automation");
+	sampleAccurateCheck_->setToolTip("Split the processed blocks at the positions of the parameter changes.\n"
+			"Some VST plugins might not handle the variable block size well.");
+
 	targetEdit_ = new LineEdit;
 	targetEdit_->setButtonEnabled(true);
 	targetEdit_->setButtonStyle(LineEdit::kLightAutoRaise);
@@ -134,11 +193,25 @@ void LinkDialog::setupUi()
 	mainLayout->addWidget(new QLabel("Log level:"), 5, 0, Qt::AlignRight);
 	mainLayout->addWidget(logLevelCombo_, 5, 1, 1, 1);
 
-	mainLayout->addWidget(new QWidget, 6, 0);
+	mainLayout->addWidget(new QLabel("Spin wait limit:"), 6, 0, Qt::AlignRight);
+	mainLayout->addWidget(spinLimitSpin_, 6, 1, 1, 1);
+
+	mainLayout->addWidget(new QLabel("Realtime priority:"), 7, 0, Qt::AlignRight);
+	mainLayout->addWidget(prioritySpin_, 7, 1, 1, 1);
+
+	mainLayout->addWidget(new QLabel("CPU affinity:"), 8, 0, Qt::AlignRight);
+	mainLayout->addWidget(affinityEdit_, 8, 1, 1, 1);
 
-	mainLayout->addWidget(buttons_, 7, 1, 1, 2);
+	mainLayout->addWidget(pipelinedCheck_, 9, 1, 1, 2);
+	mainLayout->addWidget(inheritanceCheck_, 10, 1, 1, 2);
+	mainLayout->addWidget(hugePagesCheck_, 11, 1, 1, 2);
+	mainLayout->addWidget(sampleAccurateCheck_, 12, 1, 1, 2);
 
-	mainLayout->setRowStretch(5, 1);
+	mainLayout->addWidget(new QWidget, 13, 0);
+
+	mainLayout->addWidget(buttons_, 14, 1, 1, 2);
+
+	mainLayout->setRowStretch(13, 1);
 
 	mainLayout->setColumnStretch(0, 0);
 	mainLayout->setColumnStretch(1, 0);
@@ -236,6 +309,11 @@ void LinkDialog::accept()
 		return;
 	}
 
+	if(!affinityEdit_->hasAcceptableInput()) {
+		QMessageBox::critical(this, "Error", "CPU affinity list is invalid.");
+		return;
+	}
+
 	QString pluginPath = getPluginPath();
 	if(pluginPath.isEmpty()) {
 		QMessageBox::critical(this, "Error", "VST plugin is corrupted.");
@@ -268,6 +346,13 @@ void LinkDialog::accept()
 
 		int value = logLevelCombo_->currentIndex() - 1;
 		item_->setLogLevel(static_cast<LogLevel>(value));
+		item_->setPipelined(pipelinedCheck_->isChecked());
+		item_->setSpinLimit(spinLimitSpin_->value());
+		item_->setRealtimePriority(prioritySpin_->value());
+		item_->setCpuAffinity(affinityEdit_->text());
+		item_->setPriorityInheritance(inheritanceCheck_->isChecked());
+		item_->setHugePages(hugePagesCheck_->isChecked());
+		item_->setSampleAccurate(sampleAccurateCheck_->isChecked());
 	}
 	else {
 		if(item_->name() != name) {
@@ -297,6 +382,13 @@ void LinkDialog::accept()
 
 		int value = logLevelCombo_->currentIndex() - 1;
 		item_->setLogLevel(static_cast<LogLevel>(value));
+		item_->setPipelined(pipelinedCheck_->isChecked());
+		item_->setSpinLimit(spinLimitSpin_->value());
+		item_->setRealtimePriority(prioritySpin_->value());
+		item_->setCpuAffinity(affinityEdit_->text());
+		item_->setPriorityInheritance(inheritanceCheck_->isChecked());
+		item_->setHugePages(hugePagesCheck_->isChecked());
+		item_->setSampleAccurate(sampleAccurateCheck_->isChecked());
 	}
 
 	qApp->storage()->save();
@@ -4,8 +4,10 @@
 #include <QDialog>
 
 
+class QCheckBox;
 class QComboBox;
 class QDialogButtonBox;
+class QSpinBox;
 class LineEdit;
 class LinkItem;
 
@@ -22,6 +24,13 @@ private:
 	QComboBox* loaderCombo_;
 	QComboBox* prefixCombo_;
 	QComboBox* logLevelCombo_;
+	QCheckBox* pipelinedCheck_;
+	QSpinBox* spinLimitSpin_;
+	QSpinBox* prioritySpin_;
+	LineEdit* affinityEdit_;
+	QCheckBox* inheritanceCheck_;
+	QCheckBox* hugePagesCheck_;
+	QCheckBox* sampleAccurateCheck_;
 	LineEdit* targetEdit_;
 	LineEdit* locationEdit_;
 	LineEdit* nameEdit_;
@@ -1,20 +1,25 @@
 #include "mainform.h"
 
 #include <QAction>
+#include <QComboBox>
 #include <QDesktopServices>
 #include <QDir>
 #include <QFileInfo>
 #include <QHBoxLayout>
 #include <QHeaderView>
+#include <QLabel>
 #include <QMessageBox>
+#include <QRegularExpression>
 #include <QSettings>
 #include <QSplitter>
+#include <QStatusBar>
 #include <QToolBar>
 #include "common/config.h"
 #include "core/application.h"
 #include "forms/linkdialog.h"
 #include "forms/settingsdialog.h"
 #include "models/linksmodel.h"
+#include "widgets/lineedit.h"
 #include "widgets/linksview.h"
 #include "widgets/logview.h"
 
@@ -29,13 +34,18 @@ MainForm::MainForm(QWidget* parent) :
 	QString logSocketPath = QString::fromStdString(qApp->storage()->logSocketPath());
 
 	LogSocket* socket = qApp->logSocket();
+	socket->setBufferSize(qApp->storage()->logBufferSize() * 1024);
 	if(!socket->listen(logSocketPath))
 		qDebug("Unable to create logger socket.");
 
 	connect(socket,
-			SIGNAL(newMessage(quint64,QString,QString)),
+			SIGNAL(newMessages(QVector<LogMessage>)),
 			logView_,
-			SLOT(addMessage(quint64,QString,QString)));
+			SLOT(addMessages(QVector<LogMessage>)));
+
+	connect(socket,
+			SIGNAL(droppedCountChanged(quint64)),
+			SLOT(showDroppedCount(quint64)));
 
 	connect(qApp->links(),
 			SIGNAL(rowsInserted(QModelIndex,int,int)),
@@ -67,8 +77,11 @@ void MainForm::loadSettings()
 
 	splitter_->restoreState(settings.value("mainSplitter").toByteArray());
 
-	toggleWordWrap_->setChecked(settings.value("logWordWrap", true).toBool());
+	toggleWordWrap_->setChecked(settings.value("logWordWrap", false).toBool());
 	toggleAutoScroll_->setChecked(settings.value("logAutoScroll", true).toBool());
+	logView_->setWordWrap(toggleWordWrap_->isChecked());
+	logView_->setAutoScroll(toggleAutoScroll_->isChecked());
+	logLevelCombo_->setCurrentIndex(settings.value("logFilterLevel", 3).toInt());
 
 	QHeaderView* header = linksView_->header();
 
@@ -100,6 +113,7 @@ void MainForm::saveSettings()
 
 	settings.setValue("logWordWrap", toggleWordWrap_->isChecked());
 	settings.setValue("logAutoScroll", toggleAutoScroll_->isChecked());
+	settings.setValue("logFilterLevel", logLevelCombo_->currentIndex());
 
 	QHeaderView* header = linksView_->header();
 	settings.setValue("linkNameWidth", header->sectionSize(0));
@@ -143,9 +157,50 @@ void MainForm::setupUi()
 
 	logView_ = new LogView;
 
+	// Log filter
+	logLevelCombo_ = new QComboBox;
+	logLevelCombo_->setToolTip("Show the log messages up to this level");
+	logLevelCombo_->addItem(QIcon(":/warning.png"), "error");
+	logLevelCombo_->addItem(QIcon(":/trace.png"), "trace");
+	logLevelCombo_->addItem(QIcon(":/bug.png"), "debug");
+	logLevelCombo_->addItem(QIcon(":/scull.png"), "flood");
+	logLevelCombo_->setCurrentIndex(logLevelCombo_->count() - 1);
+	connect(logLevelCombo_, SIGNAL(currentIndexChanged(int)), SLOT(updateLogFilter()));
+
+	logSenderEdit_ = new LineEdit;
+	logSenderEdit_->setPlaceholderText("Sender");
+	logSenderEdit_->setToolTip("Show the log messages of the matching senders only");
+	logSenderEdit_->setAutoClearMode(true);
+	logSenderEdit_->setButtonEnabled(true);
+	logSenderEdit_->setButtonStyle(LineEdit::kLightAutoRaise);
+	connect(logSenderEdit_, SIGNAL(textEditTimeout(QString)), SLOT(updateLogFilter()));
+
+	logPatternEdit_ = new LineEdit;
+	logPatternEdit_->setPlaceholderText("Regular expression");
+	logPatternEdit_->setToolTip("Show the log messages matching the regular expression "
+			"only");
+	logPatternEdit_->setAutoClearMode(true);
+	logPatternEdit_->setButtonEnabled(true);
+	logPatternEdit_->setButtonStyle(LineEdit::kLightAutoRaise);
+	connect(logPatternEdit_, SIGNAL(textEditTimeout(QString)), SLOT(updateLogFilter()));
+
+	QHBoxLayout* filterLayout = new QHBoxLayout;
+	filterLayout->setContentsMargins(0, 0, 0, 0);
+	filterLayout->addWidget(logLevelCombo_);
+	filterLayout->addWidget(logSenderEdit_, 1);
+	filterLayout->addWidget(logPatternEdit_, 2);
+
+	QVBoxLayout* logLayout = new QVBoxLayout;
+	logLayout->setContentsMargins(0, 0, 0, 0);
+	logLayout->addLayout(filterLayout);
+	logLayout->addWidget(logView_);
+
+	QWidget* logPane = new QWidget;
+	logPane->setLayout(logLayout);
+
 	splitter_ = new QSplitter(Qt::Vertical);
 	splitter_->addWidget(linksView_);
-	splitter_->addWidget(logView_);
+	splitter_->addWidget(logPane);
 
 	int size = splitter_->height();
 	splitter_->setSizes(QList<int>() << size * 0.618 << size * 0.382);
@@ -246,6 +301,16 @@ void MainForm::setupUi()
 	showSettings_ = new QAction(QIcon(":/settings.png"), "Settings", this);
 	toolBar_->addAction(showSettings_);
 	connect(showSettings_, SIGNAL(triggered()), SLOT(showSettings()));
+
+	//
+	// Status bar, shown when some of the log messages are dropped
+	//
+	droppedLabel_ = new QLabel;
+	droppedLabel_->setToolTip("Count of the log messages lost since the manager start.\n"
+			"Lower the log level or increase the log buffer size in the settings.");
+
+	statusBar()->addPermanentWidget(droppedLabel_);
+	statusBar()->hide();
 }
 
 
@@ -379,3 +444,27 @@ void MainForm::updateToolbarButtons()
 
 	updateLinks_->setEnabled(linksView_->model()->root()->childCount());
 }
+
+
+void MainForm::updateLogFilter()
+{
+	int index = logLevelCombo_->currentIndex();
+	Airwave::LogLevel level = static_cast<Airwave::LogLevel>(index + 1);
+
+	// Mark the invalid expression, it doesn't filter anything.
+	QString pattern = logPatternEdit_->text();
+	QPalette palette = logPatternEdit_->palette();
+	palette.setColor(QPalette::Text, QRegularExpression(pattern).isValid() ?
+			qApp->palette().text().color() : QColor(Qt::red));
+
+	logPatternEdit_->setPalette(palette);
+
+	logView_->setFilter(level, logSenderEdit_->text(), pattern);
+}
+
+
+void MainForm::showDroppedCount(quint64 count)
+{
+	droppedLabel_->setText(QString("Dropped log messages: %1").arg(count));
+	statusBar()->show();
+}
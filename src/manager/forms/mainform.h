@@ -5,7 +5,10 @@
 
 
 class QAction;
+class QComboBox;
+class QLabel;
 class QSplitter;
+class LineEdit;
 class LinksModel;
 class LinksView;
 class LogView;
@@ -41,6 +44,10 @@ private:
 	QSplitter* splitter_;
 	LinksView* linksView_;
 	LogView* logView_;
+	QComboBox* logLevelCombo_;
+	LineEdit* logSenderEdit_;
+	LineEdit* logPatternEdit_;
+	QLabel* droppedLabel_;
 
 	void setupUi();
 	bool checkBinaries();
@@ -55,6 +62,8 @@ private slots:
 	void showSettings();
 
 	void updateToolbarButtons();
+	void updateLogFilter();
+	void showDroppedCount(quint64 count);
 };
 
 
@@ -8,6 +8,7 @@
 #include <QMessageBox>
 #include <QPushButton>
 #include <QSettings>
+#include <QSpinBox>
 #include <QTreeWidget>
 #include "common/config.h"
 #include "core/application.h"
@@ -35,6 +36,7 @@ SettingsDialog::SettingsDialog(QWidget* parent) :
 	Storage* storage = qApp->storage();
 	binariesPathEdit_->setText(QString::fromStdString(storage->binariesPath()));
 	logSocketEdit_->setText(QString::fromStdString(storage->logSocketPath()));
+	logBufferSpin_->setValue(storage->logBufferSize());
 
 	int index = static_cast<int>(storage->defaultLogLevel());
 	logLevelCombo_->setCurrentIndex(index);
@@ -88,6 +90,12 @@ void SettingsDialog::setupUi()
 	logLevelCombo_->addItem(QIcon(":/bug.png"), "debug");
 	logLevelCombo_->addItem(QIcon(":/scull.png"), "flood");
 
+	logBufferSpin_ = new QSpinBox;
+	logBufferSpin_->setRange(Storage::kMinLogBufferSize, Storage::kMaxLogBufferSize);
+	logBufferSpin_->setSuffix(" KiB");
+	logBufferSpin_->setToolTip("Size of the buffer for the received log messages, which "
+			"aren't shown yet.\nThe messages, which don't fit it, are dropped.");
+
 	QGridLayout* generalLayout = new QGridLayout;
 	generalLayout->addWidget(new QLabel("VST location:"), 0, 0, Qt::AlignRight);
 	generalLayout->addWidget(vstPathEdit_, 0, 1, 1, 4);
@@ -97,6 +105,8 @@ void SettingsDialog::setupUi()
 	generalLayout->addWidget(logSocketEdit_, 2, 1, 1, 4);
 	generalLayout->addWidget(new QLabel("Default log level:"), 3, 0, Qt::AlignRight);
 	generalLayout->addWidget(logLevelCombo_, 3, 1);
+	generalLayout->addWidget(new QLabel("Log buffer size:"), 4, 0, Qt::AlignRight);
+	generalLayout->addWidget(logBufferSpin_, 4, 1);
 
 	prefixesView_ = new PrefixesView;
 	prefixesView_->setModel(qApp->prefixes());
@@ -376,12 +386,15 @@ void SettingsDialog::accept()
 	}
 
 	LogSocket* socket = qApp->logSocket();
+	socket->setBufferSize(logBufferSpin_->value() * 1024);
+
 	if(logSocketEdit_->text() != socket->id()) {
 		socket->close();
 		socket->listen(logSocketEdit_->text());
 	}
 
 	storage->setDefaultLogLevel(level);
+	storage->setLogBufferSize(logBufferSpin_->value());
 	storage->setBinariesPath(binariesPathEdit_->text().toStdString());
 
 	storage->save();
@@ -8,6 +8,7 @@ class QComboBox;
 class QDialogButtonBox;
 class QLabel;
 class QPushButton;
+class QSpinBox;
 class LineEdit;
 class LoadersModel;
 class LoadersView;
@@ -26,6 +27,7 @@ private:
 	LineEdit* binariesPathEdit_;
 	LineEdit* logSocketEdit_;
 	QComboBox* logLevelCombo_;
+	QSpinBox* logBufferSpin_;
 	PrefixesView* prefixesView_;
 	QPushButton* addPrefixButton_;
 	QPushButton* editPrefixButton_;
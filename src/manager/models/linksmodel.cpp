@@ -13,7 +13,16 @@ LinkItem::LinkItem(Storage::Link link) :
 		QString prefix = QString::fromStdString(storage->prefix(link_.prefix()).path());
 
 		QFileInfo info(QDir(prefix), QString::fromStdString(link_.target()));
-		arch_ = ModuleInfo::instance()->getArch(info.absoluteFilePath().toStdString());
+
+		// The links to the non-VST modules are shown with the unknown architecture.
+		ModuleInfo::Module module;
+		std::string path = info.absoluteFilePath().toStdString();
+		if(ModuleInfo::instance()->getModule(path, &module) && module.isVstPlugin) {
+			arch_ = module.arch;
+		}
+		else {
+			arch_ = ModuleInfo::kArchUnknown;
+		}
 	}
 }
 
@@ -133,6 +142,97 @@ void LinkItem::setLogLevel(LogLevel level)
 }
 
 
+bool LinkItem::isPipelined() const
+{
+	return link_.isPipelined();
+}
+
+
+void LinkItem::setPipelined(bool enabled)
+{
+	link_.setPipelined(enabled);
+	updateData();
+}
+
+
+int LinkItem::spinLimit() const
+{
+	return link_.spinLimit();
+}
+
+
+void LinkItem::setSpinLimit(int usecs)
+{
+	link_.setSpinLimit(usecs);
+	updateData();
+}
+
+
+bool LinkItem::hasPriorityInheritance() const
+{
+	return link_.hasPriorityInheritance();
+}
+
+
+void LinkItem::setPriorityInheritance(bool enabled)
+{
+	link_.setPriorityInheritance(enabled);
+	updateData();
+}
+
+
+bool LinkItem::hasHugePages() const
+{
+	return link_.hasHugePages();
+}
+
+
+void LinkItem::setHugePages(bool enabled)
+{
+	link_.setHugePages(enabled);
+	updateData();
+}
+
+
+bool LinkItem::isSampleAccurate() const
+{
+	return link_.isSampleAccurate();
+}
+
+
+void LinkItem::setSampleAccurate(bool enabled)
+{
+	link_.setSampleAccurate(enabled);
+	updateData();
+}
+
+
+int LinkItem::realtimePriority() const
+{
+	return link_.realtimePriority();
+}
+
+
+void LinkItem::setRealtimePriority(int priority)
+{
+	link_.setRealtimePriority(priority);
+	updateData();
+}
+
+
+QString LinkItem::cpuAffinity() const
+{
+	return QString::fromStdString(link_.cpuAffinity());
+}
+
+
+void LinkItem::setCpuAffinity(const QString& cpus)
+{
+	link_.setCpuAffinity(cpus.toStdString());
+	updateData();
+}
+
+
 LinksModel::LinksModel(QObject* parent) :
 	GenericTreeModel<LinkItem>(new LinkItem(), parent)
 {
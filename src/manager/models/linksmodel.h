@@ -38,6 +38,27 @@ public:
 	LogLevel logLevel() const;
 	void setLogLevel(LogLevel level);
 
+	bool isPipelined() const;
+	void setPipelined(bool enabled);
+
+	int spinLimit() const;
+	void setSpinLimit(int usecs);
+
+	bool hasPriorityInheritance() const;
+	void setPriorityInheritance(bool enabled);
+
+	bool hasHugePages() const;
+	void setHugePages(bool enabled);
+
+	bool isSampleAccurate() const;
+	void setSampleAccurate(bool enabled);
+
+	int realtimePriority() const;
+	void setRealtimePriority(int priority);
+
+	QString cpuAffinity() const;
+	void setCpuAffinity(const QString& cpus);
+
 private:
 	friend class LinksModel;
 
@@ -0,0 +1,208 @@
+#include "logmodel.h"
+
+#include <vector>
+#include <QStringBuilder>
+
+
+LogModel::LogModel(int capacity, QObject* parent) :
+	QAbstractListModel(parent),
+	capacity_(qMax(1, capacity)),
+	first_(0),
+	next_(0),
+	level_(Airwave::LogLevel::kFlood)
+{
+}
+
+
+int LogModel::capacity() const
+{
+	return capacity_;
+}
+
+
+int LogModel::rowCount(const QModelIndex& parent) const
+{
+	if(parent.isValid())
+		return 0;
+
+	return rows_.size();
+}
+
+
+QVariant LogModel::data(const QModelIndex& index, int role) const
+{
+	if(!index.isValid() || index.row() >= static_cast<int>(rows_.size()))
+		return QVariant();
+
+	const Record& item = record(rows_[index.row()]);
+	const LogMessage& message = item.message;
+
+	switch(role) {
+	case Qt::DisplayRole:
+		if(item.isSeparator)
+			return QString();
+
+		return QString(QString::number(message.time >> 32) % '.' %
+				QString::number(message.time & 0xFFFFFFFF).rightJustified(9, '0') %
+				' ' % message.sender % " : " % message.text);
+
+	case Qt::ToolTipRole:
+		return message.text;
+
+	case kTimeRole:
+		return message.time;
+
+	case kLevelRole:
+		return static_cast<int>(message.level);
+
+	case kSenderRole:
+		return message.sender;
+
+	case kTextRole:
+		return message.text;
+
+	case kSeparatorRole:
+		return item.isSeparator;
+	}
+
+	return QVariant();
+}
+
+
+void LogModel::setFilter(Airwave::LogLevel level, const QString& sender,
+		const QRegularExpression& expression)
+{
+	level_ = level;
+	sender_ = sender;
+	expression_ = expression;
+
+	beginResetModel();
+	rows_.clear();
+
+	for(quint64 sequence = first_; sequence < next_; ++sequence) {
+		if(isAccepted(record(sequence)))
+			rows_.push_back(sequence);
+	}
+
+	endResetModel();
+}
+
+
+void LogModel::addMessages(const QVector<LogMessage>& messages)
+{
+	QVector<Record> records;
+	records.reserve(messages.size());
+
+	foreach(const LogMessage& message, messages) {
+		Record record;
+		record.message = message;
+		record.isSeparator = false;
+		records.append(record);
+	}
+
+	addRecords(records);
+}
+
+
+void LogModel::addSeparator()
+{
+	Record record;
+	record.message.time = 0;
+	record.message.level = Airwave::LogLevel::kQuiet;
+	record.isSeparator = true;
+
+	addRecords(QVector<Record>() << record);
+}
+
+
+void LogModel::clear()
+{
+	beginResetModel();
+
+	records_.clear();
+	rows_.clear();
+	first_ = 0;
+	next_ = 0;
+
+	endResetModel();
+}
+
+
+const LogModel::Record& LogModel::record(quint64 sequence) const
+{
+	return records_[sequence % capacity_];
+}
+
+
+bool LogModel::isAccepted(const Record& record) const
+{
+	if(record.isSeparator)
+		return true;
+
+	const LogMessage& message = record.message;
+
+	if(message.level > level_)
+		return false;
+
+	if(!sender_.isEmpty() && !message.sender.contains(sender_, Qt::CaseInsensitive))
+		return false;
+
+	if(!expression_.pattern().isEmpty() && expression_.isValid())
+		return expression_.match(message.text).hasMatch();
+
+	return true;
+}
+
+
+void LogModel::addRecords(const QVector<Record>& records)
+{
+	// Only the last records fit the buffer.
+	int offset = qMax(0, records.size() - capacity_);
+	int count = records.size() - offset;
+	if(count == 0)
+		return;
+
+	quint64 next = next_ + count;
+	quint64 first = next > static_cast<quint64>(capacity_) ? next - capacity_ : 0;
+
+	// Remove the rows of the records, which are going to be overwritten.
+	size_t removed = 0;
+	while(removed < rows_.size() && rows_[removed] < first)
+		removed++;
+
+	if(removed > 0) {
+		beginRemoveRows(QModelIndex(), 0, removed - 1);
+		rows_.erase(rows_.begin(), rows_.begin() + removed);
+		endRemoveRows();
+	}
+
+	first_ = first;
+
+	std::vector<quint64> accepted;
+	accepted.reserve(count);
+
+	for(int i = offset; i < records.size(); ++i) {
+		const Record& item = records[i];
+		int index = next_ % capacity_;
+
+		// The buffer grows up to its capacity.
+		if(index == records_.size()) {
+			records_.append(item);
+		}
+		else {
+			records_[index] = item;
+		}
+
+		if(isAccepted(item))
+			accepted.push_back(next_);
+
+		next_++;
+	}
+
+	if(!accepted.empty()) {
+		int row = rows_.size();
+		beginInsertRows(QModelIndex(), row, row + accepted.size() - 1);
+		rows_.insert(rows_.end(), accepted.begin(), accepted.end());
+		endInsertRows();
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef MODELS_LOGMODEL_H
+#define MODELS_LOGMODEL_H
+
+#include <deque>
+#include <QAbstractListModel>
+#include <QRegularExpression>
+#include <QVector>
+#include "core/logsocket.h"
+
+
+// Keeps the last capacity() log messages in the ring buffer, the oldest ones are
+// discarded. The rows of the model are the messages, which match the filter. The
+// filter is applied to the new messages only, the history is filtered again only when
+// the filter is changed.
+class LogModel : public QAbstractListModel {
+	Q_OBJECT
+public:
+	enum Role {
+		kTimeRole = Qt::UserRole,
+		kLevelRole,
+		kSenderRole,
+		kTextRole,
+		kSeparatorRole
+	};
+
+	LogModel(int capacity, QObject* parent = nullptr);
+
+	int capacity() const;
+
+	int rowCount(const QModelIndex& parent = QModelIndex()) const;
+	QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+
+	// Messages with the higher level, other senders or the text not matching the
+	// expression are hidden. The empty sender and expression match any message.
+	void setFilter(Airwave::LogLevel level, const QString& sender,
+			const QRegularExpression& expression);
+
+	void addMessages(const QVector<LogMessage>& messages);
+	void addSeparator();
+	void clear();
+
+private:
+	struct Record {
+		LogMessage message;
+		bool isSeparator;
+	};
+
+	int capacity_;
+	QVector<Record> records_;
+
+	// The sequence numbers of the oldest and the next record.
+	quint64 first_;
+	quint64 next_;
+
+	// The sequence numbers of the records, which match the filter.
+	std::deque<quint64> rows_;
+
+	Airwave::LogLevel level_;
+	QString sender_;
+	QRegularExpression expression_;
+
+	const Record& record(quint64 sequence) const;
+	bool isAccepted(const Record& record) const;
+	void addRecords(const QVector<Record>& records);
+};
+
+
+#endif // MODELS_LOGMODEL_H
@@ -0,0 +1,141 @@
+#include "logdelegate.h"
+
+#include <climits>
+#include <QAbstractItemView>
+#include <QPainter>
+#include "common/config.h"
+#include "common/logger.h"
+#include "models/logmodel.h"
+
+
+// Horizontal padding of the row (in pixels).
+static const int kMargin = 3;
+
+
+LogDelegate::LogDelegate(QAbstractItemView* view) :
+	QStyledItemDelegate(view),
+	view_(view),
+	isWordWrap_(false)
+{
+}
+
+
+bool LogDelegate::isWordWrap() const
+{
+	return isWordWrap_;
+}
+
+
+void LogDelegate::setWordWrap(bool enabled)
+{
+	isWordWrap_ = enabled;
+}
+
+
+void LogDelegate::paint(QPainter* painter, const QStyleOptionViewItem& option,
+		const QModelIndex& index) const
+{
+	painter->save();
+
+	bool isSelected = option.state & QStyle::State_Selected;
+	if(isSelected)
+		painter->fillRect(option.rect, option.palette.highlight());
+
+	QRect rect = option.rect.adjusted(kMargin, 0, -kMargin, 0);
+
+	if(index.data(LogModel::kSeparatorRole).toBool()) {
+		int y = rect.center().y();
+		painter->setPen(QColor(0x909090));
+		painter->drawLine(rect.left(), y, rect.right(), y);
+		painter->restore();
+		return;
+	}
+
+	QFontMetrics metrics(option.font);
+	painter->setFont(option.font);
+
+	// Time
+	QString text = timeText(index);
+	painter->setPen(isSelected ? option.palette.highlightedText().color() :
+			QColor(0x909090));
+
+	painter->drawText(rect, Qt::AlignLeft | Qt::AlignTop, text);
+	rect.setLeft(rect.left() + metrics.width(text));
+
+	// Sender
+	QString sender = index.data(LogModel::kSenderRole).toString();
+	text = senderText(index);
+
+	if(isSelected) {
+		painter->setPen(option.palette.highlightedText().color());
+	}
+	else if(sender == HOST_BASENAME || sender.endsWith(".dll")) {
+		painter->setPen(QColor(0x804000));
+	}
+	else {
+		painter->setPen(QColor(0x004080));
+	}
+
+	painter->drawText(rect, Qt::AlignLeft | Qt::AlignTop, text);
+	rect.setLeft(rect.left() + metrics.width(text));
+
+	// Message
+	int level = index.data(LogModel::kLevelRole).toInt();
+
+	if(isSelected) {
+		painter->setPen(option.palette.highlightedText().color());
+	}
+	else if(level == static_cast<int>(Airwave::LogLevel::kError)) {
+		painter->setPen(QColor(0xa00000));
+	}
+	else {
+		painter->setPen(QColor(0x222222));
+	}
+
+	painter->drawText(rect, textFlags(), index.data(LogModel::kTextRole).toString());
+	painter->restore();
+}
+
+
+QSize LogDelegate::sizeHint(const QStyleOptionViewItem& option,
+		const QModelIndex& index) const
+{
+	QFontMetrics metrics(option.font);
+	int width = view_->viewport()->width();
+
+	if(!isWordWrap_ || index.data(LogModel::kSeparatorRole).toBool())
+		return QSize(width, metrics.height());
+
+	int prefixWidth = metrics.width(timeText(index) + senderText(index));
+	int textWidth = qMax(metrics.averageCharWidth(), width - prefixWidth - 2 * kMargin);
+
+	QString text = index.data(LogModel::kTextRole).toString();
+	QRect rect = metrics.boundingRect(QRect(0, 0, textWidth, INT_MAX), textFlags(), text);
+	return QSize(width, qMax(metrics.height(), rect.height()));
+}
+
+
+QString LogDelegate::timeText(const QModelIndex& index) const
+{
+	quint64 time = index.data(LogModel::kTimeRole).toULongLong();
+
+	return QString::number(time >> 32) + '.' +
+			QString::number(time & 0xFFFFFFFF).rightJustified(9, '0') + ' ';
+}
+
+
+QString LogDelegate::senderText(const QModelIndex& index) const
+{
+	QString sender = index.data(LogModel::kSenderRole).toString();
+	return sender.rightJustified(20, ' ', true) + " : ";
+}
+
+
+int LogDelegate::textFlags() const
+{
+	int flags = Qt::AlignLeft | Qt::AlignTop;
+	if(isWordWrap_)
+		flags |= Qt::TextWrapAnywhere;
+
+	return flags;
+}
@@ -0,0 +1,36 @@
+#ifndef WIDGETS_LOGDELEGATE_H
+#define WIDGETS_LOGDELEGATE_H
+
+#include <QStyledItemDelegate>
+
+
+class QAbstractItemView;
+
+
+// Paints the log message as the colored timestamp, sender and text columns. Without
+// the word wrap all rows have the same height, so the view lays them out without
+// asking each row for its size.
+class LogDelegate : public QStyledItemDelegate {
+	Q_OBJECT
+public:
+	explicit LogDelegate(QAbstractItemView* view);
+
+	bool isWordWrap() const;
+	void setWordWrap(bool enabled);
+
+	void paint(QPainter* painter, const QStyleOptionViewItem& option,
+			const QModelIndex& index) const;
+
+	QSize sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const;
+
+private:
+	QAbstractItemView* view_;
+	bool isWordWrap_;
+
+	QString timeText(const QModelIndex& index) const;
+	QString senderText(const QModelIndex& index) const;
+	int textFlags() const;
+};
+
+
+#endif // WIDGETS_LOGDELEGATE_H
@@ -1,22 +1,50 @@
-#include <QScrollBar>
-#include <QStringBuilder>
-#include <QTime>
 #include "logview.h"
-#include "common/config.h"
+
+#include <algorithm>
+#include <QApplication>
+#include <QClipboard>
+#include <QKeyEvent>
+#include <QRegularExpression>
+#include <QScreen>
+#include <QScrollBar>
+#include "models/logmodel.h"
+#include "widgets/logdelegate.h"
+
+
+// Maximum number of the messages kept by the view, the oldest ones are discarded.
+static const int kCapacity = 100000;
 
 
 LogView::LogView(QWidget* parent) :
-	QTextEdit(parent),
+	QListView(parent),
 	isAutoScroll_(true),
-	isWordWrap_(true)
+	model_(new LogModel(kCapacity, this)),
+	delegate_(new LogDelegate(this))
 {
-	setReadOnly(true);
-
 	QFont font("Monospace");
 	font.setStyleHint(QFont::TypeWriter);
 	setFont(font);
 
-	setWordWrap(isWordWrap_);
+	setModel(model_);
+	setItemDelegate(delegate_);
+	setSelectionMode(QAbstractItemView::ExtendedSelection);
+	setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+	setResizeMode(QListView::Adjust);
+	setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+
+	// All rows have the same height without the word wrap, so the view lays out only
+	// the visible ones.
+	setWordWrap(false);
+
+	// Don't update the view more often than the screen does.
+	qreal rate = 60;
+	QScreen* screen = QApplication::primaryScreen();
+	if(screen && screen->refreshRate() > 0)
+		rate = screen->refreshRate();
+
+	flushTimer_.setInterval(qMax(1, qRound(1000 / rate)));
+	flushTimer_.setSingleShot(true);
+	connect(&flushTimer_, SIGNAL(timeout()), SLOT(flushMessages()));
 }
 
 
@@ -28,7 +56,7 @@ bool LogView::isAutoScroll() const
 
 bool LogView::isWordWrap() const
 {
-	return isWordWrap_;
+	return delegate_->isWordWrap();
 }
 
 
@@ -40,52 +68,88 @@ void LogView::setAutoScroll(bool enabled)
 
 void LogView::setWordWrap(bool enabled)
 {
-	isWordWrap_ = enabled;
+	delegate_->setWordWrap(enabled);
 
-	if(isWordWrap_) {
-		setWordWrapMode(QTextOption::WrapAtWordBoundaryOrAnywhere);
-	}
-	else {
-		setWordWrapMode(QTextOption::NoWrap);
-	}
+	// The rows with the wrapped text differ in height, so each row is measured. They are
+	// laid out in batches to keep the view responsive.
+	setUniformItemSizes(!enabled);
+	setLayoutMode(enabled ? QListView::Batched : QListView::SinglePass);
+	scheduleDelayedItemsLayout();
 }
 
 
-void LogView::addMessage(quint64 time, const QString& sender, const QString& text)
+void LogView::setFilter(Airwave::LogLevel level, const QString& sender,
+		const QString& pattern)
 {
-	setTextColor(QColor(0x909090));
-	insertPlainText(QString::number(time >> 32));
-	insertPlainText(".");
-	insertPlainText(QString::number(time & 0xFFFFFFFF).rightJustified(9, '0'));
-	insertPlainText(" ");
-
-	if(sender == HOST_BASENAME || sender.endsWith(".dll")) {
-		setTextColor(QColor(0x804000));
-	}
-	else {
-		setTextColor(QColor(0x004080));
-	}
+	flushMessages();
 
-	insertPlainText(sender.rightJustified(20, ' ', true));
+	QRegularExpression expression(pattern);
+	model_->setFilter(level, sender, expression);
 
-	insertPlainText(" : ");
+	if(isAutoScroll_)
+		scrollToBottom();
+}
 
-	setTextColor(0x222222);
-	insertPlainText(text);
-	insertPlainText("\n");
 
-	if(isAutoScroll_) {
-		int maximum = verticalScrollBar()->maximum();
-		verticalScrollBar()->setValue(maximum);
-	}
+void LogView::addMessages(const QVector<LogMessage>& messages)
+{
+	pending_ += messages;
+
+	// The messages, which don't fit the model, would be discarded anyway.
+	if(pending_.size() > kCapacity)
+		pending_.remove(0, pending_.size() - kCapacity);
+
+	if(!flushTimer_.isActive())
+		flushTimer_.start();
 }
 
 
 void LogView::addSeparator()
 {
-	insertHtml("<hr><br>");
-	if(isAutoScroll_) {
-		int maximum = verticalScrollBar()->maximum();
-		verticalScrollBar()->setValue(maximum);
+	flushMessages();
+	model_->addSeparator();
+
+	if(isAutoScroll_)
+		scrollToBottom();
+}
+
+
+void LogView::clear()
+{
+	flushTimer_.stop();
+	pending_.clear();
+	model_->clear();
+}
+
+
+void LogView::keyPressEvent(QKeyEvent* event)
+{
+	if(!event->matches(QKeySequence::Copy)) {
+		QListView::keyPressEvent(event);
+		return;
 	}
+
+	QModelIndexList indexes = selectionModel()->selectedIndexes();
+	std::sort(indexes.begin(), indexes.end());
+
+	QStringList lines;
+	foreach(const QModelIndex& index, indexes)
+		lines << index.data().toString();
+
+	QApplication::clipboard()->setText(lines.join('\n'));
+}
+
+
+void LogView::flushMessages()
+{
+	flushTimer_.stop();
+
+	if(pending_.isEmpty())
+		return;
+
+	model_->addMessages(pending_);
+	pending_.clear();
+
+	if(isAutoScroll_)
+		scrollToBottom();
 }
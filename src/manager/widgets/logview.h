@@ -1,10 +1,19 @@
 #ifndef WIDGETS_LOGVIEW_H
 #define WIDGETS_LOGVIEW_H
 
-#include <QTextEdit>
+#include <QListView>
+#include <QTimer>
+#include <QVector>
+#include "core/logsocket.h"
 
 
-class LogView : public QTextEdit {
+class LogDelegate;
+class LogModel;
+
+
+// Shows the last messages kept by the LogModel. Only the visible rows are painted and
+// the received messages are added to the model at most once per screen refresh.
+class LogView : public QListView {
 	Q_OBJECT
 public:
 	LogView(QWidget* parent = nullptr);
@@ -15,12 +24,25 @@ public:
 public slots:
 	void setAutoScroll(bool enabled);
 	void setWordWrap(bool enabled);
-	void addMessage(quint64 time, const QString& sender, const QString& text);
+	void setFilter(Airwave::LogLevel level, const QString& sender,
+			const QString& pattern);
+
+	void addMessages(const QVector<LogMessage>& messages);
 	void addSeparator();
+	void clear();
+
+protected:
+	void keyPressEvent(QKeyEvent* event);
 
 private:
 	bool isAutoScroll_;
-	bool isWordWrap_;
+	LogModel* model_;
+	LogDelegate* delegate_;
+	QVector<LogMessage> pending_;
+	QTimer flushTimer_;
+
+private slots:
+	void flushMessages();
 };
 
 
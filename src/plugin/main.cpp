@@ -5,8 +5,10 @@
 #include "common/config.h"
 #include "common/filesystem.h"
 #include "common/logger.h"
+#include "common/metadatacache.h"
 #include "common/moduleinfo.h"
 #include "common/storage.h"
+#include "common/threadpolicy.h"
 
 
 using namespace Airwave;
@@ -100,27 +102,38 @@ AEffect* VSTPluginMain(AudioMasterProc audioMasterProc)
 
 	TRACE("WINE loader:   %s", loaderPath.c_str());
 
-	std::string vstPath = prefixPath + '/' + link.target();
+	// The metadata cache is keyed by the real path, the same as the scanner uses.
+	std::string linkPath = prefixPath + '/' + link.target();
+	std::string vstPath = FileSystem::realPath(linkPath);
 	if(!FileSystem::isFileExists(vstPath)) {
-		ERROR("VST binary '%s' doesn't exists", vstPath.c_str());
+		ERROR("VST binary '%s' doesn't exists", linkPath.c_str());
 		return nullptr;
 	}
 
 	TRACE("VST binary:    %s", vstPath.c_str());
 
 	// Find host binary path
-	ModuleInfo::Arch arch = ModuleInfo::instance()->getArch(vstPath);
+	ModuleInfo::Module module;
+	if(!ModuleInfo::instance()->getModule(vstPath, &module)) {
+		ERROR("Unable to determine VST plugin architecture");
+		return nullptr;
+	}
+
+	// Reject the non-VST modules before the host process is spawned.
+	if(!module.isVstPlugin) {
+		ERROR("The %s is not a VST plugin", vstPath.c_str());
+		return nullptr;
+	}
+
+	for(const std::string& name : module.imports)
+		DEBUG("Module import: %s", name.c_str());
 
 	std::string hostName;
-	if(arch == ModuleInfo::kArch64) {
+	if(module.arch == ModuleInfo::kArch64) {
 		hostName = HOST_BASENAME "-64.exe";
 	}
-	else if(arch == ModuleInfo::kArch32) {
-		hostName = HOST_BASENAME "-32.exe";
-	}
 	else {
-		ERROR("Unable to determine VST plugin architecture");
-		return nullptr;
+		hostName = HOST_BASENAME "-32.exe";
 	}
 
 	std::string hostPath = FileSystem::realPath(storage.binariesPath() + '/' + hostName);
@@ -140,15 +153,61 @@ AEffect* VSTPluginMain(AudioMasterProc audioMasterProc)
 		TRACE("Log level:     debug");
 	}
 
+	if(link.isPipelined())
+		TRACE("Processing:    pipelined");
+
+	if(link.spinLimit() > 0)
+		TRACE("Spin limit:    %d us", link.spinLimit());
+
+	if(link.hasPriorityInheritance())
+		TRACE("Audio port:    priority inheritance");
+
+	if(link.hasHugePages())
+		TRACE("Audio port:    huge pages");
+
+	if(link.isSampleAccurate())
+		TRACE("Automation:    sample accurate");
+
+	if(link.realtimePriority() == Storage::Link::kInheritPriority) {
+		TRACE("Priority:      inherited");
+	}
+	else if(link.realtimePriority() > 0) {
+		TRACE("Priority:      %d", link.realtimePriority());
+	}
+
+	u64 cpuAffinity = 0;
+	if(!parseCpuList(link.cpuAffinity(), &cpuAffinity)) {
+		ERROR("Invalid CPU list '%s', the affinity is not set",
+				link.cpuAffinity().c_str());
+		cpuAffinity = 0;
+	}
+	else if(cpuAffinity) {
+		TRACE("CPU affinity:  %s", link.cpuAffinity().c_str());
+	}
+
+	// The cached metadata allows to answer the DAW plugin scan without starting WINE.
+	PluginMetadata metadata;
+	bool isCached = MetadataCache().load(vstPath, &metadata);
+	if(isCached)
+		TRACE("Metadata:      cached");
+
 	// Initialize plugin endpoint
 	Plugin* plugin;
 	plugin = new Plugin(vstPath, hostPath, prefixPath, loaderPath,
-			storage.logSocketPath(), audioMasterProc);
+			storage.logSocketPath(), audioMasterProc, metadata, isCached);
 	if(!plugin->effect()) {
 		ERROR("Unable to initialize plugin endpoint");
 		return nullptr;
 	}
 
+	plugin->setPipelined(link.isPipelined());
+	plugin->setSpinLimit(link.spinLimit());
+	plugin->setPriorityInheritance(link.hasPriorityInheritance());
+	plugin->setHugePages(link.hasHugePages());
+	plugin->setSampleAccurate(link.isSampleAccurate());
+	plugin->setRealtimePriority(link.realtimePriority());
+	plugin->setCpuAffinity(cpuAffinity);
+
 	TRACE("Plugin endpoint is initialized");
 	return plugin->effect();
 }
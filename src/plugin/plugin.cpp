@@ -3,8 +3,10 @@
 #include <cstring>
 #include <unistd.h>
 #include <sys/wait.h>
+#include "common/hostlauncher.h"
 #include "common/logger.h"
 #include "common/protocol.h"
+#include "common/threadpolicy.h"
 
 
 #define XEMBED_EMBEDDED_NOTIFY	0
@@ -14,198 +16,1150 @@
 namespace Airwave {
 
 
+// Process request header, including the transport state snapshot.
+static const size_t kAudioHeaderSize = alignAudio(sizeof(DataFrame) +
+		sizeof(AudioLayout) + sizeof(VstTimeInfo));
+
+// Request all of the transport state fields, since we don't know which of them the
+// VST plugin will be interested in.
+static const intptr_t kTimeInfoFlags = kVstNanosValid | kVstPpqPosValid |
+		kVstTempoValid | kVstBarsValid | kVstCyclePosValid | kVstTimeSigValid |
+		kVstSmpteValid | kVstClockValid;
+
+// Set for the threads, which have called the process functions at least once.
+static thread_local bool isProcessThread = false;
+
+// Realtime priority of the thread, which calls the process functions. It's queried once,
+// since the VST hosts set it up when the thread is created.
+static thread_local int processThreadPriority = -1;
+
+
+// Name of the metadata cache entry, holding the answer to the dispatch request.
+static const char* metadataKey(i32 opcode)
+{
+	switch(opcode) {
+	case effGetVstVersion:    return "vst_version";
+	case effGetVendorVersion: return "vendor_version";
+	case effGetPlugCategory:  return "category";
+	case effGetEffectName:    return "effect_name";
+	case effGetVendorString:  return "vendor_string";
+	case effGetProductString: return "product_string";
+	}
+
+	return nullptr;
+}
+
+
+static inline i64 monotonicTime()
+{
+	timespec tm;
+	clock_gettime(CLOCK_MONOTONIC, &tm);
+	return static_cast<i64>(tm.tv_sec) * 1000000000 + tm.tv_nsec;
+}
+
+
 Plugin::Plugin(const std::string& vstPath, const std::string& hostPath,
 		const std::string& prefixPath, const std::string& loaderPath,
-		const std::string& logSocketPath, AudioMasterProc masterProc) :
+		const std::string& logSocketPath, AudioMasterProc masterProc,
+		const PluginMetadata& metadata, bool isCached) :
+	vstPath_(vstPath),
+	hostPath_(hostPath),
+	prefixPath_(prefixPath),
+	loaderPath_(loaderPath),
+	logSocketPath_(logSocketPath),
+	metadata_(metadata),
+	hasCachedMetadata_(isCached),
+	isMetadataChanged_(false),
+	isStarted_(false),
+	hasStartFailed_(false),
+	isOpenDeferred_(false),
+	isProcessDeferred_(false),
+	deferredBlockSize_(0),
 	masterProc_(masterProc),
 	effect_(nullptr),
 	data_(nullptr),
 	dataLength_(0),
+	chunkHitCount_(0),
+	chunkShareCount_(0),
+	chunkMissCount_(0),
+	isPipelined_(false),
+	slotSize_(0),
+	nextSlot_(0),
+	inFlightCount_(0),
+	pendingFrame_(nullptr),
+	pendingCommand_(Command::Response),
+	initialDelay_(0),
+	pipelineDelay_(0),
+	fifoChannels_(0),
+	fifoCapacity_(0),
+	fifoStart_(0),
+	fifoLength_(0),
+	isIoChanged_(false),
+	spinLimit_(0),
+	isSampleAccurate_(false),
+	sampleRate_(0.0f),
+	blockStartTime_(0),
+	blockLength_(0),
+	hasHugePages_(false),
+	realtimePriority_(kInheritPriority),
+	audioPriority_(0),
+	cpuAffinity_(0),
 	childPid_(-1),
-	processCallbacks_(ATOMIC_FLAG_INIT),
-	mainThreadId_(std::this_thread::get_id()),
-	lastIndex_(-1),
-	lastValue_(0)
+	isPooledHost_(false),
+	processCallbacks_(false),
+	hasAutomationQueue_(false),
+	mainThreadId_(std::this_thread::get_id())
+{
+	// The effect() function will be returning nullptr, if the host endpoint can't be
+	// started, indicating the error.
+
+	DEBUG("Main thread id: %p", mainThreadId_);
+
+	// Avoid memory allocations in the audio thread.
+	stagedEvents_.reserve(kMaxEventCount);
+
+	effect_ = new AEffect;
+	std::memset(effect_, 0, sizeof(AEffect));
+
+	effect_->magic                  = kEffectMagic;
+	effect_->object                 = this;
+	effect_->dispatcher             = dispatchProc;
+	effect_->getParameter           = getParameterProc;
+	effect_->setParameter           = setParameterProc;
+	effect_->__processDeprecated    = nullptr;
+	effect_->processReplacing       = processReplacingProc;
+	effect_->processDoubleReplacing = processDoubleReplacingProc;
+
+	// A DAW plugin scan is served from the cached metadata. The host endpoint is started
+	// on the first request, which can't be answered from the cache.
+	if(hasCachedMetadata_) {
+		TRACE("Using cached VST plugin metadata, host endpoint start is deferred");
+		setPluginInfo(metadata_.info);
+		return;
+	}
+
+	if(!start()) {
+		delete effect_;
+		effect_ = nullptr;
+		return;
+	}
+
+	isStarted_ = true;
+}
+
+
+bool Plugin::start()
+{
+	// FIXME: frame size should be verified.
+	if(!controlPort_.create(65536)) {
+		ERROR("Unable to create control port");
+		return false;
+	}
+
+	// FIXME: frame size should be verified.
+	if(!callbackPort_.create(1024)) {
+		ERROR("Unable to create callback port");
+		controlPort_.disconnect();
+		return false;
+	}
+
+	// Start the host endpoint's process.
+	if(!spawnHost()) {
+		controlPort_.disconnect();
+		callbackPort_.disconnect();
+		return false;
+	}
+
+	DEBUG("Child process started, pid=%d", childPid_);
+
+	std::memset(&rect_, 0, sizeof(ERect));
+
+	processCallbacks_ = true;
+	callbackThread_ = std::thread(&Plugin::callbackThread, this);
+
+	condition_.wait();
+
+	// Send host info to the host endpoint.
+	DataFrame* frame = controlPort_.frame<DataFrame>();
+	frame->command = Command::HostInfo;
+	frame->opcode = callbackPort_.id();
+	frame->index = callbackPort_.owner();
+	controlPort_.sendRequest();
+
+	TRACE("Waiting response from host endpoint...");
+
+	// Wait for the host endpoint initialization.
+	if(!controlPort_.waitResponse()) {
+		ERROR("Host endpoint is not responding");
+
+		// The pooled host endpoint could be a server, shared with other instances.
+		if(!isPooledHost_)
+			kill(childPid_, SIGKILL);
+
+		controlPort_.disconnect();
+		callbackPort_.disconnect();
+		childPid_ = -1;
+		return false;
+	}
+
+	// The host endpoint is connected to both ports, only the mappings are kept.
+	controlPort_.releaseDescriptor();
+	callbackPort_.releaseDescriptor();
+
+	PluginInfo* info = reinterpret_cast<PluginInfo*>(frame->data);
+	setPluginInfo(*info);
+
+	// Cache the metadata of the VST plugin for the next DAW plugin scan.
+	if(!hasCachedMetadata_) {
+		metadata_.info = *info;
+		isMetadataChanged_ = true;
+	}
+
+	// FIXME: frame size should be verified.
+	if(realtimePort_.create(1024)) {
+		frame->command = Command::RealtimePort;
+		frame->opcode = realtimePort_.id();
+		frame->index = realtimePort_.owner();
+
+		controlPort_.sendRequest();
+		controlPort_.waitResponse();
+
+		// Fall back to the general callback channel.
+		if(frame->value) {
+			realtimePort_.releaseDescriptor();
+			realtimeThread_ = std::thread(&Plugin::realtimeThread, this);
+		}
+		else {
+			ERROR("Host endpoint is unable to use the realtime callback port");
+			realtimePort_.disconnect();
+		}
+	}
+
+	if(automationQueue_.create(kAutomationQueueSize)) {
+		frame->command = Command::AutomationQueue;
+		frame->opcode = automationQueue_.id();
+		frame->index = automationQueue_.owner();
+
+		controlPort_.sendRequest();
+		controlPort_.waitResponse();
+
+		// Fall back to the requests through the callback port.
+		if(frame->value) {
+			automationQueue_.releaseDescriptor();
+			hasAutomationQueue_ = true;
+		}
+		else {
+			ERROR("Host endpoint is unable to use the automation queue");
+		}
+	}
+
+	if(effect_->numParams > 0 && parameterQueue_.create(kParameterQueueSize)) {
+		frame->command = Command::ParameterQueue;
+		frame->opcode = parameterQueue_.id();
+		frame->index = parameterQueue_.owner();
+
+		controlPort_.sendRequest();
+		controlPort_.waitResponse();
+
+		// Fall back to the requests through the audio port.
+		if(frame->value) {
+			parameterQueue_.releaseDescriptor();
+		}
+		else {
+			ERROR("Host endpoint is unable to use the parameter queue");
+			parameterQueue_.disconnect();
+		}
+	}
+
+	if(effect_->numParams > 0 && parameters_.create(effect_->numParams)) {
+		frame->command = Command::ParameterMirror;
+		frame->opcode = parameters_.id();
+		frame->index = parameters_.owner();
+
+		controlPort_.sendRequest();
+		controlPort_.waitResponse();
+
+		// Fall back to the requests through the audio port.
+		if(frame->value) {
+			parameters_.releaseDescriptor();
+			recordParameterValues();
+		}
+		else {
+			ERROR("Host endpoint is unable to use the parameter mirror");
+			parameters_.disconnect();
+		}
+	}
+
+	return true;
+}
+
+
+bool Plugin::spawnHost()
+{
+	// Claim an already booted host endpoint from the pool daemon, if there is one
+	// running for the WINE prefix.
+	PoolClaim claim;
+	std::memset(&claim, 0, sizeof(claim));
+	claim.portId = controlPort_.id();
+	claim.portOwner = controlPort_.owner();
+	claim.logLevel = static_cast<i32>(loggerLogLevel());
+
+	// The host endpoint gets the display, audio and WINE settings of the DAW.
+	std::vector<std::string> environment = currentEnvironment();
+
+	if(hostPath_.size() < kPoolPathSize && vstPath_.size() < kPoolPathSize &&
+			logSocketPath_.size() < kPoolPathSize) {
+		std::strcpy(claim.hostPath, hostPath_.c_str());
+		std::strcpy(claim.vstPath, vstPath_.c_str());
+		std::strcpy(claim.logSocketPath, logSocketPath_.c_str());
+
+		pid_t pid;
+		if(claimPooledHost(prefixPath_, loaderPath_, claim, environment, &pid)) {
+			DEBUG("Claimed pooled host endpoint");
+			childPid_ = pid;
+			isPooledHost_ = true;
+			return true;
+		}
+	}
+
+	std::vector<std::string> args;
+	args.push_back(vstPath_);
+	args.push_back(std::to_string(controlPort_.id()));
+	args.push_back(std::to_string(controlPort_.owner()));
+	args.push_back(std::to_string(static_cast<int>(loggerLogLevel())));
+	args.push_back(logSocketPath_);
+
+	pid_t pid;
+	if(!launchHost(hostPath_, prefixPath_, loaderPath_, args, environment, &pid))
+		return false;
+
+	childPid_ = pid;
+	isPooledHost_ = false;
+	return true;
+}
+
+
+bool Plugin::ensureStarted()
+{
+	if(isStarted_)
+		return true;
+
+	RecursiveLock lock(guard_);
+
+	if(isStarted_)
+		return true;
+
+	// The partially started host endpoint can't be restarted.
+	if(hasStartFailed_)
+		return false;
+
+	TRACE("Starting deferred host endpoint...");
+
+	if(!start()) {
+		ERROR("Unable to start deferred host endpoint");
+		hasStartFailed_ = true;
+		return false;
+	}
+
+	if(isOpenDeferred_)
+		dispatch(&controlPort_, effOpen, 0, 0, nullptr, 0.0f);
+
+	if(deferredBlockSize_)
+		dispatch(&controlPort_, effSetBlockSize, 0, deferredBlockSize_, nullptr, 0.0f);
+
+	if(isProcessDeferred_)
+		dispatch(&controlPort_, effStartProcess, 0, 0, nullptr, 0.0f);
+
+	{
+		std::lock_guard<std::mutex> lock(metadataGuard_);
+		for(auto& it : deferredParameters_) {
+			if(!queueParameter(it.first, it.second))
+				ERROR("Unable to send deferred value of parameter %d", it.first);
+		}
+
+		deferredParameters_.clear();
+	}
+
+	isStarted_ = true;
+	return true;
+}
+
+
+void Plugin::setPluginInfo(const PluginInfo& info)
+{
+	effect_->flags        = info.flags;
+	effect_->numPrograms  = info.programCount;
+	effect_->numParams    = info.paramCount;
+	effect_->numInputs    = info.inputCount;
+	effect_->numOutputs   = info.outputCount;
+	effect_->initialDelay = info.initialDelay;
+	effect_->uniqueID     = info.uniqueId;
+	effect_->version      = info.version;
+
+	initialDelay_ = info.initialDelay;
+
+	DEBUG("VST plugin summary:");
+	DEBUG("  flags:         0x%08X", effect_->flags);
+	DEBUG("  program count: %d",     effect_->numPrograms);
+	DEBUG("  param count:   %d",     effect_->numParams);
+	DEBUG("  input count:   %d",     effect_->numInputs);
+	DEBUG("  output count:  %d",     effect_->numOutputs);
+	DEBUG("  initial delay: %d",     effect_->initialDelay);
+	DEBUG("  unique ID:     0x%08X", effect_->uniqueID);
+	DEBUG("  version:       %d",     effect_->version);
+}
+
+
+bool Plugin::dispatchCached(i32 opcode, i32 index, intptr_t value, void* ptr,
+		intptr_t* result)
+{
+	std::lock_guard<std::mutex> lock(metadataGuard_);
+
+	switch(opcode) {
+	case effOpen:
+		isOpenDeferred_ = true;
+		*result = 0;
+		return true;
+
+	// Booting WINE would stall the audio thread of the DAW.
+	case effSetBlockSize:
+		deferredBlockSize_ = value;
+		*result = 0;
+		return true;
+
+	case effStartProcess:
+	case effStopProcess:
+		isProcessDeferred_ = opcode == effStartProcess;
+		*result = 0;
+		return true;
+
+	// The output is silent until the host endpoint is started.
+	case effProcessEvents:
+		*result = 1;
+		return true;
+
+	case effEditIdle:
+		*result = 1;
+		return true;
+
+	case effGetVstVersion:
+	case effGetVendorVersion:
+	case effGetPlugCategory: {
+		auto it = metadata_.values.find(metadataKey(opcode));
+		if(it == metadata_.values.end())
+			return false;
+
+		*result = it->second;
+		return true; }
+
+	case effGetEffectName:
+	case effGetVendorString:
+	case effGetProductString: {
+		auto it = metadata_.strings.find(metadataKey(opcode));
+		if(it == metadata_.strings.end())
+			return false;
+
+		int length = opcode == effGetEffectName ? kVstMaxEffectNameLen :
+				kVstMaxVendorStrLen;
+
+		vst_strncpy(static_cast<char*>(ptr), it->second.c_str(), length - 1);
+		*result = 1;
+		return true; }
+
+	case effGetParamName: {
+		auto it = metadata_.parameterNames.find(index);
+		if(it == metadata_.parameterNames.end())
+			return false;
+
+		vst_strncpy(static_cast<char*>(ptr), it->second.c_str(),
+				kVstExtMaxParamStrLen - 1);
+
+		*result = 1;
+		return true; }
+
+	case effGetProgramNameIndexed: {
+		auto it = metadata_.programNames.find(index);
+		if(it == metadata_.programNames.end())
+			return false;
+
+		vst_strncpy(static_cast<char*>(ptr), it->second.c_str(), kVstMaxProgNameLen - 1);
+		*result = 1;
+		return true; }
+
+	case effCanDo: {
+		if(!ptr) {
+			*result = 0;
+			return true;
+		}
+
+		auto it = metadata_.canDo.find(static_cast<const char*>(ptr));
+		if(it == metadata_.canDo.end())
+			return false;
+
+		*result = it->second;
+		return true; }
+	}
+
+	return false;
+}
+
+
+void Plugin::recordMetadata(i32 opcode, i32 index, void* ptr, intptr_t result)
+{
+	std::lock_guard<std::mutex> lock(metadataGuard_);
+
+	switch(opcode) {
+	case effGetVstVersion:
+	case effGetVendorVersion:
+	case effGetPlugCategory: {
+		i64& value = metadata_.values[metadataKey(opcode)];
+		if(value != result) {
+			value = result;
+			isMetadataChanged_ = true;
+		}
+		break; }
+
+	case effGetEffectName:
+	case effGetVendorString:
+	case effGetProductString: {
+		// Some of the VST plugins fill the string, but return zero.
+		const char* string = static_cast<const char*>(ptr);
+		if(!string || !string[0])
+			break;
+
+		std::string& value = metadata_.strings[metadataKey(opcode)];
+		if(value != string) {
+			value = string;
+			isMetadataChanged_ = true;
+		}
+		break; }
+
+	case effGetParamName:
+	case effGetProgramNameIndexed: {
+		const char* string = static_cast<const char*>(ptr);
+		if(!string || index < 0)
+			break;
+
+		auto& names = opcode == effGetParamName ? metadata_.parameterNames :
+				metadata_.programNames;
+
+		std::string& value = names[index];
+		if(value != string) {
+			value = string;
+			isMetadataChanged_ = true;
+		}
+		break; }
+
+	case effCanDo: {
+		const char* string = static_cast<const char*>(ptr);
+		if(!string)
+			break;
+
+		auto it = metadata_.canDo.find(string);
+		if(it == metadata_.canDo.end() || it->second != result) {
+			metadata_.canDo[string] = result;
+			isMetadataChanged_ = true;
+		}
+		break; }
+	}
+}
+
+
+void Plugin::recordParameterValues()
+{
+	std::lock_guard<std::mutex> lock(metadataGuard_);
+
+	// The getParameter calls are answered with these values until the deferred start.
+	if(hasCachedMetadata_ && !metadata_.parameterValues.empty())
+		return;
+
+	for(i32 i = 0; i < parameters_.count(); ++i) {
+		float value = parameters_.value(i);
+
+		auto it = metadata_.parameterValues.find(i);
+		if(it == metadata_.parameterValues.end() || it->second != value) {
+			metadata_.parameterValues[i] = value;
+			isMetadataChanged_ = true;
+		}
+	}
+}
+
+
+Plugin::~Plugin()
+{
+	TRACE("Waiting for callback thread termination...");
+
+	processCallbacks_ = false;
+	if(callbackThread_.joinable())
+		callbackThread_.join();
+
+	if(realtimeThread_.joinable())
+		realtimeThread_.join();
+
+	SpinPolicy* policy = audioPort_.spinPolicy();
+	if(policy->limit()) {
+		DEBUG("Audio port spin wait: %llu hits, %llu misses",
+				static_cast<ulonglong>(policy->hitCount()),
+				static_cast<ulonglong>(policy->missCount()));
+	}
+
+	if(chunkHitCount_ || chunkShareCount_ || chunkMissCount_) {
+		DEBUG("Chunk cache: %llu hits, %llu shared, %llu misses",
+				static_cast<ulonglong>(chunkHitCount_),
+				static_cast<ulonglong>(chunkShareCount_),
+				static_cast<ulonglong>(chunkMissCount_));
+	}
+
+	controlPort_.disconnect();
+	callbackPort_.disconnect();
+	audioPort_.disconnect();
+	realtimePort_.disconnect();
+	chunk_.reset();
+	parameters_.disconnect();
+	parameterQueue_.disconnect();
+	automationQueue_.disconnect();
+
+	TRACE("Waiting for child process termination...");
+
+	// The pooled host endpoint is not our child, it is reaped by the pool daemon.
+	if(childPid_ > 0 && !isPooledHost_) {
+		int status;
+		waitpid(childPid_, &status, 0);
+	}
+
+	if(isMetadataChanged_)
+		MetadataCache().save(vstPath_, metadata_);
+
+	if(effect_)
+		delete effect_;
+
+	TRACE("Plugin endpoint terminated");
+}
+
+
+AEffect* Plugin::effect()
+{
+	return effect_;
+}
+
+
+bool Plugin::isPipelined() const
+{
+	return isPipelined_;
+}
+
+
+void Plugin::setPipelined(bool enabled)
+{
+	// NOTE The audio port layout is negotiated during the effSetBlockSize request, so
+	// this function should be called before the effOpen event.
+	isPipelined_ = enabled;
+}
+
+
+int Plugin::spinLimit() const
+{
+	return spinLimit_;
+}
+
+
+void Plugin::setSpinLimit(int usecs)
+{
+	spinLimit_ = usecs;
+	audioPort_.spinPolicy()->setLimit(usecs);
+}
+
+
+bool Plugin::isSampleAccurate() const
+{
+	return isSampleAccurate_;
+}
+
+
+void Plugin::setSampleAccurate(bool enabled)
+{
+	// NOTE Should be called before the effOpen event, see setPipelined().
+	isSampleAccurate_ = enabled;
+}
+
+
+int Plugin::realtimePriority() const
+{
+	return realtimePriority_;
+}
+
+
+void Plugin::setRealtimePriority(int priority)
+{
+	realtimePriority_ = priority;
+}
+
+
+u64 Plugin::cpuAffinity() const
+{
+	return cpuAffinity_;
+}
+
+
+void Plugin::setCpuAffinity(u64 mask)
+{
+	// NOTE Should be called before the effOpen event, see setPipelined().
+	cpuAffinity_ = mask;
+}
+
+
+bool Plugin::hasHugePages() const
+{
+	return hasHugePages_;
+}
+
+
+void Plugin::setHugePages(bool enabled)
+{
+	// NOTE Should be called before the effOpen event, see setPipelined().
+	hasHugePages_ = enabled;
+}
+
+
+bool Plugin::hasPriorityInheritance() const
+{
+	return audioPort_.hasPriorityInheritance();
+}
+
+
+void Plugin::setPriorityInheritance(bool enabled)
+{
+	// NOTE Should be called before the effOpen event, see setPipelined().
+	audioPort_.setPriorityInheritance(enabled);
+}
+
+
+void Plugin::callbackThread()
+{
+	TRACE("Callback thread started");
+
+	condition_.post();
+
+	int priority = 0;
+	u64 affinity = 0;
+
+	while(processCallbacks_) {
+		updateThreadPolicy(&priority, &affinity);
+
+		bool hasRequest;
+
+		// The host endpoint rings the automation queue doorbell for both the queued
+		// events and the requests, so the thread sleeps on the single event. The queue
+		// is drained before serving the request to preserve the order of callbacks.
+		if(hasAutomationQueue_) {
+			if(!automationQueue_.wait(100))
+				continue;
+
+			handleAutomationEvents();
+			hasRequest = callbackPort_.tryWaitRequest();
+		}
+		else {
+			hasRequest = callbackPort_.waitRequest(100);
+		}
+
+		if(hasRequest) {
+			DataFrame* frame = callbackPort_.frame<DataFrame>();
+			frame->value = handleAudioMaster(&callbackPort_, &events_);
+			callbackPort_.sendResponse();
+		}
+	}
+
+	TRACE("Callback thread terminated");
+}
+
+
+void Plugin::realtimeThread()
+{
+	TRACE("Realtime callback thread started");
+
+	int priority = 0;
+	u64 affinity = 0;
+
+	while(processCallbacks_) {
+		updateThreadPolicy(&priority, &affinity);
+
+		if(realtimePort_.waitRequest(100)) {
+			DataFrame* frame = realtimePort_.frame<DataFrame>();
+			frame->value = handleAudioMaster(&realtimePort_, &realtimeEvents_);
+			realtimePort_.sendResponse();
+		}
+	}
+
+	TRACE("Realtime callback thread terminated");
+}
+
+
+void Plugin::updateThreadPolicy(int* priority, u64* affinity)
+{
+	// The callback threads serve the audio thread of the host endpoint, so they are
+	// scheduled the same way. The failures are logged once.
+	int audioPriority = audioPriority_;
+	if(*priority != audioPriority) {
+		*priority = audioPriority;
+		setThreadPriority(audioPriority);
+	}
+
+	u64 mask = cpuAffinity_;
+	if(*affinity != mask) {
+		*affinity = mask;
+		setThreadAffinity(mask);
+	}
+}
+
+
+void Plugin::handleAutomationEvents()
+{
+	AutomationEvent event;
+
+	while(automationQueue_.pop(&event)) {
+		FLOOD("(%p) handleAutomationEvent(opcode: %s, index: %d, value: %g)",
+				std::this_thread::get_id(), kAudioMasterEvents[event.opcode],
+				event.index, event.value);
+
+		masterProc_(effect_, event.opcode, event.index, 0, nullptr, event.value);
+	}
+}
+
+
+intptr_t Plugin::setBlockSize(DataPort* port, intptr_t frames)
+{
+	size_t slotSize = kAudioHeaderSize + alignAudio(sizeof(double) * frames) *
+			(effect_->numInputs + effect_->numOutputs) +
+			alignAudio(sizeof(VstEvent) * kMaxEventCount);
+
+	i32 slotCount = isPipelined_ ? kProcessSlotCount : 0;
+	size_t frameSize = slotSize * (1 + slotCount);
+
+	RecursiveLock lock(audioGuard_);
+
+	// In pipelined mode the output of the plugin is delayed by the maximum block size.
+	// The FIFO holds the delayed samples plus one more block.
+	pipelineDelay_ = isPipelined_ ? frames : 0;
+	fifoChannels_ = isPipelined_ ? effect_->numOutputs : 0;
+	fifoCapacity_ = pipelineDelay_ * 2;
+	outputFifo_.assign(fifoChannels_ * fifoCapacity_, 0.0);
+
+	flushPipeline();
+
+	i32 initialDelay = initialDelay_ + pipelineDelay_;
+	if(effect_->initialDelay != initialDelay) {
+		effect_->initialDelay = initialDelay;
+		isIoChanged_ = true;
+	}
+
+	if(audioPort_.frameSize() < frameSize) {
+		DEBUG("Setting block size to %d frames", frames);
+		audioPort_.disconnect();
+
+		// The audio frame is accessed from the realtime threads on both sides, so it
+		// shouldn't cause any page faults.
+		int flags = DataPort::kLockMemory;
+		if(hasHugePages_)
+			flags |= DataPort::kHugePages;
+
+		if(!audioPort_.create(frameSize, flags)) {
+			ERROR("Unable to create audio port");
+			return 0;
+		}
+
+		slotSize_ = slotSize;
+		nextSlot_ = 0;
+
+		DataFrame* frame = controlPort_.frame<DataFrame>();
+		frame->command = Command::Dispatch;
+		frame->opcode = effSetBlockSize;
+		frame->index = audioPort_.id();
+		frame->value = frames;
+
+		AudioPortInfo* info = reinterpret_cast<AudioPortInfo*>(frame->data);
+		info->owner     = audioPort_.owner();
+		info->slotCount = slotCount;
+		info->slotSize  = slotSize;
+		info->spinLimit = spinLimit_;
+		info->priorityInheritance = audioPort_.hasPriorityInheritance();
+		info->sampleAccurate = isSampleAccurate_;
+		info->cpuAffinity = cpuAffinity_;
+
+		port->sendRequest();
+		port->waitResponse();
+
+		if(audioPort_.isConnected())
+			audioPort_.releaseDescriptor();
+
+		return frame->value;
+	}
+
+	return 1;
+}
+
+
+DataFrame* Plugin::processSlot(i32 index)
+{
+	u8* buffer = static_cast<u8*>(audioPort_.frameBuffer());
+	return reinterpret_cast<DataFrame*>(buffer + (index + 1) * slotSize_);
+}
+
+
+void Plugin::drainPipeline()
+{
+	// Collect responses for all process requests in flight. Must be called with locked
+	// audio guard before sending any synchronous request through the audio port.
+	while(inFlightCount_ > 0) {
+		audioPort_.waitResponse();
+		inFlightCount_--;
+	}
+}
+
+
+void Plugin::flushPipeline()
 {
-	// The constructor will return early when error occurs. In this case the effect()
-	// fucntion will be returning nullptr, indicating the error.
+	RecursiveLock lock(audioGuard_);
+	drainPipeline();
 
-	DEBUG("Main thread id: %p", mainThreadId_);
+	// Discard the rendered block, it doesn't belong to the next processed block anymore.
+	pendingFrame_ = nullptr;
+	resetOutputFifo();
+}
 
-	// FIXME: frame size should be verified.
-	if(!controlPort_.create(65536)) {
-		ERROR("Unable to create control port");
-		return;
-	}
 
-	// FIXME: frame size should be verified.
-	if(!callbackPort_.create(1024)) {
-		ERROR("Unable to create callback port");
-		controlPort_.disconnect();
-		return;
-	}
+void Plugin::resetOutputFifo()
+{
+	// The delayed part of the stream is silence right after the processing is
+	// (re)started.
+	std::fill(outputFifo_.begin(), outputFifo_.end(), 0.0);
+	fifoStart_ = 0;
+	fifoLength_ = pipelineDelay_;
+}
 
-	// Start the host endpoint's process.
-	childPid_ = fork();
-	if(childPid_ == -1) {
-		ERROR("fork() call failed");
-		controlPort_.disconnect();
-		callbackPort_.disconnect();
-		return;
-	}
-	else if(childPid_ == 0) {
-		setenv("WINEPREFIX", prefixPath.c_str(), 1);
-		setenv("WINELOADER", loaderPath.c_str(), 1);
 
-		std::string id = std::to_string(controlPort_.id());
-		std::string level = std::to_string(static_cast<int>(loggerLogLevel()));
+void Plugin::notifyIoChanged()
+{
+	if(isIoChanged_.exchange(false))
+		masterProc_(effect_, audioMasterIOChanged, 0, 0, nullptr, 0.0f);
+}
 
-		execl("/bin/sh", "/bin/sh", hostPath.c_str(), vstPath.c_str(), id.c_str(),
-				level.c_str(), logSocketPath.c_str(), nullptr);
 
-		// We should never reach this point on success child execution.
-		ERROR("execl() call failed");
-		return;
+bool Plugin::queueParameter(i32 index, float value)
+{
+	ParameterChange change;
+	change.index = index;
+	change.value = value;
+	change.offset = 0;
+
+	// The changes made by the processing thread belong to the beginning of the next
+	// block. The changes made by the other threads (e.g. automation from the GUI) are
+	// placed according to the time elapsed since the last block was started. If it's
+	// longer than the block, the VST host isn't processing at the moment.
+	if(!isProcessThread && sampleRate_ > 0.0f) {
+		i64 elapsed = monotonicTime() - blockStartTime_;
+		i64 offset = elapsed * static_cast<i64>(sampleRate_) / 1000000000;
+
+		if(offset < blockLength_)
+			change.offset = offset;
 	}
 
-	DEBUG("Child process started, pid=%d", childPid_);
+	// The change is counted before it's pushed, so the host endpoint doesn't refresh the
+	// value until the change is applied.
+	parameters_.addPending(index);
 
-	std::memset(&rect_, 0, sizeof(ERect));
+	if(!parameterQueue_.push(change)) {
+		parameters_.removePending(index);
+		return false;
+	}
 
-	processCallbacks_.test_and_set();
-	callbackThread_ = std::thread(&Plugin::callbackThread, this);
+	// The new value should be visible to the VST host right away.
+	parameters_.setValue(index, value);
+	return true;
+}
 
-	condition_.wait();
 
-	// Send host info to the host endpoint.
-	DataFrame* frame = controlPort_.frame<DataFrame>();
-	frame->command = Command::HostInfo;
-	frame->opcode = callbackPort_.id();
-	controlPort_.sendRequest();
+void Plugin::stageEvents(const VstEvents* events)
+{
+	for(int i = 0; i < events->numEvents; ++i) {
+		if(stagedEvents_.size() >= kMaxEventCount) {
+			ERROR("Too many events per block, %d events are dropped",
+					events->numEvents - i);
+			break;
+		}
 
-	TRACE("Waiting response from host endpoint...");
+		stagedEvents_.push_back(*events->events[i]);
+	}
+}
 
-	// Wait for the host endpoint initialization.
-	if(!controlPort_.waitResponse()) {
-		ERROR("Host endpoint is not responding");
-		kill(childPid_, SIGKILL);
-		controlPort_.disconnect();
-		callbackPort_.disconnect();
-		childPid_ = -1;
-		return;
+
+template<typename T>
+void Plugin::processPipelined(Command command, T** inputs, T** outputs, i32 count)
+{
+	DataFrame* frame = processSlot(nextSlot_);
+	nextSlot_ = (nextSlot_ + 1) % kProcessSlotCount;
+
+	writeInputs(frame, command, inputs, count);
+	audioPort_.sendRequest();
+	inFlightCount_++;
+
+	// Wait for the block, which was sent during the previous call. Usually it's
+	// already rendered at this point.
+	while(inFlightCount_ > 1) {
+		audioPort_.waitResponse();
+		inFlightCount_--;
 	}
 
-	PluginInfo* info = reinterpret_cast<PluginInfo*>(frame->data);
-	effect_ = new AEffect;
-	std::memset(effect_, 0, sizeof(AEffect));
+	// The previous block follows the samples already in the FIFO, there are at least
+	// pipelineDelay_ of them afterwards.
+	if(pendingFrame_) {
+		if(pendingCommand_ == Command::ProcessSingle) {
+			pushOutputs<float>(pendingFrame_);
+		}
+		else {
+			pushOutputs<double>(pendingFrame_);
+		}
+	}
 
-	effect_->magic                  = kEffectMagic;
-	effect_->object                 = this;
-	effect_->dispatcher             = dispatchProc;
-	effect_->getParameter           = getParameterProc;
-	effect_->setParameter           = setParameterProc;
-	effect_->__processDeprecated    = nullptr;
-	effect_->processReplacing       = processReplacingProc;
-	effect_->processDoubleReplacing = processDoubleReplacingProc;
-	effect_->flags                  = info->flags;
-	effect_->numPrograms            = info->programCount;
-	effect_->numParams              = info->paramCount;
-	effect_->numInputs              = info->inputCount;
-	effect_->numOutputs             = info->outputCount;
-	effect_->initialDelay           = info->initialDelay;
-	effect_->uniqueID               = info->uniqueId;
-	effect_->version                = info->version;
+	pendingFrame_ = frame;
+	pendingCommand_ = command;
 
-	DEBUG("VST plugin summary:");
-	DEBUG("  flags:         0x%08X", effect_->flags);
-	DEBUG("  program count: %d",     effect_->numPrograms);
-	DEBUG("  param count:   %d",     effect_->numParams);
-	DEBUG("  input count:   %d",     effect_->numInputs);
-	DEBUG("  output count:  %d",     effect_->numOutputs);
-	DEBUG("  initial delay: %d",     effect_->initialDelay);
-	DEBUG("  unique ID:     0x%08X", effect_->uniqueID);
-	DEBUG("  version:       %d",     effect_->version);
+	popOutputs(outputs, count);
 }
 
 
-Plugin::~Plugin()
+template<typename T>
+void Plugin::writeInputs(DataFrame* frame, Command command, T** inputs, i32 count)
 {
-	TRACE("Waiting for callback thread termination...");
+	frame->command = command;
+	frame->value = count;
 
-	processCallbacks_.clear();
-	if(callbackThread_.joinable())
-		callbackThread_.join();
+	AudioLayout* layout = reinterpret_cast<AudioLayout*>(frame->data);
+	layout->channelStride = alignAudio(sizeof(T) * count);
+	layout->inputOffset = kAudioHeaderSize;
+	layout->outputOffset = layout->inputOffset +
+			layout->channelStride * effect_->numInputs;
+	layout->eventOffset = layout->outputOffset +
+			layout->channelStride * effect_->numOutputs;
+	layout->eventCount = stagedEvents_.size();
 
-	controlPort_.disconnect();
-	callbackPort_.disconnect();
-	audioPort_.disconnect();
+	if(realtimePriority_ == kInheritPriority) {
+		if(processThreadPriority < 0)
+			processThreadPriority = threadPriority();
 
-	TRACE("Waiting for child process termination...");
+		layout->priority = processThreadPriority;
+	}
+	else {
+		layout->priority = realtimePriority_;
+	}
 
-	int status;
-	waitpid(childPid_, &status, 0);
+	audioPriority_ = layout->priority;
 
-	if(effect_)
-		delete effect_;
+	blockStartTime_ = monotonicTime();
+	blockLength_ = count;
 
-	TRACE("Plugin endpoint terminated");
+	if(!stagedEvents_.empty()) {
+		u8* events = reinterpret_cast<u8*>(frame) + layout->eventOffset;
+		std::memcpy(events, stagedEvents_.data(), sizeof(VstEvent) * layout->eventCount);
+		stagedEvents_.clear();
+	}
+
+	// Take the transport state snapshot, so the host endpoint can answer the
+	// audioMasterGetTime requests without calling back to the VST host.
+	intptr_t value = masterProc_(effect_, audioMasterGetTime, 0, kTimeInfoFlags, nullptr,
+			0.0f);
+
+	VstTimeInfo* timeInfo = reinterpret_cast<VstTimeInfo*>(value);
+	if(timeInfo) {
+		layout->timeInfoOffset = sizeof(DataFrame) + sizeof(AudioLayout);
+		u8* data = reinterpret_cast<u8*>(frame) + layout->timeInfoOffset;
+		std::memcpy(data, timeInfo, sizeof(VstTimeInfo));
+	}
+	else {
+		layout->timeInfoOffset = 0;
+	}
+
+	u8* data = reinterpret_cast<u8*>(frame) + layout->inputOffset;
+
+	for(int i = 0; i < effect_->numInputs; ++i) {
+		std::memcpy(data, inputs[i], sizeof(T) * count);
+		data += layout->channelStride;
+	}
 }
 
 
-AEffect* Plugin::effect()
+template<typename T>
+void Plugin::readOutputs(DataFrame* frame, T** outputs, i32 count)
 {
-	return effect_;
+	AudioLayout* layout = reinterpret_cast<AudioLayout*>(frame->data);
+	u8* data = reinterpret_cast<u8*>(frame) + layout->outputOffset;
+
+	for(int i = 0; i < effect_->numOutputs; ++i) {
+		std::memcpy(outputs[i], data, sizeof(T) * count);
+		data += layout->channelStride;
+	}
 }
 
 
-void Plugin::callbackThread()
+template<typename T>
+void Plugin::pushOutputs(DataFrame* frame)
 {
-	TRACE("Callback thread started");
+	// The VST host has exceeded the maximum block size, the rest can't be delayed.
+	i32 count = std::min(static_cast<i32>(frame->value), fifoCapacity_ - fifoLength_);
+	if(count <= 0)
+		return;
 
-	condition_.post();
+	AudioLayout* layout = reinterpret_cast<AudioLayout*>(frame->data);
+	u8* data = reinterpret_cast<u8*>(frame) + layout->outputOffset;
 
-	while(processCallbacks_.test_and_set()) {
-		if(callbackPort_.waitRequest(100)) {
-			DataFrame* frame = callbackPort_.frame<DataFrame>();
-			frame->value = handleAudioMaster();
-			callbackPort_.sendResponse();
-		}
+	i32 end = (fifoStart_ + fifoLength_) % fifoCapacity_;
+	i32 first = std::min(count, fifoCapacity_ - end);
+	i32 channelCount = std::min(effect_->numOutputs, fifoChannels_);
+
+	for(int i = 0; i < channelCount; ++i) {
+		const T* source = reinterpret_cast<const T*>(data);
+		double* channel = outputFifo_.data() + i * fifoCapacity_;
+
+		std::copy(source, source + first, channel + end);
+		std::copy(source + first, source + count, channel);
+		data += layout->channelStride;
 	}
 
-	TRACE("Callback thread terminated");
+	fifoLength_ += count;
 }
 
 
-intptr_t Plugin::setBlockSize(DataPort* port, intptr_t frames)
+template<typename T>
+void Plugin::popOutputs(T** outputs, i32 count)
 {
-	size_t frameSize = sizeof(DataFrame) + sizeof(double) *
-			(frames * effect_->numInputs + frames * effect_->numOutputs);
+	i32 length = std::min(count, fifoLength_);
+	i32 first = std::min(length, fifoCapacity_ - fifoStart_);
 
-	if(audioPort_.frameSize() < frameSize) {
-		DEBUG("Setting block size to %d frames", frames);
-		audioPort_.disconnect();
+	for(int i = 0; i < effect_->numOutputs; ++i) {
+		T* output = outputs[i];
 
-		if(!audioPort_.create(frameSize)) {
-			ERROR("Unable to create audio port");
-			return 0;
+		// The channels added after the effSetBlockSize are silent.
+		if(i >= fifoChannels_) {
+			std::fill(output, output + count, T());
+			continue;
 		}
 
-		DataFrame* frame = controlPort_.frame<DataFrame>();
-		frame->command = Command::Dispatch;
-		frame->opcode = effSetBlockSize;
-		frame->index = audioPort_.id();
-		port->sendRequest();
-		port->waitResponse();
-		return frame->value;
+		const double* channel = outputFifo_.data() + i * fifoCapacity_;
+
+		std::copy(channel + fifoStart_, channel + fifoStart_ + first, output);
+		std::copy(channel, channel + length - first, output + first);
+		std::fill(output + length, output + count, T());
 	}
 
-	return 1;
+	if(length > 0) {
+		fifoStart_ = (fifoStart_ + length) % fifoCapacity_;
+		fifoLength_ -= length;
+	}
 }
 
 
-intptr_t Plugin::handleAudioMaster()
+intptr_t Plugin::handleAudioMaster(DataPort* port, VstEventKeeper* events)
 {
-	DataFrame* frame = callbackPort_.frame<DataFrame>();
+	DataFrame* frame = port->frame<DataFrame>();
 
 	if(frame->opcode != audioMasterGetTime && frame->opcode != audioMasterIdle) {
 		FLOOD("(%p) handleAudioMaster(opcode: %s, index: %d, value: %d, opt: %g)",
@@ -231,17 +1185,9 @@ intptr_t Plugin::handleAudioMaster()
 		return masterProc_(effect_, frame->opcode, frame->index, frame->value, nullptr,
 				frame->opt);
 
-	case audioMasterAutomate: {
-		lastThreadId_ = std::this_thread::get_id();
-		lastIndex_ = frame->index;
-		lastValue_ = frame->value;
-
-		intptr_t result = masterProc_(effect_, frame->opcode, frame->index, frame->value,
-				nullptr, frame->opt);
-
-		lastIndex_ = -1;
-		return result;
-	}
+	case audioMasterAutomate:
+		return masterProc_(effect_, frame->opcode, frame->index, frame->value, nullptr,
+				frame->opt);
 
 	case audioMasterIOChanged: {
 		PluginInfo* info = reinterpret_cast<PluginInfo*>(frame->data);
@@ -250,10 +1196,12 @@ intptr_t Plugin::handleAudioMaster()
 		effect_->numParams    = info->paramCount;
 		effect_->numInputs    = info->inputCount;
 		effect_->numOutputs   = info->outputCount;
-		effect_->initialDelay = info->initialDelay;
+		effect_->initialDelay = info->initialDelay + pipelineDelay_;
 		effect_->uniqueID     = info->uniqueId;
 		effect_->version      = info->version;
 
+		initialDelay_ = info->initialDelay;
+
 		return masterProc_(effect_, frame->opcode, frame->index, frame->value, nullptr,
 				frame->opt); }
 
@@ -276,9 +1224,8 @@ intptr_t Plugin::handleAudioMaster()
 		return 0; }
 
 	case audioMasterProcessEvents: {
-		VstEvent* events = reinterpret_cast<VstEvent*>(frame->data);
-		events_.reload(frame->index, events);
-		VstEvents* e = events_.events();
+		events->reload(frame->index, reinterpret_cast<VstEvent*>(frame->data));
+		VstEvents* e = events->events();
 
 		return masterProc_(effect_, frame->opcode, 0, 0, e, 0.0f); }
 	}
@@ -318,12 +1265,16 @@ intptr_t Plugin::dispatch(DataPort* port, i32 opcode, i32 index, intptr_t value,
 		setBlockSize(port, 256);
 		return result; }
 
+	case effSetSampleRate:
+		sampleRate_ = opt;
+		port->sendRequest();
+		port->waitResponse();
+		return frame->value;
+
 	case effGetVstVersion:
 	case effGetPlugCategory:
-	case effSetSampleRate:
 	case effGetVendorVersion:
 	case effEditClose:
-	case effMainsChanged:
 	case effCanBeAutomated:
 	case effGetProgram:
 	case effStartProcess:
@@ -344,13 +1295,20 @@ intptr_t Plugin::dispatch(DataPort* port, i32 opcode, i32 index, intptr_t value,
 		port->waitResponse();
 		return frame->value;
 
+	case effMainsChanged:
+		// The block rendered before suspending doesn't belong to the resumed stream.
+		flushPipeline();
+
+		port->sendRequest();
+		port->waitResponse();
+		return frame->value;
+
 	case effClose:
 		port->sendRequest();
 		port->waitResponse();
 
 		TRACE("Closing plugin");
 		delete this;
-		loggerFree();
 		return 1;
 
 	case effSetBlockSize:
@@ -544,52 +1502,56 @@ intptr_t Plugin::dispatch(DataPort* port, i32 opcode, i32 index, intptr_t value,
 	case effGetChunk: {
 		DEBUG("effGetChunk");
 
+		// Tell the hash of the chunk we already have to the host endpoint.
+		ChunkHeader* header = reinterpret_cast<ChunkHeader*>(frame->data);
+		header->hash = chunk_ ? chunk_->hash : 0;
+		header->size = chunk_ ? chunk_->size : 0;
+
 		// Tell the block size to the host endpoint.
-		ptrdiff_t blockSize = port->frameSize() - sizeof(DataFrame);
-		frame->value = blockSize;
+		frame->value = port->frameSize() - sizeof(DataFrame) - sizeof(ChunkHeader);
 
 		port->sendRequest();
 		port->waitResponse();
 
 		DEBUG("effGetChunk: chunk size %d bytes", frame->value);
 
-		// If VST plugin supports the effGetChunk event, it has placed first data block
-		// (or even the entire chunk) in the frame buffer.
 		size_t chunkSize = frame->value;
-		size_t count = frame->index;
+		u64 hash = header->hash;
 
-		if(chunkSize == 0 || count == 0) {
+		if(chunkSize == 0) {
 			ERROR("effGetChunk is unsupported by the VST plugin");
 			return 0;
 		}
 
-		chunk_.resize(chunkSize);
-
-		auto it = chunk_.begin();
-		it = std::copy(frame->data, frame->data + count, it);
+		void** chunk = static_cast<void**>(ptr);
 
-		while(it != chunk_.end()) {
-			frame->command = Command::GetDataBlock;
-			frame->index = std::min(blockSize, chunk_.end() - it);
+		// The VST plugin state hasn't changed since the previous request.
+		if(chunk_ && chunk_->hash == hash && chunk_->size == chunkSize) {
+			DEBUG("effGetChunk: chunk is unchanged");
+			chunkHitCount_++;
 
-			DEBUG("effGetChunk: requesting next %d bytes", frame->index);
+			*chunk = static_cast<void*>(chunk_->data());
+			return chunkSize;
+		}
 
-			port->sendRequest();
-			port->waitResponse();
+		// Another instance of the VST plugin could have the same state.
+		std::shared_ptr<Chunk> received = ChunkCache::find(hash, chunkSize);
+		if(received) {
+			DEBUG("effGetChunk: chunk is shared with another instance");
+			chunkShareCount_++;
+		}
+		else {
+			chunkMissCount_++;
 
-			size_t count = frame->index;
-			if(count == 0) {
-				ERROR("effGetChunk: premature end of data transmission");
+			received = receiveChunk(port, hash, chunkSize);
+			if(!received)
 				return 0;
-			}
 
-			it = std::copy(frame->data, frame->data + count, it);
+			ChunkCache::insert(received);
 		}
 
-		DEBUG("effGetChunk: received %d bytes", chunkSize);
-
-		void** chunk = static_cast<void**>(ptr);
-		*chunk = static_cast<void*>(chunk_.data());
+		chunk_ = received;
+		*chunk = static_cast<void*>(chunk_->data());
 		return chunkSize; }
 
 	case effSetChunk: {
@@ -601,6 +1563,16 @@ intptr_t Plugin::dispatch(DataPort* port, i32 opcode, i32 index, intptr_t value,
 		dataLength_ = frame->value;
 		size_t blockSize = port->frameSize() - sizeof(DataFrame);
 
+		// Large chunks are transferred at once through the transient port of the exact
+		// chunk size. The host endpoint holds the port until the effSetChunk request.
+		DataPort chunkPort;
+		if(chunkSize > blockSize && chunkPort.create(chunkSize)) {
+			std::memcpy(chunkPort.frameBuffer(), data_, chunkSize);
+
+			if(sendChunkPort(port, &chunkPort, false))
+				dataLength_ = 0;
+		}
+
 		while(dataLength_) {
 			frame->command = Command::SetDataBlock;
 			size_t count = std::min(blockSize, dataLength_);
@@ -654,6 +1626,87 @@ intptr_t Plugin::dispatch(DataPort* port, i32 opcode, i32 index, intptr_t value,
 }
 
 
+std::shared_ptr<Chunk> Plugin::receiveChunk(DataPort* port, u64 hash, size_t size)
+{
+	DataFrame* frame = port->frame<DataFrame>();
+
+	// If VST plugin supports the effGetChunk event, it has placed first data block
+	// (or even the entire chunk) in the frame buffer, right after the chunk header.
+	const u8* block = frame->data + sizeof(ChunkHeader);
+	size_t count = frame->index;
+
+	if(count == 0) {
+		ERROR("effGetChunk: no data received");
+		return nullptr;
+	}
+
+	std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+	chunk->hash = hash;
+	chunk->size = size;
+
+	// The rest of a large chunk is transferred at once through the transient port of
+	// the exact chunk size, instead of the series of GetDataBlock requests.
+	if(size > count && chunk->port.create(size)) {
+		std::memcpy(chunk->port.frameBuffer(), block, count);
+
+		if(sendChunkPort(port, &chunk->port, true)) {
+			DEBUG("effGetChunk: received %d bytes (chunk port)", size);
+			return chunk;
+		}
+
+		chunk->port.disconnect();
+	}
+
+	ptrdiff_t blockSize = port->frameSize() - sizeof(DataFrame);
+	chunk->buffer.resize(size);
+
+	auto it = chunk->buffer.begin();
+	it = std::copy(block, block + count, it);
+
+	while(it != chunk->buffer.end()) {
+		frame->command = Command::GetDataBlock;
+		frame->index = std::min(blockSize, chunk->buffer.end() - it);
+
+		DEBUG("effGetChunk: requesting next %d bytes", frame->index);
+
+		port->sendRequest();
+		port->waitResponse();
+
+		size_t count = frame->index;
+		if(count == 0) {
+			ERROR("effGetChunk: premature end of data transmission");
+			return nullptr;
+		}
+
+		it = std::copy(frame->data, frame->data + count, it);
+	}
+
+	DEBUG("effGetChunk: received %d bytes", size);
+	return chunk;
+}
+
+
+bool Plugin::sendChunkPort(DataPort* port, DataPort* chunkPort, bool isReceiving)
+{
+	DataFrame* frame = port->frame<DataFrame>();
+	frame->command = Command::ChunkPort;
+	frame->opcode  = chunkPort->id();
+	frame->index   = chunkPort->owner();
+	frame->value   = isReceiving;
+
+	port->sendRequest();
+	port->waitResponse();
+
+	if(!frame->value) {
+		ERROR("Host endpoint is unable to use the chunk port");
+		return false;
+	}
+
+	chunkPort->releaseDescriptor();
+	return true;
+}
+
+
 void Plugin::sendXembedMessage(Display* display, Window window, long message, long detail,
 		long data1, long data2)
 {
@@ -677,6 +1730,8 @@ void Plugin::sendXembedMessage(Display* display, Window window, long message, lo
 
 float Plugin::getParameter(i32 index)
 {
+	drainPipeline();
+
 	DataFrame* frame = audioPort_.frame<DataFrame>();
 	frame->command = Command::GetParameter;
 	frame->index = index;
@@ -689,6 +1744,8 @@ float Plugin::getParameter(i32 index)
 
 void Plugin::setParameter(i32 index, float value)
 {
+	drainPipeline();
+
 	DataFrame* frame = audioPort_.frame<DataFrame>();
 	frame->command = Command::SetParameter;
 	frame->index = index;
@@ -701,45 +1758,35 @@ void Plugin::setParameter(i32 index, float value)
 
 void Plugin::processReplacing(float** inputs, float** outputs, i32 count)
 {
-	DataFrame* frame = audioPort_.frame<DataFrame>();
-	frame->command = Command::ProcessSingle;
-	frame->value = count;
-	float* data = reinterpret_cast<float*>(frame->data);
-
-	for(int i = 0; i < effect_->numInputs; ++i) {
-		std::memcpy(data, inputs[i], sizeof(float) * count);
-		data += count;
+	if(isPipelined_) {
+		processPipelined(Command::ProcessSingle, inputs, outputs, count);
+		return;
 	}
 
+	DataFrame* frame = audioPort_.frame<DataFrame>();
+	writeInputs(frame, Command::ProcessSingle, inputs, count);
+
 	audioPort_.sendRequest();
 	audioPort_.waitResponse();
 
-	data = reinterpret_cast<float*>(frame->data);
-
-	for(int i = 0; i < effect_->numOutputs; ++i) {
-		std::memcpy(outputs[i], data, sizeof(float) * count);
-		data += count;
-	}
+	readOutputs(frame, outputs, count);
 }
 
 
 void Plugin::processDoubleReplacing(double** inputs, double** outputs, i32 count)
 {
-	DataFrame* frame = audioPort_.frame<DataFrame>();
-	frame->command = Command::ProcessDouble;
-	frame->value = count;
-	double* data = reinterpret_cast<double*>(frame->data);
+	if(isPipelined_) {
+		processPipelined(Command::ProcessDouble, inputs, outputs, count);
+		return;
+	}
 
-	for(int i = 0; i < effect_->numInputs; ++i)
-		data = std::copy(inputs[i], inputs[i] + count, data);
+	DataFrame* frame = audioPort_.frame<DataFrame>();
+	writeInputs(frame, Command::ProcessDouble, inputs, count);
 
 	audioPort_.sendRequest();
 	audioPort_.waitResponse();
 
-	data = reinterpret_cast<double*>(frame->data);
-
-	for(int i = 0; i < effect_->numOutputs; ++i)
-		data = std::copy(outputs[i], outputs[i] + count, data);
+	readOutputs(frame, outputs, count);
 }
 
 
@@ -755,6 +1802,24 @@ intptr_t Plugin::dispatchProc(AEffect* effect, i32 opcode, i32 index, intptr_t v
 	DataPort* port;
 	RecursiveMutex* guard;
 
+	if(opcode == effEditIdle)
+		plugin->notifyIoChanged();
+
+	if(!plugin->isStarted_) {
+		if(opcode == effClose) {
+			TRACE("Closing plugin");
+			delete plugin;
+			return 1;
+		}
+
+		intptr_t result;
+		if(plugin->dispatchCached(opcode, index, value, ptr, &result))
+			return result;
+
+		if(!plugin->ensureStarted())
+			return 0;
+	}
+
 	// Ardour seems to be sending effEditOpen on something else besides the main thread.
 	// However, we do want to send it to the control port, since that's where our
 	// bridge expects it.
@@ -768,13 +1833,29 @@ intptr_t Plugin::dispatchProc(AEffect* effect, i32 opcode, i32 index, intptr_t v
 	}
 
 	guard->lock();
+
+	if(port == &plugin->audioPort_) {
+		// The events are sent along with the next process request, instead of a separate
+		// round trip to the host endpoint.
+		if(opcode == effProcessEvents) {
+			plugin->stageEvents(static_cast<VstEvents*>(ptr));
+			guard->unlock();
+			return 1;
+		}
+
+		// Synchronous requests can't be mixed with the pipelined process requests.
+		plugin->drainPipeline();
+	}
+
 	int result = plugin->dispatch(port, opcode, index, value, ptr, opt);
 
 	// If opcode equals to effClose, then plugin will be destroyed inside of
 	// plugin->dispatch() call, thus we don't need to unlock the mutex and can't
 	// dereference the guard pointer here
-	if(opcode != effClose)
+	if(opcode != effClose) {
+		plugin->recordMetadata(opcode, index, ptr, result);
 		guard->unlock();
+	}
 
 	return result;
 }
@@ -783,16 +1864,21 @@ intptr_t Plugin::dispatchProc(AEffect* effect, i32 opcode, i32 index, intptr_t v
 float Plugin::getParameterProc(AEffect* effect, i32 index)
 {
 	Plugin* plugin = static_cast<Plugin*>(effect->object);
-
-	if(plugin->lastIndex_ != -1 && std::this_thread::get_id() == plugin->lastThreadId_) {
-		if(plugin->lastIndex_ != index) {
-			ERROR("Unable to get parameter (%d!=%d)", plugin->lastIndex_, index);
-			return 0.0f;
-		}
-
-		return plugin->lastValue_;
+	if(!plugin->isStarted_) {
+		std::lock_guard<std::mutex> lock(plugin->metadataGuard_);
+		auto it = plugin->deferredParameters_.find(index);
+		if(it != plugin->deferredParameters_.end())
+			return it->second;
+
+		auto value = plugin->metadata_.parameterValues.find(index);
+		return value != plugin->metadata_.parameterValues.end() ? value->second : 0.0f;
 	}
 
+	// The parameter count could grow after audioMasterIOChanged, the mirror doesn't
+	// cover such parameters.
+	if(index < plugin->parameters_.count())
+		return plugin->parameters_.value(index);
+
 	RecursiveLock lock(plugin->audioGuard_);
 	return plugin->getParameter(index);
 }
@@ -801,6 +1887,15 @@ float Plugin::getParameterProc(AEffect* effect, i32 index)
 void Plugin::setParameterProc(AEffect* effect, i32 index, float value)
 {
 	Plugin* plugin = static_cast<Plugin*>(effect->object);
+	if(!plugin->isStarted_) {
+		std::lock_guard<std::mutex> lock(plugin->metadataGuard_);
+		plugin->deferredParameters_[index] = value;
+		return;
+	}
+
+	if(plugin->queueParameter(index, value))
+		return;
+
 	RecursiveLock lock(plugin->audioGuard_);
 	plugin->setParameter(index, value);
 }
@@ -810,7 +1905,19 @@ void Plugin::processReplacingProc(AEffect* effect, float** inputs, float** outpu
 		i32 sampleCount)
 {
 	Plugin* plugin = static_cast<Plugin*>(effect->object);
+	plugin->notifyIoChanged();
+
+	// Booting WINE would stall the audio thread, the host endpoint is started by the
+	// dispatcher (effMainsChanged at the latest).
+	if(!plugin->isStarted_) {
+		for(i32 i = 0; i < effect->numOutputs; ++i)
+			std::memset(outputs[i], 0, sizeof(float) * sampleCount);
+
+		return;
+	}
+
 	RecursiveLock lock(plugin->audioGuard_);
+	isProcessThread = true;
 	plugin->processReplacing(inputs, outputs, sampleCount);
 }
 
@@ -819,7 +1926,17 @@ void Plugin::processDoubleReplacingProc(AEffect* effect, double** inputs,
 		double** outputs, i32 sampleCount)
 {
 	Plugin* plugin = static_cast<Plugin*>(effect->object);
+	plugin->notifyIoChanged();
+
+	if(!plugin->isStarted_) {
+		for(i32 i = 0; i < effect->numOutputs; ++i)
+			std::memset(outputs[i], 0, sizeof(double) * sampleCount);
+
+		return;
+	}
+
 	RecursiveLock lock(plugin->audioGuard_);
+	isProcessThread = true;
 	plugin->processDoubleReplacing(inputs, outputs, sampleCount);
 }
 
@@ -2,13 +2,20 @@
 #define PLUGIN_PLUGIN_H
 
 #include <atomic>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 #include <X11/Xlib.h>
+#include "common/chunkcache.h"
 #include "common/dataport.h"
 #include "common/event.h"
+#include "common/metadatacache.h"
+#include "common/parametermirror.h"
+#include "common/protocol.h"
+#include "common/sharedqueue.h"
 #include "common/vst24.h"
 #include "common/vsteventkeeper.h"
 
@@ -24,21 +31,93 @@ class Plugin {
 public:
 	Plugin(const std::string& vstPath, const std::string& hostPath,
 		   const std::string& prefixPath, const std::string& loaderPath,
-		   const std::string& logSocketPath, AudioMasterProc masterProc);
+		   const std::string& logSocketPath, AudioMasterProc masterProc,
+		   const PluginMetadata& metadata, bool isCached);
 
 	~Plugin();
 
 	AEffect* effect();
 
+	bool isPipelined() const;
+	void setPipelined(bool enabled);
+
+	int spinLimit() const;
+	void setSpinLimit(int usecs);
+
+	bool hasPriorityInheritance() const;
+	void setPriorityInheritance(bool enabled);
+
+	bool hasHugePages() const;
+	void setHugePages(bool enabled);
+
+	bool isSampleAccurate() const;
+	void setSampleAccurate(bool enabled);
+
+	// The kInheritPriority means the priority of the VST host thread, which calls the
+	// process functions. Zero disables the realtime scheduling.
+	static const int kInheritPriority = -1;
+
+	int realtimePriority() const;
+	void setRealtimePriority(int priority);
+
+	u64 cpuAffinity() const;
+	void setCpuAffinity(u64 mask);
+
 private:
+	// Number of audio port slots used for process requests in pipelined mode.
+	static const i32 kProcessSlotCount = 2;
+
+	// Maximum number of events, that can be sent along with a process request.
+	static const i32 kMaxEventCount = 512;
+
+	// Capacity of the parameter change queue, should be a power of two.
+	static const u32 kParameterQueueSize = 1024;
+
+	// Capacity of the automation event queue, should be a power of two.
+	static const u32 kAutomationQueueSize = 1024;
+
+	std::string vstPath_;
+	std::string hostPath_;
+	std::string prefixPath_;
+	std::string loaderPath_;
+	std::string logSocketPath_;
+
+	// Answers to the metadata queries are recorded and saved to the cache, so the next
+	// DAW plugin scan doesn't need to start the host endpoint.
+	PluginMetadata metadata_;
+	std::mutex metadataGuard_;
+	bool hasCachedMetadata_;
+	bool isMetadataChanged_;
+
+	// The host endpoint start is deferred when the plugin endpoint is created with the
+	// cached metadata. The effOpen event received in the meantime is sent after start.
+	// The realtime calls and the events, which the DAW could send from its audio thread,
+	// never start the host endpoint. Their state is kept here and sent after start.
+	std::atomic<bool> isStarted_;
+	bool hasStartFailed_;
+	bool isOpenDeferred_;
+	bool isProcessDeferred_;
+	intptr_t deferredBlockSize_;
+	std::map<i32, float> deferredParameters_;
+
 	AudioMasterProc masterProc_;
 	AEffect* effect_;
 	ERect rect_;
 	VstEventKeeper events_;
 
+	// Events received through the effProcessEvents from the audio thread. They are sent
+	// to the host endpoint along with the next process request.
+	std::vector<VstEvent> stagedEvents_;
+
 	uint8_t* data_;
 	size_t dataLength_;
-	std::vector<uint8_t> chunk_;
+
+	// Chunk received with the last effGetChunk request, possibly shared with the other
+	// plugin endpoints of the process.
+	std::shared_ptr<Chunk> chunk_;
+	u64 chunkHitCount_;
+	u64 chunkShareCount_;
+	u64 chunkMissCount_;
 
 	RecursiveMutex guard_;
 	RecursiveMutex audioGuard_;
@@ -47,32 +126,122 @@ private:
 	DataPort callbackPort_;
 	DataPort audioPort_;
 
+	// Callback channel of the host endpoint's audio thread, served by its own thread.
+	DataPort realtimePort_;
+	VstEventKeeper realtimeEvents_;
+
+	// Pipelined processing state. The host endpoint renders the block N while the VST
+	// host produces the block N+1. The rendered samples pass the output FIFO, which
+	// starts with pipelineDelay_ (the maximum block size) silent samples per channel, so
+	// the latency doesn't depend on the block sizes used by the VST host.
+	bool isPipelined_;
+	size_t slotSize_;
+	i32 nextSlot_;
+	i32 inFlightCount_;
+	DataFrame* pendingFrame_;
+	Command pendingCommand_;
+	i32 initialDelay_;
+	i32 pipelineDelay_;
+	std::vector<double> outputFifo_;
+	i32 fifoChannels_;
+	i32 fifoCapacity_;
+	i32 fifoStart_;
+	i32 fifoLength_;
+
+	// The changed latency is reported to the VST host with the next process call or
+	// effEditIdle, since some hosts don't accept audioMasterIOChanged from within the
+	// effSetBlockSize handler.
+	std::atomic<bool> isIoChanged_;
+
+	// Upper bound of the busy-waiting phase on the audio port (in microseconds).
+	int spinLimit_;
+
+	// Parameter changes are queued and applied by the host endpoint before processing
+	// the next block. In sample accurate mode the block is split at the change offsets.
+	bool isSampleAccurate_;
+	SharedQueue<ParameterChange> parameterQueue_;
+	float sampleRate_;
+	std::atomic<i64> blockStartTime_;
+	std::atomic<i32> blockLength_;
+
+	// Back the audio port with huge pages.
+	bool hasHugePages_;
+
+	// Scheduling of the audio threads on both sides. The audioPriority_ is the resolved
+	// priority sent along with the last block, the callback threads follow it.
+	int realtimePriority_;
+	std::atomic<int> audioPriority_;
+	std::atomic<u64> cpuAffinity_;
+
 	Event condition_;
 
 	int childPid_;
+	bool isPooledHost_;
 
 	std::thread callbackThread_;
-	std::atomic_flag processCallbacks_;
+	std::thread realtimeThread_;
+	std::atomic<bool> processCallbacks_;
+
+	// Automation notifications of the VST plugin are delivered by the callback thread
+	// without holding up the thread, which has sent them.
+	SharedQueue<AutomationEvent> automationQueue_;
+	std::atomic<bool> hasAutomationQueue_;
 	std::thread::id mainThreadId_;
 
-	// When handling audioMasterAutomate, Ardour calls back into the plugin using
-	// getParameter(). It's unclear whether that's VST-legal or not, but at the moment it
-	// seems to deadlock when processReplacing() is going on at the same time.
-	// We will remember the parameter's value and feed it to the host when it will call
-	// getParameter() from audioMasterAutomate handler.
-	i32 lastIndex_;
-	float lastValue_;
-	std::thread::id lastThreadId_;
+	// Parameter values are read from the mirror without any requests to the host endpoint.
+	// This also allows hosts like Ardour to call getParameter() from the
+	// audioMasterAutomate handler, while processReplacing() is going on.
+	ParameterMirror parameters_;
+
+	bool start();
+	bool ensureStarted();
+	bool spawnHost();
+	void setPluginInfo(const PluginInfo& info);
+
+	bool dispatchCached(i32 opcode, i32 index, intptr_t value, void* ptr,
+			intptr_t* result);
+	void recordMetadata(i32 opcode, i32 index, void* ptr, intptr_t result);
+	void recordParameterValues();
 
 	void callbackThread();
+	void realtimeThread();
+	void updateThreadPolicy(int* priority, u64* affinity);
+	void handleAutomationEvents();
 
 	intptr_t setBlockSize(DataPort* port, intptr_t frames);
 
-	intptr_t handleAudioMaster();
+	DataFrame* processSlot(i32 index);
+	void drainPipeline();
+	void flushPipeline();
+	void resetOutputFifo();
+	void notifyIoChanged();
+
+	bool queueParameter(i32 index, float value);
+	void stageEvents(const VstEvents* events);
+
+	template<typename T>
+	void processPipelined(Command command, T** inputs, T** outputs, i32 count);
+
+	template<typename T>
+	void writeInputs(DataFrame* frame, Command command, T** inputs, i32 count);
+
+	template<typename T>
+	void readOutputs(DataFrame* frame, T** outputs, i32 count);
+
+	template<typename T>
+	void pushOutputs(DataFrame* frame);
+
+	template<typename T>
+	void popOutputs(T** outputs, i32 count);
+
+	intptr_t handleAudioMaster(DataPort* port, VstEventKeeper* events);
 
 	intptr_t dispatch(DataPort* port, i32 opcode, i32 index, intptr_t value, void* ptr,
 			float opt);
 
+	bool sendChunkPort(DataPort* port, DataPort* chunkPort, bool isReceiving);
+	std::shared_ptr<Chunk> receiveChunk(DataPort* port, u64 hash, size_t size);
+
 	void sendXembedMessage(Display* display, Window window, long message, long detail,
 			long data1, long data2);
 
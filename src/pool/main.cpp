@@ -0,0 +1,88 @@
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "common/config.h"
+#include "common/storage.h"
+#include "pool/pool.h"
+
+
+using namespace Airwave;
+
+
+static volatile std::sig_atomic_t isTerminated = 0;
+
+
+static void signalHandler(int)
+{
+	isTerminated = 1;
+}
+
+
+static void printUsage(const char* name)
+{
+	printf("Airwave host pool, version " VERSION_STRING "\n");
+	printf("usage: %s [-n <count>] [-s <capacity>] [-p <prefix>] [-l <loader>]\n\n",
+			name);
+	printf("Keeps the booted host endpoints ready for the plugin endpoints, which use\n");
+	printf("the given WINE prefix and loader, so the plugin instances don't wait for\n");
+	printf("WINE to start.\n\n");
+	printf("  -n <count>     idle host endpoints per architecture (default: 2)\n");
+	printf("  -s <capacity>  instances served by one host endpoint (default: 1)\n");
+	printf("  -p <prefix>    name of the WINE prefix (default: default)\n");
+	printf("  -l <loader>    name of the WINE loader (default: default)\n");
+}
+
+
+int main(int argc, char** argv)
+{
+	int count = 2;
+	int capacity = 1;
+	std::string prefix = "default";
+	std::string loader = "default";
+
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+
+		if((arg == "-n" || arg == "-s" || arg == "-p" || arg == "-l") && i + 1 < argc) {
+			std::string value = argv[++i];
+
+			if(arg == "-n") {
+				count = std::atoi(value.c_str());
+			}
+			else if(arg == "-s") {
+				capacity = std::atoi(value.c_str());
+			}
+			else if(arg == "-p") {
+				prefix = value;
+			}
+			else {
+				loader = value;
+			}
+		}
+		else if(arg == "-h" || arg == "--help") {
+			printUsage(argv[0]);
+			return EXIT_SUCCESS;
+		}
+		else {
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// The handler is installed without SA_RESTART, so it interrupts the poll().
+	struct sigaction action;
+	std::memset(&action, 0, sizeof(action));
+	action.sa_handler = signalHandler;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+
+	Storage storage;
+	HostPool pool(&storage, count, capacity);
+
+	if(!pool.initialize(prefix, loader) || !pool.run(&isTerminated))
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,425 @@
+#include "pool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "common/config.h"
+#include "common/filesystem.h"
+#include "common/hash.h"
+#include "common/hostlauncher.h"
+
+
+namespace Airwave {
+
+
+// Interval of the housekeeping (reaping and replacing the host endpoints).
+static const int kTickInterval = 1000;
+
+// Time given to the claimed host endpoint to accept the claim. It is shorter than the
+// plugin endpoint's claim timeout, so the plugin endpoint receives the refusal and
+// starts its own host endpoint.
+static const int kClaimTimeout = 1000;
+
+
+// Number of the environments with their own host endpoints.
+static const size_t kMaxEnvironments = 2;
+
+
+// The WINE settings, display, locale and audio variables. The rest of them (e.g. the
+// working directory) doesn't affect the host endpoint.
+static bool isHostVariable(const std::string& variable)
+{
+	static const char* const kPrefixes[] = { "WINE", "DISPLAY=", "XAUTHORITY=", "LANG",
+			"LC_", "XDG_RUNTIME_DIR=", "PULSE_", "JACK_", "PIPEWIRE_" };
+
+	for(const char* prefix : kPrefixes) {
+		if(variable.compare(0, std::strlen(prefix), prefix) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+
+static u64 hashEnvironment(const std::vector<std::string>& environment)
+{
+	std::vector<std::string> variables;
+	for(const std::string& variable : environment) {
+		if(isHostVariable(variable))
+			variables.push_back(variable);
+	}
+
+	// The order of the variables depends on the process.
+	std::sort(variables.begin(), variables.end());
+
+	std::string block;
+	for(const std::string& variable : variables)
+		block.append(variable.c_str(), variable.size() + 1);
+
+	return hash64(block.data(), block.size());
+}
+
+
+HostPool::HostPool(Storage* storage, int size, int capacity) :
+	storage_(storage),
+	size_(std::max(size, 1)),
+	capacity_(std::max(capacity, 1)),
+	socket_(-1)
+{
+	std::vector<std::string> environment = currentEnvironment();
+	useEnvironment(environment, hashEnvironment(environment));
+}
+
+
+HostPool::~HostPool()
+{
+	if(socket_ >= 0)
+		close(socket_);
+
+	// The claimed host endpoints keep serving their plugin endpoints. So do the servers
+	// with instances, they are retired to exit after their last instance is closed.
+	for(Endpoint& endpoint : endpoints_)
+		retire(endpoint);
+}
+
+
+bool HostPool::initialize(const std::string& prefix, const std::string& loader)
+{
+	Storage::Prefix storagePrefix = storage_->prefix(prefix);
+	if(!storagePrefix) {
+		fprintf(stderr, "Invalid WINE prefix '%s'\n", prefix.c_str());
+		return false;
+	}
+
+	Storage::Loader storageLoader = storage_->loader(loader);
+	if(!storageLoader) {
+		fprintf(stderr, "Invalid WINE loader '%s'\n", loader.c_str());
+		return false;
+	}
+
+	// The paths are resolved the same way as the plugin endpoint does, so the pool
+	// address matches.
+	prefixPath_ = FileSystem::realPath(storagePrefix.path());
+	loaderPath_ = FileSystem::realPath(storageLoader.path());
+
+	if(prefixPath_.empty() || loaderPath_.empty()) {
+		fprintf(stderr, "WINE prefix or loader path doesn't exists\n");
+		return false;
+	}
+
+	for(const char* name : { HOST_BASENAME "-64.exe", HOST_BASENAME "-32.exe" }) {
+		std::string path = storage_->binariesPath() + '/' + name;
+		std::string hostPath = FileSystem::realPath(path);
+		if(!hostPath.empty())
+			hostPaths_.push_back(hostPath);
+	}
+
+	if(hostPaths_.empty()) {
+		fprintf(stderr, "Unable to find host binaries\n");
+		return false;
+	}
+
+	std::string address = hostPoolAddress(prefixPath_, loaderPath_);
+
+	sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	std::memcpy(addr.sun_path + 1, address.data(), address.size());
+	socklen_t addrSize = offsetof(sockaddr_un, sun_path) + 1 + address.size();
+
+	socket_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(socket_ < 0) {
+		fprintf(stderr, "Unable to create pool socket\n");
+		return false;
+	}
+
+	if(bind(socket_, reinterpret_cast<sockaddr*>(&addr), addrSize) != 0 ||
+			listen(socket_, 64) != 0) {
+		fprintf(stderr, "Unable to bind pool socket, is another pool running?\n");
+		close(socket_);
+		socket_ = -1;
+		return false;
+	}
+
+	return true;
+}
+
+
+bool HostPool::run(volatile std::sig_atomic_t* isTerminated)
+{
+	if(socket_ < 0)
+		return false;
+
+	replenish();
+
+	while(!*isTerminated) {
+		pollfd pfd;
+		pfd.fd = socket_;
+		pfd.events = POLLIN;
+
+		int result = poll(&pfd, 1, kTickInterval);
+		if(result < 0 && errno != EINTR) {
+			fprintf(stderr, "Unable to poll pool socket: %s\n", std::strerror(errno));
+			return false;
+		}
+
+		if(result > 0) {
+			int fd = accept4(socket_, nullptr, nullptr, SOCK_CLOEXEC);
+			if(fd >= 0) {
+				serve(fd);
+				close(fd);
+			}
+		}
+
+		reap();
+		replenish();
+	}
+
+	return true;
+}
+
+
+bool HostPool::spawn(const std::string& hostPath, const Environment& environment)
+{
+	std::unique_ptr<DataPort> port(new DataPort);
+	if(!port->create(sizeof(PoolClaim))) {
+		fprintf(stderr, "Unable to create pool port\n");
+		return false;
+	}
+
+	std::vector<std::string> args;
+	args.push_back(capacity_ > 1 ? "--server" : "--pool");
+	args.push_back(std::to_string(port->id()));
+	args.push_back(std::to_string(port->owner()));
+
+	pid_t pid;
+	if(!launchHost(hostPath, prefixPath_, loaderPath_, args, environment.variables,
+			&pid)) {
+		fprintf(stderr, "Unable to start host endpoint '%s'\n", hostPath.c_str());
+		return false;
+	}
+
+	Endpoint endpoint;
+	endpoint.pid = pid;
+	endpoint.hostPath = hostPath;
+	endpoint.port = std::move(port);
+	endpoint.isReady = false;
+	endpoint.instanceCount = 0;
+	endpoint.environmentHash = environment.hash;
+
+	endpoints_.push_back(std::move(endpoint));
+	return true;
+}
+
+
+void HostPool::replenish()
+{
+	for(const Environment& environment : environments_) {
+		for(const std::string& hostPath : hostPaths_) {
+			int count = 0;
+			for(const Endpoint& endpoint : endpoints_) {
+				if(endpoint.hostPath == hostPath &&
+						endpoint.environmentHash == environment.hash) {
+					count++;
+				}
+			}
+
+			for(; count < size_; ++count) {
+				if(!spawn(hostPath, environment))
+					break;
+			}
+		}
+	}
+}
+
+
+void HostPool::reap()
+{
+	// Both the claimed and the idle host endpoints are our children.
+	pid_t pid;
+	while((pid = waitpid(-1, nullptr, WNOHANG)) > 0) {
+		for(auto it = endpoints_.begin(); it != endpoints_.end(); ++it) {
+			if(it->pid != pid)
+				continue;
+
+			if(capacity_ > 1) {
+				fprintf(stderr, "Host server %d has terminated, serving %d instances\n",
+						pid, it->instanceCount);
+			}
+			else {
+				fprintf(stderr, "Idle host endpoint %d has terminated\n", pid);
+			}
+
+			endpoints_.erase(it);
+			break;
+		}
+	}
+}
+
+
+// The idle host endpoint is killed, the one with instances is told to exit after its
+// last instance is closed.
+void HostPool::retire(Endpoint& endpoint)
+{
+	if(endpoint.instanceCount == 0) {
+		kill(endpoint.pid, SIGKILL);
+		waitpid(endpoint.pid, nullptr, 0);
+	}
+	else if(capacity_ > 1) {
+		PoolClaim* retire = endpoint.port->frame<PoolClaim>();
+		retire->portId = kPoolRetire;
+
+		endpoint.port->sendRequest();
+		endpoint.port->waitResponse(kClaimTimeout);
+	}
+}
+
+
+// Moves the environment to the front. The host endpoints of the least recently claimed
+// environment are retired, when there are too many of them.
+void HostPool::useEnvironment(const std::vector<std::string>& variables, u64 hash)
+{
+	auto found = std::find_if(environments_.begin(), environments_.end(),
+			[hash](const Environment& environment) { return environment.hash == hash; });
+
+	if(found != environments_.end()) {
+		std::rotate(environments_.begin(), found, found + 1);
+		return;
+	}
+
+	Environment environment;
+	environment.hash = hash;
+	environment.variables = variables;
+	environments_.insert(environments_.begin(), std::move(environment));
+
+	if(environments_.size() <= kMaxEnvironments)
+		return;
+
+	u64 oldHash = environments_.back().hash;
+	environments_.pop_back();
+
+	fprintf(stderr, "Too many environments of the plugin endpoints, retiring the host "
+			"endpoints of the oldest one\n");
+
+	for(auto it = endpoints_.begin(); it != endpoints_.end();) {
+		if(it->environmentHash == oldHash) {
+			retire(*it);
+			it = endpoints_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+
+void HostPool::serve(int fd)
+{
+	// Accept the claims from the processes of the same user only.
+	ucred credentials;
+	socklen_t size = sizeof(credentials);
+	if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) != 0 ||
+			credentials.uid != getuid()) {
+		return;
+	}
+
+	timeval timeout;
+	timeout.tv_sec = kClaimTimeout / 1000;
+	timeout.tv_usec = (kClaimTimeout % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	PoolClaim request;
+	if(recv(fd, &request, sizeof(request), 0) != sizeof(request))
+		return;
+
+	request.hostPath[kPoolPathSize - 1] = '\0';
+
+	std::vector<char> block(kPoolEnvironmentSize);
+	ssize_t length = recv(fd, block.data(), block.size(), 0);
+	if(length < 0)
+		return;
+
+	std::vector<std::string> environment;
+	const char* it = block.data();
+	const char* end = it + length;
+
+	while(it < end) {
+		size_t size = strnlen(it, end - it);
+		environment.push_back(std::string(it, size));
+		it += size + 1;
+	}
+
+	u64 hash = hashEnvironment(environment);
+
+	i32 result = claim(request, hash);
+	send(fd, &result, sizeof(result), MSG_NOSIGNAL);
+
+	// If the environment is new, the plugin endpoint starts its own host endpoint this
+	// time. The next ones will find the host endpoints started with its environment.
+	useEnvironment(environment, hash);
+}
+
+
+pid_t HostPool::claim(const PoolClaim& request, u64 environmentHash)
+{
+	// The host endpoint posts the response once it is booted and waits for the claim.
+	// The ones still booting are not used, it is faster for the plugin endpoint to
+	// start its own host endpoint than to wait for the unknown amount of time.
+	auto found = endpoints_.end();
+
+	for(auto it = endpoints_.begin(); it != endpoints_.end(); ++it) {
+		if(it->hostPath != request.hostPath || it->environmentHash != environmentHash)
+			continue;
+
+		if(!it->isReady)
+			it->isReady = it->port->waitResponse(0);
+
+		if(!it->isReady)
+			continue;
+
+		// Prefer the server, which already has the DLL loaded.
+		if(found == endpoints_.end() || it->vstPaths.count(request.vstPath)) {
+			found = it;
+
+			if(it->vstPaths.count(request.vstPath))
+				break;
+		}
+	}
+
+	if(found == endpoints_.end())
+		return 0;
+
+	std::memcpy(found->port->frameBuffer(), &request, sizeof(PoolClaim));
+	found->port->sendRequest();
+
+	pid_t pid = found->pid;
+
+	if(!found->port->waitResponse(kClaimTimeout)) {
+		fprintf(stderr, "Idle host endpoint %d is not responding\n", pid);
+		kill(pid, SIGKILL);
+		endpoints_.erase(found);
+		return 0;
+	}
+
+	found->instanceCount++;
+	found->vstPaths.insert(request.vstPath);
+
+	if(found->instanceCount >= capacity_) {
+		// The full server exits after its last instance is closed.
+		retire(*found);
+		endpoints_.erase(found);
+	}
+
+	return pid;
+}
+
+
+} // namespace Airwave
@@ -0,0 +1,79 @@
+#ifndef POOL_POOL_H
+#define POOL_POOL_H
+
+#include <csignal>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "common/dataport.h"
+#include "common/protocol.h"
+#include "common/storage.h"
+
+
+namespace Airwave {
+
+
+// Keeps a number of booted and idle host endpoints for the WINE prefix. The plugin
+// endpoints claim them through the pool socket (see claimPooledHost) instead of
+// starting their own host endpoint processes, so they don't wait for WINE to boot.
+// The claimed host endpoints are replaced in the background. They are started with the
+// environment of the plugin endpoints, which have claimed them (initially with the
+// environment of the daemon). A few of the recently claimed environments have their own
+// host endpoints, only the variables the host endpoint depends on are compared.
+// With the capacity greater than one, the host endpoints are started in the server mode
+// and serve up to capacity instances each. The instances of the same DLL are put into the
+// same process where possible, so they share the code pages and the WINE runtime.
+class HostPool {
+public:
+	HostPool(Storage* storage, int size, int capacity = 1);
+	~HostPool();
+
+	bool initialize(const std::string& prefix, const std::string& loader);
+
+	// Serves the claims until the isTerminated flag is set (by a signal handler).
+	bool run(volatile std::sig_atomic_t* isTerminated);
+
+private:
+	struct Endpoint {
+		pid_t pid;
+		std::string hostPath;
+		std::unique_ptr<DataPort> port;
+		bool isReady;
+		int instanceCount;
+		std::set<std::string> vstPaths;
+		u64 environmentHash;
+	};
+
+	struct Environment {
+		u64 hash;
+		std::vector<std::string> variables;
+	};
+
+	Storage* storage_;
+	int size_;
+	int capacity_;
+	int socket_;
+
+	std::string prefixPath_;
+	std::string loaderPath_;
+	std::vector<std::string> hostPaths_;
+	std::vector<Endpoint> endpoints_;
+
+	// The most recently claimed environment goes first.
+	std::vector<Environment> environments_;
+
+	bool spawn(const std::string& hostPath, const Environment& environment);
+	void replenish();
+	void reap();
+	void retire(Endpoint& endpoint);
+	void useEnvironment(const std::vector<std::string>& variables, u64 hash);
+	void serve(int fd);
+	pid_t claim(const PoolClaim& claim, u64 environmentHash);
+};
+
+
+} // namespace Airwave
+
+
+#endif // POOL_POOL_H
@@ -0,0 +1,92 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common/config.h"
+#include "common/logger.h"
+#include "common/storage.h"
+#include "scanner/scanner.h"
+
+
+using namespace Airwave;
+
+
+static void printUsage(const char* name)
+{
+	printf("Airwave plugin scanner, version " VERSION_STRING "\n");
+	printf("usage: %s [-j <jobs>] [-p <prefix>] [-l <loader>] [<directory>...]\n\n",
+			name);
+	printf("Fills the metadata cache with the information about the VST plugins, so\n");
+	printf("the DAW plugin scan doesn't need to start WINE. Without directories, all\n");
+	printf("of the links are scanned. Otherwise, every DLL found in the directories\n");
+	printf("is scanned using the given WINE prefix and loader.\n\n");
+	printf("  -j <jobs>    number of parallel scans (default: number of cores)\n");
+	printf("  -p <prefix>  name of the WINE prefix (default: default)\n");
+	printf("  -l <loader>  name of the WINE loader (default: default)\n");
+}
+
+
+int main(int argc, char** argv)
+{
+	int jobCount = std::thread::hardware_concurrency();
+	std::string prefix = "default";
+	std::string loader = "default";
+	std::vector<std::string> directories;
+
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+
+		if((arg == "-j" || arg == "-p" || arg == "-l") && i + 1 < argc) {
+			std::string value = argv[++i];
+
+			if(arg == "-j") {
+				jobCount = std::atoi(value.c_str());
+			}
+			else if(arg == "-p") {
+				prefix = value;
+			}
+			else {
+				loader = value;
+			}
+		}
+		else if(arg == "-h" || arg == "--help") {
+			printUsage(argv[0]);
+			return EXIT_SUCCESS;
+		}
+		else if(arg[0] == '-') {
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		else {
+			directories.push_back(arg);
+		}
+	}
+
+	Storage storage;
+
+	// The logger is shared by all of the scan jobs.
+	loggerInit(storage.logSocketPath(), PROJECT_NAME "-scanner");
+
+	Scanner scanner(&storage, jobCount);
+
+	if(directories.empty()) {
+		for(Storage::Link link = storage.link(); !link.isNull(); link = link.next())
+			scanner.addLink(link);
+	}
+	else {
+		for(const std::string& directory : directories)
+			scanner.addDirectory(directory, prefix, loader);
+	}
+
+	int failCount = scanner.run();
+	loggerFree();
+
+	if(failCount) {
+		fprintf(stderr, "Unable to scan %d VST plugins\n", failCount);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,276 @@
+#include "scanner.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+#include <dirent.h>
+#include <thread>
+#include "common/config.h"
+#include "common/filesystem.h"
+#include "common/moduleinfo.h"
+#include "plugin/plugin.h"
+
+
+namespace Airwave {
+
+
+// The effCanDo strings asked by the DAWs during the plugin scan.
+static const char* kCanDoStrings[] = {
+	"sendVstEvents",
+	"sendVstMidiEvent",
+	"receiveVstEvents",
+	"receiveVstMidiEvent",
+	"receiveVstTimeInfo",
+	"offline",
+	"midiProgramNames",
+	"bypass",
+	"MPE"
+};
+
+
+Scanner::Scanner(Storage* storage, int jobCount) :
+	storage_(storage),
+	jobCount_(std::max(jobCount, 1)),
+	nextJob_(0),
+	doneCount_(0),
+	failCount_(0)
+{
+}
+
+
+bool Scanner::addLink(Storage::Link link)
+{
+	Storage::Prefix prefix = storage_->prefix(link.prefix());
+	if(!prefix) {
+		fprintf(stderr, "Invalid WINE prefix '%s'\n", link.prefix().c_str());
+		return false;
+	}
+
+	std::string prefixPath = FileSystem::realPath(prefix.path());
+	return addJob(prefixPath + '/' + link.target(), link.prefix(), link.loader());
+}
+
+
+int Scanner::addDirectory(const std::string& path, const std::string& prefix,
+		const std::string& loader)
+{
+	DIR* dir = opendir(path.c_str());
+	if(!dir) {
+		fprintf(stderr, "Unable to open directory '%s'\n", path.c_str());
+		return 0;
+	}
+
+	int count = 0;
+
+	while(dirent* entry = readdir(dir)) {
+		std::string name = entry->d_name;
+		if(name == "." || name == "..")
+			continue;
+
+		std::string filePath = path + '/' + name;
+
+		if(FileSystem::isDirExists(filePath)) {
+			count += addDirectory(filePath, prefix, loader);
+		}
+		else if(name.size() > 4 &&
+				strcasecmp(name.c_str() + name.size() - 4, ".dll") == 0) {
+			if(addJob(filePath, prefix, loader))
+				count++;
+		}
+	}
+
+	closedir(dir);
+	return count;
+}
+
+
+int Scanner::run()
+{
+	// Keep the jobs of the same prefix together.
+	std::stable_sort(jobs_.begin(), jobs_.end(), [](const Job& a, const Job& b) {
+		return a.prefixPath < b.prefixPath;
+	});
+
+	int count = std::min(jobCount_, static_cast<int>(jobs_.size()));
+
+	std::vector<std::thread> threads;
+	for(int i = 0; i < count; ++i)
+		threads.emplace_back(&Scanner::worker, this);
+
+	for(std::thread& thread : threads)
+		thread.join();
+
+	return failCount_;
+}
+
+
+bool Scanner::addJob(const std::string& vstPath, const std::string& prefix,
+		const std::string& loader)
+{
+	Storage::Prefix storagePrefix = storage_->prefix(prefix);
+	if(!storagePrefix) {
+		fprintf(stderr, "Invalid WINE prefix '%s'\n", prefix.c_str());
+		return false;
+	}
+
+	Storage::Loader storageLoader = storage_->loader(loader);
+	if(!storageLoader) {
+		fprintf(stderr, "Invalid WINE loader '%s'\n", loader.c_str());
+		return false;
+	}
+
+	Job job;
+	job.vstPath = FileSystem::realPath(vstPath);
+	job.prefixPath = FileSystem::realPath(storagePrefix.path());
+	job.loaderPath = FileSystem::realPath(storageLoader.path());
+
+	if(job.vstPath.empty()) {
+		fprintf(stderr, "VST binary '%s' doesn't exists\n", vstPath.c_str());
+		return false;
+	}
+
+	ModuleInfo::Module module;
+	if(!ModuleInfo::instance()->getModule(job.vstPath, &module)) {
+		fprintf(stderr, "Unable to determine architecture of '%s'\n",
+				job.vstPath.c_str());
+		return false;
+	}
+
+	// The directories usually contain the helper DLLs along with the plugins.
+	if(!module.isVstPlugin) {
+		fprintf(stderr, "Skipping '%s', it is not a VST plugin\n", job.vstPath.c_str());
+		return false;
+	}
+
+	std::string hostName;
+	if(module.arch == ModuleInfo::kArch64) {
+		hostName = HOST_BASENAME "-64.exe";
+	}
+	else {
+		hostName = HOST_BASENAME "-32.exe";
+	}
+
+	job.hostPath = FileSystem::realPath(storage_->binariesPath() + '/' + hostName);
+	if(job.hostPath.empty()) {
+		fprintf(stderr, "Host binary '%s' doesn't exists\n", hostName.c_str());
+		return false;
+	}
+
+	jobs_.push_back(job);
+	return true;
+}
+
+
+void Scanner::worker()
+{
+	for(;;) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if(nextJob_ >= jobs_.size())
+			return;
+
+		const Job& job = jobs_[nextJob_++];
+		lock.unlock();
+
+		bool result = scan(job);
+
+		lock.lock();
+		doneCount_++;
+		if(!result)
+			failCount_++;
+
+		printf("[%d/%d] %s %s\n", doneCount_, static_cast<int>(jobs_.size()),
+				result ? "done  " : "failed", job.vstPath.c_str());
+
+		fflush(stdout);
+	}
+}
+
+
+bool Scanner::scan(const Job& job)
+{
+	// The plugin endpoint records the answers and saves them to the metadata cache,
+	// when it is closed. The existing entry only provides the binary identity, the VST
+	// plugin is always queried.
+	PluginMetadata metadata;
+	MetadataCache().load(job.vstPath, &metadata);
+
+	Plugin* plugin = new Plugin(job.vstPath, job.hostPath, job.prefixPath,
+			job.loaderPath, storage_->logSocketPath(), audioMasterProc, metadata, false);
+
+	AEffect* effect = plugin->effect();
+	if(!effect) {
+		delete plugin;
+		return false;
+	}
+
+	char buffer[256];
+
+	effect->dispatcher(effect, effOpen, 0, 0, nullptr, 0.0f);
+	effect->dispatcher(effect, effGetVstVersion, 0, 0, nullptr, 0.0f);
+	effect->dispatcher(effect, effGetVendorVersion, 0, 0, nullptr, 0.0f);
+	effect->dispatcher(effect, effGetPlugCategory, 0, 0, nullptr, 0.0f);
+
+	std::memset(buffer, 0, sizeof(buffer));
+	effect->dispatcher(effect, effGetEffectName, 0, 0, buffer, 0.0f);
+
+	std::memset(buffer, 0, sizeof(buffer));
+	effect->dispatcher(effect, effGetVendorString, 0, 0, buffer, 0.0f);
+
+	std::memset(buffer, 0, sizeof(buffer));
+	effect->dispatcher(effect, effGetProductString, 0, 0, buffer, 0.0f);
+
+	for(i32 i = 0; i < effect->numParams; ++i) {
+		std::memset(buffer, 0, sizeof(buffer));
+		effect->dispatcher(effect, effGetParamName, i, 0, buffer, 0.0f);
+	}
+
+	for(i32 i = 0; i < effect->numPrograms; ++i) {
+		std::memset(buffer, 0, sizeof(buffer));
+		effect->dispatcher(effect, effGetProgramNameIndexed, i, 0, buffer, 0.0f);
+	}
+
+	for(const char* string : kCanDoStrings) {
+		std::strncpy(buffer, string, sizeof(buffer));
+		effect->dispatcher(effect, effCanDo, 0, 0, buffer, 0.0f);
+	}
+
+	// The plugin endpoint is destroyed here.
+	effect->dispatcher(effect, effClose, 0, 0, nullptr, 0.0f);
+	return true;
+}
+
+
+intptr_t Scanner::audioMasterProc(AEffect* effect, i32 opcode, i32 index,
+		intptr_t value, void* ptr, float opt)
+{
+	UNUSED(effect);
+	UNUSED(index);
+	UNUSED(value);
+	UNUSED(opt);
+
+	switch(opcode) {
+	case audioMasterVersion:
+		return kVstVersion;
+
+	case audioMasterGetSampleRate:
+		return 44100;
+
+	case audioMasterGetVendorString:
+		vst_strncpy(static_cast<char*>(ptr), "airwave", kVstMaxVendorStrLen - 1);
+		return 1;
+
+	case audioMasterGetProductString:
+		vst_strncpy(static_cast<char*>(ptr), PROJECT_NAME "-scanner",
+				kVstMaxProductStrLen - 1);
+		return 1;
+
+	case audioMasterGetVendorVersion:
+		return VERSION_MAJOR * 1000 + VERSION_MINOR * 100 + VERSION_PATCH;
+	}
+
+	return 0;
+}
+
+
+} // namespace Airwave
@@ -0,0 +1,59 @@
+#ifndef SCANNER_SCANNER_H
+#define SCANNER_SCANNER_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include "common/storage.h"
+#include "common/vst24.h"
+
+
+namespace Airwave {
+
+
+// Runs the host endpoints of the VST plugins on a bounded pool of worker threads and
+// collects their metadata into the metadata cache. The plugins are scanned prefix by
+// prefix, so the concurrently running host endpoints share the same wineserver.
+class Scanner {
+public:
+	Scanner(Storage* storage, int jobCount);
+
+	bool addLink(Storage::Link link);
+	int addDirectory(const std::string& path, const std::string& prefix,
+			const std::string& loader);
+
+	// Returns the number of VST plugins, which were failed to scan.
+	int run();
+
+private:
+	struct Job {
+		std::string vstPath;
+		std::string hostPath;
+		std::string prefixPath;
+		std::string loaderPath;
+	};
+
+	Storage* storage_;
+	int jobCount_;
+
+	std::vector<Job> jobs_;
+	size_t nextJob_;
+	int doneCount_;
+	int failCount_;
+	std::mutex mutex_;
+
+	bool addJob(const std::string& vstPath, const std::string& prefix,
+			const std::string& loader);
+
+	void worker();
+	bool scan(const Job& job);
+
+	static intptr_t audioMasterProc(AEffect* effect, i32 opcode, i32 index,
+			intptr_t value, void* ptr, float opt);
+};
+
+
+} // namespace Airwave
+
+
+#endif // SCANNER_SCANNER_H
@@ -0,0 +1,80 @@
+#include <cstring>
+#include <string>
+#include "common/logdecoder.h"
+#include "common/logger.h"
+#include "test.h"
+
+
+using namespace Airwave;
+
+
+static const u64 kSession = 0x1234;
+
+
+static std::string header(LogDatagram kind, u32 id)
+{
+	std::string datagram(sizeof(u64), '\0');
+	datagram += "test";
+	datagram += static_cast<char>(kind);
+	datagram.append(reinterpret_cast<const char*>(&kSession), sizeof(u64));
+	datagram.append(reinterpret_cast<const char*>(&id), sizeof(u32));
+	return datagram;
+}
+
+
+// Registers the format and decodes the record with the given arguments.
+template<typename... Args>
+static std::string format(const char* text, const Args&... args)
+{
+	static u32 id = 0;
+	id++;
+
+	LogDecoder decoder;
+	u64 timestamp;
+	LogLevel level;
+	std::string sender;
+	std::string result;
+
+	std::string datagram = header(LogDatagram::kFormat, id);
+	datagram += static_cast<char>(LogLevel::kDebug);
+	datagram.append(text, std::strlen(text) + 1);
+	decoder.decode(datagram.data(), datagram.size(), &timestamp, &level, &sender,
+			&result);
+
+	u8 buffer[256];
+	LogWriter writer;
+	writer.pos = buffer;
+	writer.end = buffer + sizeof(buffer);
+	loggerWriteArgs(&writer, args...);
+
+	datagram = header(LogDatagram::kRecord, id);
+	datagram.append(reinterpret_cast<const char*>(buffer), writer.pos - buffer);
+
+	if(!decoder.decode(datagram.data(), datagram.size(), &timestamp, &level, &sender,
+			&result)) {
+		return "(not decoded)";
+	}
+
+	return result;
+}
+
+
+bool testLogDecoder()
+{
+	CHECK(format("%d %u", -5, 7u) == "-5 7");
+	CHECK(format("%x %X", -1, -2) == "ffffffff FFFFFFFE");
+	CHECK(format("%llx", static_cast<i64>(-1)) == "ffffffffffffffff");
+	CHECK(format("%lx", static_cast<u64>(1) << 40) == "10000000000");
+	CHECK(format("%hx %hhx", -1, -1) == "ffff ff");
+	CHECK(format("%08x", 0xbeef) == "0000beef");
+	CHECK(format("[%*d]", 5, 42) == "[   42]");
+	CHECK(format("[%-*d]", 4, 7) == "[7   ]");
+	CHECK(format("[%.*s]", 3, "abcdef") == "[abc]");
+	CHECK(format("[%*.*f]", 8, 2, 3.14159) == "[    3.14]");
+	CHECK(format("[%.*s]", -1, "abc") == "[abc]");
+	CHECK(format("%d %d", 1) == "1 (missing)");
+	CHECK(format("%s", "text") == "text");
+	CHECK(format("100%%") == "100%");
+
+	return true;
+}
@@ -0,0 +1,35 @@
+#include <cstdio>
+#include <cstring>
+#include "test.h"
+
+
+struct Test {
+	const char* name;
+	bool (*function)();
+};
+
+
+static const Test kTests[] = {
+	{ "logdecoder",    testLogDecoder    },
+	{ "metadatacache", testMetadataCache }
+};
+
+
+// Runs the test given as the argument, or all of them.
+int main(int argc, char* argv[])
+{
+	int failedCount = 0;
+
+	for(const Test& test : kTests) {
+		if(argc > 1 && std::strcmp(argv[1], test.name) != 0)
+			continue;
+
+		bool isPassed = test.function();
+		std::printf("%s: %s\n", test.name, isPassed ? "passed" : "FAILED");
+
+		if(!isPassed)
+			failedCount++;
+	}
+
+	return failedCount > 0 ? 1 : 0;
+}
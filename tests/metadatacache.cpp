@@ -0,0 +1,92 @@
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "common/metadatacache.h"
+#include "test.h"
+
+
+using namespace Airwave;
+
+
+static bool writeFile(const std::string& path, const std::string& content)
+{
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+	file << content;
+	return file.good();
+}
+
+
+// Moves the modification time of the file to the past, keeping the content.
+static bool touchFile(const std::string& path, time_t seconds)
+{
+	timeval times[2];
+	times[0].tv_sec = seconds;
+	times[0].tv_usec = 0;
+	times[1] = times[0];
+	return utimes(path.c_str(), times) == 0;
+}
+
+
+bool testMetadataCache()
+{
+	char directory[] = "/tmp/airwave-test-XXXXXX";
+	CHECK(mkdtemp(directory));
+
+	std::string root = directory;
+	setenv("XDG_CACHE_HOME", root.c_str(), 1);
+
+	std::string vstPath = root + "/plugin.dll";
+	CHECK(writeFile(vstPath, "MZ fake plugin binary"));
+
+	PluginMetadata metadata;
+
+	// There is no entry yet, but the identity is filled to save it.
+	CHECK(!MetadataCache().load(vstPath, &metadata));
+	CHECK(metadata.fileSize == 21);
+	CHECK(metadata.fileHash != 0);
+
+	metadata.info.paramCount = 12;
+	metadata.info.uniqueId = 0x41697277;
+	metadata.values["vst_version"] = 2400;
+	metadata.strings["effect_name"] = "Fake";
+	metadata.parameterNames[3] = "Cutoff";
+	metadata.programNames[0] = "Init";
+	metadata.canDo["receiveVstMidiEvent"] = 1;
+	metadata.parameterValues[3] = 0.25f;
+	CHECK(MetadataCache().save(vstPath, metadata));
+
+	PluginMetadata loaded;
+	CHECK(MetadataCache().load(vstPath, &loaded));
+	CHECK(loaded.fileSize == metadata.fileSize);
+	CHECK(loaded.fileTime == metadata.fileTime);
+	CHECK(loaded.fileHash == metadata.fileHash);
+	CHECK(loaded.info.paramCount == 12);
+	CHECK(loaded.info.uniqueId == 0x41697277);
+	CHECK(loaded.values["vst_version"] == 2400);
+	CHECK(loaded.strings["effect_name"] == "Fake");
+	CHECK(loaded.parameterNames[3] == "Cutoff");
+	CHECK(loaded.programNames[0] == "Init");
+	CHECK(loaded.canDo["receiveVstMidiEvent"] == 1);
+	CHECK(loaded.parameterValues[3] == 0.25f);
+
+	// The touched binary with the same content is still valid.
+	CHECK(touchFile(vstPath, 1000000000));
+	loaded = PluginMetadata();
+	CHECK(MetadataCache().load(vstPath, &loaded));
+	CHECK(loaded.fileHash == metadata.fileHash);
+	CHECK(loaded.fileTime != metadata.fileTime);
+
+	// The changed binary is not.
+	CHECK(writeFile(vstPath, "MZ fake plugin binarY"));
+	CHECK(touchFile(vstPath, 1100000000));
+	loaded = PluginMetadata();
+	CHECK(!MetadataCache().load(vstPath, &loaded));
+	CHECK(loaded.fileHash != metadata.fileHash);
+
+	std::string command = "rm -rf '" + root + "'";
+	CHECK(std::system(command.c_str()) == 0);
+	return true;
+}
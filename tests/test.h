@@ -0,0 +1,22 @@
+#ifndef TESTS_TEST_H
+#define TESTS_TEST_H
+
+#include <cstdio>
+
+
+// Fails the running test, if the condition doesn't hold.
+#define CHECK(condition) \
+		do { \
+			if(!(condition)) { \
+				std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+						#condition); \
+				return false; \
+			} \
+		} while(0)
+
+
+bool testLogDecoder();
+bool testMetadataCache();
+
+
+#endif // TESTS_TEST_H